@@ -0,0 +1,148 @@
+/*
+ *******************************************************************************
+ *
+ *	ADMISSION CONTROL OF NEW QUERY CLASSES
+ *
+ * In the intelligent and learn modes each unknown query class is registered in
+ * the aqo_queries and aqo_query_texts tables just during its planning. Ad-hoc
+ * queries never repeat, so this work is wasted for them.
+ *
+ * This module counts sightings of unknown query classes in a shared table (see
+ * aqo_shared.c). A class is admitted into the knowledge base only if it was
+ * planned aqo.admission_threshold times within aqo.admission_window seconds.
+ * Forgotten and one-off classes are evicted from the table as the least
+ * recently used entries.
+ *
+ * Besides of that, the planner admits a pending class immediately, if the
+ * cost of its plan isn't less than aqo.admission_cost_threshold: learning on
+ * expensive queries is worth to start early (see preprocessing.c).
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/admission.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "utils/timestamp.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "admission.h"
+
+
+int		aqo_admission_threshold = 1;
+int		aqo_admission_window = 3600;
+double	aqo_admission_cost_threshold = 0.;
+int		aqo_admission_size = 10000;
+
+typedef struct AdmissionKey
+{
+	Oid		dbid;
+	int		qhash;
+} AdmissionKey;
+
+typedef struct AdmissionEntry
+{
+	AdmissionKey		key;
+
+	pg_atomic_uint64	lru;
+	TimestampTz			first_seen;	/* start of the current window */
+	int					nseen;		/* sightings within the window */
+} AdmissionEntry;
+
+
+static inline void
+init_admission_key(AdmissionKey *key, int qhash)
+{
+	memset(key, 0, sizeof(AdmissionKey));
+	key->dbid = MyDatabaseId;
+	key->qhash = qhash;
+}
+
+/*
+ * Account one more sighting of the unknown query class and decide, whether it
+ * should be added into the knowledge base.
+ * If the admission control is disabled, any class is admitted.
+ */
+bool
+query_class_admitted(int qhash)
+{
+	AdmissionKey	key;
+	AdmissionEntry *entry;
+	TimestampTz		now;
+	bool			found;
+	int				nseen;
+	bool			admitted;
+
+	if (aqo_admission_threshold <= 1)
+		return true;
+
+	init_admission_key(&key, qhash);
+	entry = (AdmissionEntry *) aqo_shared_insert(AQO_ADMISSION_TABLE,
+												 &key, &found);
+	if (entry == NULL)
+		/* The shared table is disabled. */
+		return true;
+
+	now = GetCurrentStatementStartTimestamp();
+	if (!found || (aqo_admission_window > 0 &&
+		TimestampDifferenceExceeds(entry->first_seen, now,
+								   aqo_admission_window * 1000)))
+	{
+		/* Start a new window */
+		entry->first_seen = now;
+		entry->nseen = 0;
+	}
+
+	nseen = ++entry->nseen;
+	admitted = (nseen >= aqo_admission_threshold);
+
+	if (admitted)
+		/* The class is going to the knowledge base. Don't track it anymore. */
+		aqo_shared_delete_entry(AQO_ADMISSION_TABLE, entry);
+	else
+		aqo_shared_release(AQO_ADMISSION_TABLE, entry);
+
+	elog(DEBUG1, "AQO: class %d is %s after %d sightings", qhash,
+		 admitted ? "admitted" : "pending", nseen);
+	return admitted;
+}
+
+/*
+ * Stop tracking of the query class. Called, if it was admitted bypassing the
+ * counter.
+ */
+void
+admission_forget(int qhash)
+{
+	AdmissionKey key;
+
+	init_admission_key(&key, qhash);
+	(void) aqo_shared_delete(AQO_ADMISSION_TABLE, &key);
+}
+
+/*
+ * Remove counters of the database. InvalidOid means all databases.
+ * Returns number of removed entries.
+ */
+long
+admission_reset(Oid dbid)
+{
+	return aqo_shared_remove_database(AQO_ADMISSION_TABLE, dbid);
+}
+
+void
+admission_init(void)
+{
+	aqo_shared_register_table(AQO_ADMISSION_TABLE, "aqo_admission",
+							  sizeof(AdmissionKey), sizeof(AdmissionEntry),
+							  offsetof(AdmissionEntry, lru),
+							  &aqo_admission_size);
+}
@@ -0,0 +1,17 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "postgres.h"
+
+extern PGDLLIMPORT int aqo_admission_threshold;
+extern PGDLLIMPORT int aqo_admission_window;
+extern PGDLLIMPORT double aqo_admission_cost_threshold;
+extern PGDLLIMPORT int aqo_admission_size;
+
+extern bool query_class_admitted(int qhash);
+extern void admission_forget(int qhash);
+extern long admission_reset(Oid dbid);
+
+extern void admission_init(void);
+
+#endif /* ADMISSION_H */
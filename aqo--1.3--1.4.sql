@@ -0,0 +1,271 @@
+--
+-- Reset the shared cache of feature subspaces if someone changed the
+-- aqo_data table manually.
+--
+CREATE FUNCTION aqo_invalidate_fss_cache() RETURNS trigger
+	AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE TRIGGER aqo_data_invalidate AFTER UPDATE OR DELETE OR TRUNCATE
+	ON public.aqo_data FOR EACH STATEMENT
+	EXECUTE PROCEDURE aqo_invalidate_fss_cache();
+
+--
+-- Launch a background worker which loads the most used feature subspaces of
+-- the current database into the shared cache. Returns pid of the worker.
+--
+CREATE OR REPLACE FUNCTION public.aqo_prewarm()
+RETURNS integer
+AS 'MODULE_PATHNAME', 'aqo_prewarm'
+LANGUAGE C STRICT;
+
+--
+-- Remove all cached data of the current database from shared memory.
+-- Returns a number of removed entries.
+--
+CREATE OR REPLACE FUNCTION public.aqo_cache_reset()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_cache_reset'
+LANGUAGE C STRICT;
+
+--
+-- Publish a read-only image of the knowledge base of the current database for
+-- the frozen mode. Returns a number of feature subspaces in the image.
+--
+CREATE OR REPLACE FUNCTION public.aqo_publish_snapshot()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_publish_snapshot'
+LANGUAGE C STRICT;
+
+--
+-- Remove the published image. Returns false if there was nothing to remove.
+--
+CREATE OR REPLACE FUNCTION public.aqo_drop_snapshot()
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'aqo_drop_snapshot'
+LANGUAGE C STRICT;
+
+--
+-- Write the knowledge base of the current database into a file in a binary
+-- format. Returns number of written records.
+--
+CREATE OR REPLACE FUNCTION public.aqo_export(path text,
+											 with_stats boolean DEFAULT false)
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_export'
+LANGUAGE C STRICT;
+
+--
+-- Load the knowledge base from a file, written by the aqo_export(). The mode
+-- defines what to do with already existed objects: 'replace' them, 'merge'
+-- feature subspaces by learning on the imported objects or 'skip' them.
+-- Returns number of imported records.
+--
+CREATE OR REPLACE FUNCTION public.aqo_import(path text,
+											 mode text DEFAULT 'merge')
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_import'
+LANGUAGE C STRICT;
+
+--
+-- Remove data of dropped relations from the knowledge base right in the
+-- dropping transaction.
+--
+CREATE INDEX aqo_data_oids_idx ON public.aqo_data USING gin (oids);
+
+CREATE FUNCTION aqo_drop_cleanup() RETURNS event_trigger
+	AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE EVENT TRIGGER aqo_drop_cleanup ON sql_drop
+	EXECUTE PROCEDURE aqo_drop_cleanup();
+
+--
+-- Remove data, related to previously dropped tables, from the AQO tables.
+-- Feature subspaces which refer to dropped relations are removed together
+-- with query classes which own them in their own feature spaces.
+--
+CREATE OR REPLACE FUNCTION public.clean_aqo_data() RETURNS void AS $$
+DECLARE
+  dropped oid[];
+BEGIN
+  RAISE NOTICE 'Cleaning aqo_data records';
+
+  SELECT array_agg(DISTINCT oid_var) INTO dropped
+  FROM aqo_data, unnest(oids) AS oid_var
+  WHERE NOT EXISTS (SELECT 1 FROM pg_class WHERE oid = oid_var);
+
+  IF (dropped IS NULL) THEN
+    RETURN;
+  END IF;
+
+  -- Keep the COMMON feature space and the shared pool of subspaces (-1).
+  DELETE FROM aqo_queries
+  WHERE query_hash NOT IN (0, -1) AND query_hash = fspace_hash AND
+        fspace_hash IN (SELECT fspace_hash FROM aqo_data WHERE oids && dropped);
+  DELETE FROM aqo_data WHERE oids && dropped;
+END;
+$$ LANGUAGE plpgsql;
+
+--
+-- Usage of feature subspaces. Counters are flushed here lazily from shared
+-- memory.
+--
+CREATE TABLE public.aqo_fss_usage (
+	fspace_hash		int NOT NULL,
+	fsspace_hash	int NOT NULL,
+	last_used		timestamptz,
+	nhits			bigint NOT NULL DEFAULT 0,
+	PRIMARY KEY (fspace_hash, fsspace_hash)
+);
+
+--
+-- Flush usage counters and remove the least valuable feature subspaces to meet
+-- limits of the knowledge base. Returns number of removed subspaces.
+--
+CREATE OR REPLACE FUNCTION public.aqo_evict()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_evict'
+LANGUAGE C STRICT;
+
+--
+-- Models and machine learning parameters of feature spaces. NULL means the
+-- default: the aqo.model setting for the model and built-in values for the
+-- parameters.
+--
+CREATE TABLE public.aqo_fspace_settings (
+	fspace_hash					int PRIMARY KEY,
+	model						text CHECK (model IN ('knn', 'linear')),
+	k							int CHECK (k BETWEEN 1 AND 30),
+	learning_rate				double precision
+								CHECK (learning_rate > 0 AND learning_rate <= 1),
+	object_selection_threshold	double precision
+								CHECK (object_selection_threshold >= 0),
+	log_selectivity_lower_bound	double precision
+								CHECK (log_selectivity_lower_bound <= 0)
+);
+
+CREATE FUNCTION public.aqo_fspace_settings_changed()
+RETURNS trigger
+AS 'MODULE_PATHNAME', 'aqo_fspace_settings_changed'
+LANGUAGE C;
+
+CREATE TRIGGER aqo_fspace_settings_changed
+	AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON public.aqo_fspace_settings
+	FOR EACH STATEMENT EXECUTE PROCEDURE public.aqo_fspace_settings_changed();
+
+--
+-- Set machine learning parameters of the feature space. NULL resets the
+-- parameter to the default. Learned data of the feature space is kept.
+--
+CREATE OR REPLACE FUNCTION public.aqo_set_fspace_params(
+	fspace_hash int,
+	k int DEFAULT NULL,
+	learning_rate double precision DEFAULT NULL,
+	object_selection_threshold double precision DEFAULT NULL,
+	log_selectivity_lower_bound double precision DEFAULT NULL)
+RETURNS void AS $$
+  INSERT INTO public.aqo_fspace_settings AS s
+	(fspace_hash, k, learning_rate, object_selection_threshold,
+	 log_selectivity_lower_bound)
+  VALUES (aqo_set_fspace_params.fspace_hash, aqo_set_fspace_params.k,
+		  aqo_set_fspace_params.learning_rate,
+		  aqo_set_fspace_params.object_selection_threshold,
+		  aqo_set_fspace_params.log_selectivity_lower_bound)
+  ON CONFLICT (fspace_hash) DO UPDATE SET
+	k = EXCLUDED.k,
+	learning_rate = EXCLUDED.learning_rate,
+	object_selection_threshold = EXCLUDED.object_selection_threshold,
+	log_selectivity_lower_bound = EXCLUDED.log_selectivity_lower_bound;
+$$ LANGUAGE sql;
+
+--
+-- Number of trivial queries, planned without AQO since the server start
+-- (see aqo.skip_trivial_queries).
+--
+CREATE OR REPLACE FUNCTION public.aqo_skipped_trivial_queries()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_skipped_trivial_queries'
+LANGUAGE C STRICT;
+
+--
+-- Number of plannings, which exhausted the budget of AQO since the server
+-- start (see aqo.planning_budget and aqo.prediction_budget).
+--
+CREATE OR REPLACE FUNCTION public.aqo_exhausted_budgets()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_exhausted_budgets'
+LANGUAGE C STRICT;
+
+--
+-- Plan baselines of converged query classes (see aqo.plan_baselines). A pinned
+-- baseline is never replaced or removed by AQO.
+--
+CREATE TABLE public.aqo_plan_baselines (
+	query_hash	int PRIMARY KEY REFERENCES public.aqo_queries ON DELETE CASCADE,
+	signature	text NOT NULL,
+	pinned		boolean NOT NULL DEFAULT false,
+	captured	timestamptz NOT NULL DEFAULT now()
+);
+
+CREATE FUNCTION public.aqo_plan_baselines_changed()
+RETURNS trigger
+AS 'MODULE_PATHNAME', 'aqo_plan_baselines_changed'
+LANGUAGE C;
+
+CREATE TRIGGER aqo_plan_baselines_changed
+	AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON public.aqo_plan_baselines
+	FOR EACH STATEMENT EXECUTE PROCEDURE public.aqo_plan_baselines_changed();
+
+--
+-- Pin or unpin the plan baseline of the query class. Returns false, if the
+-- class has no baseline.
+--
+CREATE OR REPLACE FUNCTION public.aqo_pin_baseline(query_hash int,
+												   pin boolean DEFAULT true)
+RETURNS boolean AS $$
+  WITH pinned AS (
+	UPDATE public.aqo_plan_baselines AS b SET pinned = aqo_pin_baseline.pin
+	WHERE b.query_hash = aqo_pin_baseline.query_hash
+	RETURNING 1)
+  SELECT count(*) > 0 FROM pinned;
+$$ LANGUAGE sql;
+
+--
+-- Remove the plan baseline of the query class. A converged class can get a new
+-- baseline after the next execution.
+--
+CREATE OR REPLACE FUNCTION public.aqo_drop_baseline(query_hash int)
+RETURNS boolean AS $$
+  WITH dropped AS (
+	DELETE FROM public.aqo_plan_baselines AS b
+	WHERE b.query_hash = aqo_drop_baseline.query_hash
+	RETURNING 1)
+  SELECT count(*) > 0 FROM dropped;
+$$ LANGUAGE sql;
+
+--
+-- Number of invalidations of cached plans since the server start (see
+-- aqo.replan_threshold).
+--
+CREATE OR REPLACE FUNCTION public.aqo_plan_invalidations()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_plan_invalidations'
+LANGUAGE C STRICT;
+
+--
+-- Mean cardinality errors of the default estimator and of AQO on plan nodes of
+-- query classes, executed in the shadow mode (see aqo.shadow_mode).
+--
+CREATE OR REPLACE FUNCTION public.aqo_shadow_report()
+RETURNS TABLE (
+  query_hash integer,		-- Query class identifier
+  executions bigint,		-- Number of executions in the shadow mode
+  nodes bigint,				-- Number of compared plan nodes
+  error_default float,		-- Mean error of the default estimations
+  error_aqo float,			-- Mean error of the predictions of AQO
+  improvement float			-- Percentage of the error, which AQO would remove
+)
+AS 'MODULE_PATHNAME', 'aqo_shadow_report'
+LANGUAGE C STRICT;
+
+-- Data of a previous installation could stay in shared memory.
+SELECT public.aqo_cache_reset();
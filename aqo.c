@@ -18,11 +18,27 @@
 #include "utils/selfuncs.h"
 
 #include "aqo.h"
+#include "admission.h"
+#include "aqo_shared.h"
+#include "aqo_snapshot.h"
+#include "baseline.h"
 #include "cardinality_hooks.h"
+#include "cleanup.h"
+#include "coarse_index.h"
+#include "drift.h"
+#include "eviction.h"
+#include "fast_path.h"
+#include "fss_cache.h"
+#include "hash.h"
 #include "ignorance.h"
+#include "model.h"
 #include "path_utils.h"
 #include "preprocessing.h"
+#include "prewarm.h"
 #include "profile_mem.h"
+#include "replan.h"
+#include "shadow.h"
+#include "settings_cache.h"
 
 
 PG_MODULE_MAGIC;
@@ -50,6 +66,54 @@ bool	force_collect_stat;
 bool	aqo_show_hash;
 bool	aqo_show_details;
 
+/*
+ * Shared pool of feature subspaces.
+ *
+ * aqo_shared_fss - use the reserved feature space AQO_SHARED_FSPACE as a
+ * fallback for predictions, and learn it on samples of all the query classes.
+ *
+ * aqo_shared_fss_sample_rate - fraction of samples, learned in the pool.
+ */
+bool	aqo_shared_fss = false;
+double	aqo_shared_fss_sample_rate = 0.1;
+
+/*
+ * Confidence of predictions.
+ *
+ * aqo_confidence_refuse_threshold - a prediction with lower confidence is
+ * refused in favor of the standard estimation.
+ *
+ * aqo_confidence_blend_threshold - a prediction with lower confidence is
+ * blended with the standard estimation.
+ *
+ * aqo_show_confidence - show confidence of predictions in EXPLAIN, if
+ * aqo_show_details is on.
+ */
+double	aqo_confidence_refuse_threshold = 0.;
+double	aqo_confidence_blend_threshold = 0.;
+bool	aqo_show_confidence = false;
+
+/*
+ * Planning budget of AQO. If the time spent by AQO during the planning (in
+ * microseconds) or the number of predictions exceeds the budget, the rest of
+ * the query is planned by the standard estimators. Zero means no limit.
+ */
+int		aqo_planning_budget = 0;
+int		aqo_prediction_budget = 0;
+
+/*
+ * Learning on aborted queries. Rows, returned by the nodes of a learned query
+ * before an error or a cancel, are learned later as lower bounds of their
+ * cardinalities.
+ */
+bool	aqo_learn_aborted = false;
+
+/*
+ * Learning on plan nodes, which could be stopped before the end of data. They
+ * are learned as completed ones by default.
+ */
+int		aqo_incomplete_nodes = AQO_INCOMPLETE_LEARN;
+
 /* GUC variables */
 static const struct config_enum_entry format_options[] = {
 	{"intelligent", AQO_MODE_INTELLIGENT, false},
@@ -61,6 +125,38 @@ static const struct config_enum_entry format_options[] = {
 	{NULL, 0, false}
 };
 
+static const struct config_enum_entry eviction_policy_options[] = {
+	{"lru", AQO_EVICTION_LRU, false},
+	{"lfu", AQO_EVICTION_LFU, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry auto_tuning_method_options[] = {
+	{"legacy", AQO_TUNING_LEGACY, false},
+	{"thompson", AQO_TUNING_THOMPSON, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry skip_trivial_options[] = {
+	{"off", AQO_SKIP_TRIVIAL_OFF, false},
+	{"unique", AQO_SKIP_TRIVIAL_UNIQUE, false},
+	{"single", AQO_SKIP_TRIVIAL_SINGLE, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry incomplete_nodes_options[] = {
+	{"learn", AQO_INCOMPLETE_LEARN, false},
+	{"skip", AQO_INCOMPLETE_SKIP, false},
+	{"lower_bound", AQO_INCOMPLETE_LOWER_BOUND, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry model_options[] = {
+	{"knn", AQO_MODEL_KNN, false},
+	{"linear", AQO_MODEL_LINEAR, false},
+	{NULL, 0, false}
+};
+
 /* Parameters of autotuning */
 int			aqo_stat_size = 20;
 int			auto_tuning_window_size = 5;
@@ -104,6 +200,7 @@ int njoins;
 post_parse_analyze_hook_type				prev_post_parse_analyze_hook;
 planner_hook_type							prev_planner_hook;
 ExecutorStart_hook_type						prev_ExecutorStart_hook;
+ExecutorRun_hook_type						prev_ExecutorRun_hook;
 ExecutorEnd_hook_type						prev_ExecutorEnd_hook;
 set_baserel_rows_estimate_hook_type			prev_set_foreign_rows_estimate_hook;
 set_baserel_rows_estimate_hook_type			prev_set_baserel_rows_estimate_hook;
@@ -133,6 +230,7 @@ aqo_free_callback(ResourceReleasePhase phase,
 	{
 		list_free(cur_classes);
 		cur_classes = NIL;
+		baseline_finish();
 	}
 }
 
@@ -162,6 +260,34 @@ _PG_init(void)
 							 NULL
 	);
 
+	DefineCustomEnumVariable("aqo.auto_tuning_method",
+							 "Method of the automatic query tuning.",
+							 NULL,
+							 &auto_tuning_method,
+							 AQO_TUNING_LEGACY,
+							 auto_tuning_method_options,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.auto_tuning_size",
+							 "Sets the maximum number of query classes, tracked by the auto tuning.",
+							 "Used by the \"thompson\" method only. Zero disables it.",
+							 &auto_tuning_size,
+							 10000,
+							 0,
+							 INT_MAX / 2,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
 	DefineCustomBoolVariable(
 							 "aqo.force_collect_stat",
 							 "Collect statistics at all AQO modes",
@@ -222,7 +348,7 @@ _PG_init(void)
 							 100,
 							 -1,
 							 INT_MAX,
-							 PGC_POSTMASTER, /* Defines a max size of used shared memory segment. So, change only on restart. */
+							 PGC_SIGHUP,
 							 0,
 							 NULL,
 							 NULL,
@@ -242,10 +368,698 @@ _PG_init(void)
 							 NULL
 	);
 
+	DefineCustomIntVariable(
+							 "aqo.fss_cache_size",
+							 "Sets the maximum number of feature subspaces cached in shared memory.",
+							 "Zero disables the cache.",
+							 &aqo_fss_cache_size,
+							 0,
+							 0,
+							 INT_MAX / 2,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.settings_cache_size",
+							 "Sets the maximum number of query settings cached in shared memory.",
+							 "Zero disables the cache.",
+							 &aqo_settings_cache_size,
+							 1000,
+							 0,
+							 INT_MAX / 2,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.dsm_size_max",
+							 "Maximum size of dynamic shared memory which AQO could allocate to store its data.",
+							 "Least recently used entries are evicted when the limit is reached.",
+							 &aqo_dsm_size_max,
+							 100,
+							 1,
+							 INT_MAX / 1024,
+							 PGC_SIGHUP,
+							 GUC_UNIT_MB,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.prewarm",
+							 "Load the AQO knowledge base into the shared cache on startup.",
+							 NULL,
+							 &aqo_prewarm_enable,
+							 false,
+							 PGC_POSTMASTER,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomStringVariable(
+							 "aqo.bgworker_database",
+							 "Database used by AQO background workers launched on startup.",
+							 NULL,
+							 &aqo_bgworker_database,
+							 "postgres",
+							 PGC_POSTMASTER,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.prewarm_delay",
+							 "Sleep time between batches of the AQO prewarm worker.",
+							 NULL,
+							 &aqo_prewarm_delay,
+							 10,
+							 0,
+							 10000,
+							 PGC_SIGHUP,
+							 GUC_UNIT_MS,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.cleanup_dropped",
+							 "Remove data of dropped relations from the AQO knowledge base.",
+							 NULL,
+							 &aqo_cleanup_dropped,
+							 true,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.fss_usage_size",
+							 "Sets the maximum number of feature subspaces which usage is tracked in shared memory.",
+							 "Zero disables the tracking.",
+							 &aqo_fss_usage_size,
+							 10000,
+							 0,
+							 INT_MAX / 2,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.max_fss",
+							 "Sets the maximum number of feature subspaces in the knowledge base of a database.",
+							 "Zero means no limit.",
+							 &aqo_max_fss,
+							 0,
+							 0,
+							 INT_MAX,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.max_fss_per_fspace",
+							 "Sets the maximum number of feature subspaces in a feature space.",
+							 "Zero means no limit.",
+							 &aqo_max_fss_per_fspace,
+							 0,
+							 0,
+							 INT_MAX,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.max_kb_size",
+							 "Sets the maximum size of feature subspaces in the knowledge base of a database.",
+							 "Zero means no limit.",
+							 &aqo_max_kb_size,
+							 0,
+							 0,
+							 INT_MAX,
+							 PGC_SUSET,
+							 GUC_UNIT_KB,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomEnumVariable("aqo.eviction_policy",
+							 "Defines which feature subspaces are evicted first, when the knowledge base exceeds its limits.",
+							 NULL,
+							 &aqo_eviction_policy,
+							 AQO_EVICTION_LRU,
+							 eviction_policy_options,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.eviction",
+							 "Launch a background worker which enforces limits of the knowledge base.",
+							 NULL,
+							 &aqo_eviction_enable,
+							 false,
+							 PGC_POSTMASTER,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.eviction_naptime",
+							 "Sleep time between runs of the AQO eviction worker.",
+							 NULL,
+							 &aqo_eviction_naptime,
+							 60,
+							 1,
+							 INT_MAX / 1000,
+							 PGC_SIGHUP,
+							 GUC_UNIT_S,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.admission_threshold",
+							 "Sets the number of executions of a new query class before it will be added into the knowledge base.",
+							 "Used in the intelligent and learn modes. One means that any new query class is added immediately.",
+							 &aqo_admission_threshold,
+							 1,
+							 1,
+							 INT_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.admission_window",
+							 "Sets the time window to count executions of a new query class.",
+							 "Zero means no limit.",
+							 &aqo_admission_window,
+							 3600,
+							 0,
+							 INT_MAX / 1000,
+							 PGC_USERSET,
+							 GUC_UNIT_S,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomRealVariable(
+							 "aqo.admission_cost_threshold",
+							 "Sets the plan cost above which a new query class is added into the knowledge base immediately.",
+							 "Zero disables it.",
+							 &aqo_admission_cost_threshold,
+							 0.,
+							 0.,
+							 DBL_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.admission_size",
+							 "Sets the maximum number of new query classes which executions are counted in shared memory.",
+							 "Zero disables the admission control.",
+							 &aqo_admission_size,
+							 10000,
+							 0,
+							 INT_MAX / 2,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.normalize_lists",
+							 "Map queries with IN-lists and VALUES lists of different lengths into the same query class.",
+							 NULL,
+							 &aqo_normalize_lists,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.list_length_feature",
+							 "Use the length of an IN-list as a feature of the feature subspace.",
+							 NULL,
+							 &aqo_list_length_feature,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.hybrid_model",
+							 "Use the standard cardinality estimation as a feature of the model.",
+							 "Models, learned with and without this feature, are stored separately.",
+							 &aqo_hybrid_model,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomEnumVariable("aqo.model",
+							 "Default model of feature subspaces.",
+							 "The model of a feature space can be set in the aqo_fspace_settings table.",
+							 &aqo_model,
+							 AQO_MODEL_KNN,
+							 model_options,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.shared_fss",
+							 "Share feature subspaces between feature spaces through a reserved feature space.",
+							 NULL,
+							 &aqo_shared_fss,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomRealVariable(
+							 "aqo.shared_fss_sample_rate",
+							 "Sets the fraction of learning samples stored in the shared pool of feature subspaces.",
+							 NULL,
+							 &aqo_shared_fss_sample_rate,
+							 0.1,
+							 0.,
+							 1.,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.coarse_fallback",
+							 "Predict cardinality of an unknown feature subspace by a coarser model.",
+							 NULL,
+							 &aqo_coarse_fallback,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.coarse_max_missing",
+							 "Sets the maximum number of clauses, unknown to a coarser model.",
+							 NULL,
+							 &aqo_coarse_max_missing,
+							 1,
+							 0,
+							 INT_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomRealVariable(
+							 "aqo.coarse_confidence",
+							 "Sets the confidence of a prediction by a coarser model.",
+							 "It is reduced in the power of the number of unknown clauses plus one. The prediction is blended with the standard estimation according to the confidence.",
+							 &aqo_coarse_confidence,
+							 0.5,
+							 0.,
+							 1.,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.coarse_index_size",
+							 "Sets the maximum number of relation sets in the index of coarser models.",
+							 "Zero disables the index.",
+							 &aqo_coarse_index_size,
+							 10000,
+							 0,
+							 INT_MAX / 2,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomRealVariable(
+							 "aqo.confidence_refuse_threshold",
+							 "Sets the confidence, below which a prediction is refused.",
+							 "The standard estimation is used instead of the refused prediction.",
+							 &aqo_confidence_refuse_threshold,
+							 0.,
+							 0.,
+							 1.,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomRealVariable(
+							 "aqo.confidence_blend_threshold",
+							 "Sets the confidence, below which a prediction is blended with the standard estimation.",
+							 NULL,
+							 &aqo_confidence_blend_threshold,
+							 0.,
+							 0.,
+							 1.,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomRealVariable(
+							 "aqo.drift_threshold",
+							 "Sets the relative number of tuple modifications, after which a learned feature subspace is untrusted.",
+							 "Predictions of the drifted subspace are refused, and its next learning starts from scratch. Zero disables the drift detection.",
+							 &aqo_drift_threshold,
+							 0.,
+							 0.,
+							 DBL_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.drift_table_size",
+							 "Sets the maximum number of feature subspaces, tracked by the drift detection.",
+							 "Zero disables the drift detection.",
+							 &aqo_drift_table_size,
+							 10000,
+							 0,
+							 INT_MAX / 2,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomEnumVariable("aqo.skip_trivial_queries",
+							 "Plans trivial queries without AQO.",
+							 "'unique' skips lookups of one relation by a unique key, 'single' skips any query over one relation without joins, aggregates and subqueries.",
+							 &aqo_skip_trivial_queries,
+							 AQO_SKIP_TRIVIAL_OFF,
+							 skip_trivial_options,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomRealVariable(
+							 "aqo.fast_path_overhead",
+							 "Sets the part of the execution time, which the overhead of AQO may take for a query class.",
+							 "A class with a bigger overhead is planned without AQO for aqo.fast_path_ttl seconds. Zero disables the fast path.",
+							 &aqo_fast_path_overhead,
+							 0.,
+							 0.,
+							 DBL_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.fast_path_ttl",
+							 "Sets the time, during which a cheap query class is planned without AQO.",
+							 NULL,
+							 &aqo_fast_path_ttl,
+							 300,
+							 1,
+							 INT_MAX / 1000,
+							 PGC_USERSET,
+							 GUC_UNIT_S,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.fast_path_size",
+							 "Sets the maximum number of query classes, tracked by the fast path.",
+							 "Zero disables the fast path.",
+							 &aqo_fast_path_size,
+							 10000,
+							 0,
+							 INT_MAX / 2,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.show_confidence",
+							 "Show confidence of predictions on explain.",
+							 "Takes effect with aqo.show_details only.",
+							 &aqo_show_confidence,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.planning_budget",
+							 "Sets the maximum time in microseconds, which AQO may spend on planning of a query.",
+							 "The rest of the query is planned by the standard estimators. Zero means no limit.",
+							 &aqo_planning_budget,
+							 0,
+							 0,
+							 INT_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.prediction_budget",
+							 "Sets the maximum number of predictions, which AQO may make during planning of a query.",
+							 "The rest of the query is planned by the standard estimators. Zero means no limit.",
+							 &aqo_prediction_budget,
+							 0,
+							 0,
+							 INT_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.learn_aborted",
+							 "Learn on queries, interrupted by an error or a cancel.",
+							 "Rows, returned by plan nodes before the error, are learned as lower bounds of their cardinalities.",
+							 &aqo_learn_aborted,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomEnumVariable("aqo.incomplete_nodes",
+							 "Sets the way of learning on plan nodes, which could be stopped before the end of data.",
+							 "A LIMIT, a semi-join, an EXISTS sublink or a cursor can stop a node early. Such a node can be learned as usual, skipped or learned as a lower bound of its cardinality.",
+							 &aqo_incomplete_nodes,
+							 AQO_INCOMPLETE_LEARN,
+							 incomplete_nodes_options,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomRealVariable(
+							 "aqo.replan_threshold",
+							 "Sets the ratio of learned and planned cardinalities of a node, which invalidates a cached plan.",
+							 "Zero disables the invalidation.",
+							 &aqo_replan_threshold,
+							 0.,
+							 0.,
+							 DBL_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.replan_interval",
+							 "Sets the minimal interval between invalidations of cached plans of a query class.",
+							 "Zero means no limit.",
+							 &aqo_replan_interval,
+							 60,
+							 0,
+							 INT_MAX / 1000,
+							 PGC_USERSET,
+							 GUC_UNIT_S,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.replan_size",
+							 "Sets the maximum number of query classes, tracked by the invalidation of cached plans.",
+							 "Zero disables the invalidation.",
+							 &aqo_replan_size,
+							 10000,
+							 0,
+							 INT_MAX / 2,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.shadow_mode",
+							 "Plans queries by the default estimations and compares them with the predictions of AQO.",
+							 "Errors of both are shown by aqo_shadow_report().",
+							 &aqo_shadow_mode,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.shadow_size",
+							 "Sets the maximum number of query classes, tracked by the shadow mode.",
+							 "Zero disables the tracking.",
+							 &aqo_shadow_size,
+							 10000,
+							 0,
+							 INT_MAX / 2,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.plan_baselines",
+							 "Plans converged query classes by their plan baselines.",
+							 "The plan of a converged class is captured into the aqo_plan_baselines table.",
+							 &aqo_plan_baselines,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable(
+							 "aqo.baseline_revalidation",
+							 "Sets the period of re-validation of plan baselines in plannings of a query class.",
+							 "Such a planning is made by predictions of AQO. Zero disables the re-validation.",
+							 &aqo_baseline_revalidation,
+							 100,
+							 0,
+							 INT_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
 	prev_planner_hook							= planner_hook;
 	planner_hook								= aqo_planner;
 	prev_ExecutorStart_hook						= ExecutorStart_hook;
 	ExecutorStart_hook							= aqo_ExecutorStart;
+	prev_ExecutorRun_hook						= ExecutorRun_hook;
+	ExecutorRun_hook							= aqo_ExecutorRun;
 	prev_ExecutorEnd_hook						= ExecutorEnd_hook;
 	ExecutorEnd_hook							= aqo_ExecutorEnd;
 
@@ -266,6 +1080,12 @@ _PG_init(void)
 	prev_create_plan_hook						= create_plan_hook;
 	create_plan_hook							= aqo_create_plan_hook;
 
+	/* Steering to plan baselines. */
+	prev_set_rel_pathlist_hook					= set_rel_pathlist_hook;
+	set_rel_pathlist_hook						= aqo_set_rel_pathlist;
+	prev_join_search_hook						= join_search_hook;
+	join_search_hook							= aqo_join_search;
+
 	/* Service hooks. */
 	prev_ExplainOnePlan_hook					= ExplainOnePlan_hook;
 	ExplainOnePlan_hook							= print_into_explain;
@@ -275,9 +1095,6 @@ _PG_init(void)
 	prev_create_upper_paths_hook				= create_upper_paths_hook;
 	create_upper_paths_hook						= aqo_store_upper_signature_hook;
 
-	prev_shmem_startup_hook						= shmem_startup_hook;
-	shmem_startup_hook							= profile_shmem_startup;
-
 	init_deactivated_queries_storage();
 	AQOMemoryContext = AllocSetContextCreate(TopMemoryContext,
 											 "AQOMemoryContext",
@@ -285,24 +1102,68 @@ _PG_init(void)
 	RegisterResourceReleaseCallback(aqo_free_callback, NULL);
 	RegisterAQOPlanNodeMethods();
 
-	/* Set shared memory hooks. */
-				profile_init();
+	/* Register shared tables and set shared memory hooks. */
+	profile_init();
+	fss_cache_init();
+	settings_cache_init();
+	snapshot_init();
+	eviction_init();
+	admission_init();
+	coarse_index_init();
+	drift_init();
+	auto_tuning_init();
+	fast_path_init();
+	replan_init();
+	shadow_init();
+	aqo_shared_init();
+	prewarm_init();
 }
 
 PG_FUNCTION_INFO_V1(invalidate_deactivated_queries_cache);
 
 /*
- * Clears the cache of deactivated queries if the user changed aqo_queries
- * manually.
+ * Clears the cache of deactivated queries and cached query settings if the user
+ * changed aqo_queries manually.
  */
 Datum
 invalidate_deactivated_queries_cache(PG_FUNCTION_ARGS)
 {
 	fini_deactivated_queries_storage();
 	init_deactivated_queries_storage();
+	(void) settings_cache_reset(MyDatabaseId);
 	PG_RETURN_POINTER(NULL);
 }
 
+PG_FUNCTION_INFO_V1(aqo_cache_reset);
+
+/*
+ * Remove all cached data of the current database from shared memory.
+ * Returns a number of removed entries.
+ */
+Datum
+aqo_cache_reset(PG_FUNCTION_ARGS)
+{
+	int64	removed;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("only superuser can reset the AQO caches")));
+
+	removed = fss_cache_reset(MyDatabaseId);
+	removed += settings_cache_reset(MyDatabaseId);
+	removed += snapshot_drop(MyDatabaseId);
+	removed += fss_usage_reset(MyDatabaseId);
+	removed += admission_reset(MyDatabaseId);
+	removed += coarse_index_reset(MyDatabaseId);
+	removed += drift_reset(MyDatabaseId);
+	removed += auto_tuning_reset(MyDatabaseId);
+	removed += fast_path_reset(MyDatabaseId);
+	removed += replan_reset(MyDatabaseId);
+	removed += shadow_reset(MyDatabaseId);
+	PG_RETURN_INT64(removed);
+}
+
 /*
  * Return AQO schema's Oid or InvalidOid if that's not possible.
  */
@@ -173,6 +173,43 @@ extern bool	force_collect_stat;
 extern bool aqo_show_hash;
 extern bool aqo_show_details;
 
+/*
+ * Shared pool of feature subspaces. It has its own reserved feature space,
+ * registered in the aqo_queries table as a virtual query, like the COMMON one.
+ */
+#define AQO_SHARED_FSPACE	(-1)
+
+extern bool aqo_shared_fss;
+extern double aqo_shared_fss_sample_rate;
+
+/* Confidence of predictions */
+extern double aqo_confidence_refuse_threshold;
+extern double aqo_confidence_blend_threshold;
+extern bool aqo_show_confidence;
+
+/* Planning budget of AQO */
+extern int	aqo_planning_budget;
+extern int	aqo_prediction_budget;
+
+/* Learning on aborted queries */
+extern bool	aqo_learn_aborted;
+
+/*
+ * Learning on plan nodes, which could be stopped before the end of data by a
+ * LIMIT, a semi-join, an EXISTS sublink or a cursor.
+ */
+typedef enum
+{
+	/* Learn as completed nodes */
+	AQO_INCOMPLETE_LEARN = 0,
+	/* Don't learn */
+	AQO_INCOMPLETE_SKIP,
+	/* Learn as lower bounds of the cardinalities */
+	AQO_INCOMPLETE_LOWER_BOUND
+} AQOIncompletePolicy;
+
+extern int	aqo_incomplete_nodes;
+
 /*
  * It is mostly needed for auto tuning of query. with auto tuning mode aqo
  * checks stability of last executions of the query, bad influence of strong
@@ -222,6 +259,24 @@ typedef struct QueryContextData
 
 	instr_time	start_execution_time;
 	double		planning_time;
+
+	/* Core query identifier and time spent by AQO itself (see fast_path.c) */
+	uint64		query_id;
+	double		overhead_time;
+
+	/* Number of predictions and state of the planning budget */
+	int			npredictions;
+	bool		budget_exhausted;
+
+	/* Planning by the plan baseline of the class (see baseline.c) */
+	bool		use_baseline;
+	bool		check_baseline;
+
+	/* The last run of the executor was stopped by the count of rows */
+	bool		stopped_early;
+
+	/* Predictions are made, but not used (see shadow.c) */
+	bool		shadow;
 } QueryContextData;
 
 extern double predicted_ppi_rows;
@@ -235,6 +290,18 @@ extern int	auto_tuning_max_iterations;
 extern int	auto_tuning_infinite_loop;
 extern double auto_tuning_convergence_error;
 
+/* Method of the automatic query tuning */
+typedef enum
+{
+	/* Sigmoid over windowed means. Decision is stored after each execution */
+	AQO_TUNING_LEGACY = 0,
+	/* Thompson sampling over shared posteriors of the total time */
+	AQO_TUNING_THOMPSON
+} AQOAutoTuningMethod;
+
+extern int	auto_tuning_method;
+extern int	auto_tuning_size;
+
 /* Machine learning parameters */
 
 /* Max number of matrix rows - max number of possible neighbors. */
@@ -246,6 +313,19 @@ extern const double learning_rate;
 extern int	aqo_k;
 extern double log_selectivity_lower_bound;
 
+/*
+ * Machine learning parameters of a feature space. By default, they are equal to
+ * the global ones above, but can be overridden in the aqo_fspace_settings table
+ * (see model.c).
+ */
+typedef struct AQOModelParams
+{
+	int		k;
+	double	learning_rate;
+	double	object_selection_threshold;
+	double	log_selectivity_lower_bound;
+} AQOModelParams;
+
 /* Parameters for current query */
 extern QueryContextData query_context;
 extern int njoins;
@@ -257,6 +337,7 @@ extern MemoryContext AQOMemoryContext;
 extern post_parse_analyze_hook_type prev_post_parse_analyze_hook;
 extern planner_hook_type prev_planner_hook;
 extern ExecutorStart_hook_type prev_ExecutorStart_hook;
+extern ExecutorRun_hook_type prev_ExecutorRun_hook;
 extern ExecutorEnd_hook_type prev_ExecutorEnd_hook;
 extern set_baserel_rows_estimate_hook_type
 										prev_set_foreign_rows_estimate_hook;
@@ -281,6 +362,10 @@ int get_clause_hash(Expr *clause, int nargs, int *args_hash, int *eclass_hash);
 
 /* Storage interaction */
 extern bool find_query(int qhash, Datum *search_values, bool *search_nulls);
+extern bool find_fspace_settings(int fhash, Datum *values, bool *nulls);
+extern bool find_baseline(int qhash, Datum *values, bool *nulls);
+extern bool update_baseline(int qhash, const char *signature);
+extern bool delete_baseline(int qhash);
 extern bool update_query(int qhash, int fhash,
 						 bool learn_aqo, bool use_aqo, bool auto_tuning);
 extern bool add_query_text(int query_hash, const char *query_string);
@@ -308,23 +393,50 @@ extern void print_into_explain(PlannedStmt *plannedstmt, IntoClause *into,
 extern void print_node_explain(ExplainState *es, PlanState *ps, Plan *plan);
 
 /* Cardinality estimation */
+struct AQOModelRoutine;
+extern bool load_fss_for_prediction(int fss_hash, int ncols, double **matrix,
+									double *targets, int *rows, List *relids,
+									const struct AQOModelRoutine **model,
+									AQOModelParams *params);
 double predict_for_relation(List *restrict_clauses, List *selectivities,
-					 List *relids, int *fss_hash);
+					 List *relids, double default_rows, int *fss_hash,
+					 double *confidence);
+extern void get_prediction_info(int fss_hash, double *confidence,
+								double *default_rows, double *shadow);
+extern void record_shadow_prediction(int fss_hash, double rows);
+extern bool aqo_budget_exhausted(void);
+extern void prediction_info_clear(void);
 
 /* Query execution statistics collecting hooks */
 void		aqo_ExecutorStart(QueryDesc *queryDesc, int eflags);
+void		aqo_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction,
+							uint64 count, bool execute_once);
 void		aqo_ExecutorEnd(QueryDesc *queryDesc);
 
 /* Machine learning techniques */
 extern double OkNNr_predict(int nrows, int ncols,
 							double **matrix, const double *targets,
-							double *features);
+							double *features, double *confidence,
+							const AQOModelParams *params);
 extern int OkNNr_learn(int matrix_rows, int matrix_cols,
 			double **matrix, double *targets,
-			double *features, double target);
+			double *features, double target,
+			const AQOModelParams *params);
+extern double NLMS_predict(int nrows, int ncols,
+						   double **matrix, const double *targets,
+						   double *features, double *confidence,
+						   const AQOModelParams *params);
+extern int NLMS_learn(int nrows, int ncols,
+					  double **matrix, double *targets,
+					  double *features, double target,
+					  const AQOModelParams *params);
 
 /* Automatic query tuning */
 extern void automatical_query_tuning(int query_hash, QueryStat * stat);
+extern bool auto_tuning_choose(int query_hash, bool use_aqo);
+extern bool converged_cq(double *elems, int nelems);
+extern long auto_tuning_reset(Oid dbid);
+extern void auto_tuning_init(void);
 
 /* Utilities */
 int			int_cmp(const void *a, const void *b);
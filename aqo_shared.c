@@ -0,0 +1,666 @@
+/*
+ *******************************************************************************
+ *
+ *	SHARED STATE OF AQO
+ *
+ * AQO keeps some of its data in shared memory: profiling of query classes,
+ * caches of feature subspaces and query settings, published snapshots of the
+ * knowledge base, usage counters of feature subspaces, sightings of unknown
+ * query classes and an index of feature subspaces by sets of relations. All
+ * these tables are dshash tables, allocated in one DSA area. So, they don't
+ * need any memory reserved at startup and may grow and shrink at runtime.
+ *
+ * Size of each table is limited by its own GUC (in entries), and total size of
+ * all the tables is limited by the aqo.dsm_size_max GUC. When a limit is
+ * reached, a batch of least recently used entries is evicted. If the room still
+ * can't be made, the new entry isn't inserted. The memory accounting is
+ * approximate: it takes into account the size of entries only.
+ * A table without a limit is never evicted. Its owner is responsible for the
+ * memory, referenced by the entries.
+ *
+ * Only a tiny fixed-size structure with handles of the DSA area and the tables
+ * is allocated at the postmaster startup.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/aqo_shared.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "storage/dsm.h"
+#include "storage/shmem.h"
+
+#include "aqo_shared.h"
+
+
+/* Part of a table to evict, when its limit is reached. */
+#define AQO_EVICTION_FRACTION	(10)
+
+typedef struct AQOSharedTableDesc
+{
+	const char		   *name;
+	dshash_parameters	params;
+	Size				lru_offset;		/* offset of pg_atomic_uint64 LRU stamp */
+	int				   *max_entries;	/* GUC, <= 0 disables the table, NULL
+										 * means no limit */
+} AQOSharedTableDesc;
+
+int		aqo_dsm_size_max = 100;
+
+shmem_request_hook_type prev_shmem_request_hook = NULL;
+shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static AQOSharedTableDesc tables_desc[AQO_SHARED_TABLES_NUM];
+static AQOSharedState *aqo_state = NULL;
+static dsa_area *aqo_dsa = NULL;
+static dshash_table *aqo_htabs[AQO_SHARED_TABLES_NUM];
+
+/*
+ * Generations, changed by the current transaction. They are advanced in shared
+ * memory at the commit only, see aqo_shared_next_generation_at_commit().
+ */
+static bool pending_generations[AQO_GENERATIONS_NUM];
+/* Advances of the generations, visible to the current backend only */
+static uint64 local_generations[AQO_GENERATIONS_NUM];
+static bool generations_callback = false;
+
+
+static inline pg_atomic_uint64 *
+lru_stamp(AQOSharedTableId id, void *entry)
+{
+	return (pg_atomic_uint64 *) ((char *) entry + tables_desc[id].lru_offset);
+}
+
+static inline void
+touch_entry(AQOSharedTableId id, void *entry)
+{
+	pg_atomic_write_u64(lru_stamp(id, entry),
+						pg_atomic_fetch_add_u64(&aqo_state->lru_clock, 1));
+}
+
+/*
+ * Register a shared table. Must be called from the _PG_init() routine.
+ * Each entry of the table must contain a pg_atomic_uint64 field for an LRU
+ * stamp at 'lru_offset'.
+ */
+void
+aqo_shared_register_table(AQOSharedTableId id, const char *name,
+						  Size keysize, Size entrysize,
+						  Size lru_offset, int *max_entries)
+{
+	AQOSharedTableDesc *desc = &tables_desc[id];
+
+	Assert(id < AQO_SHARED_TABLES_NUM && desc->name == NULL);
+	Assert(lru_offset >= keysize &&
+		   lru_offset + sizeof(pg_atomic_uint64) <= entrysize);
+
+	desc->name = name;
+	desc->params.key_size = keysize;
+	desc->params.entry_size = entrysize;
+	desc->params.compare_function = dshash_memcmp;
+	desc->params.hash_function = dshash_memhash;
+	desc->lru_offset = lru_offset;
+	desc->max_entries = max_entries;
+}
+
+/*
+ * Create the DSA area or attach to it.
+ * Returns false if it isn't possible in this process.
+ */
+static bool
+attach_dsa(void)
+{
+	MemoryContext	oldcxt;
+
+	if (aqo_dsa != NULL)
+		return true;
+
+	if (aqo_state == NULL || !IsUnderPostmaster)
+		return false;
+
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+	LWLockAcquire(aqo_state->lock, LW_EXCLUSIVE);
+	LWLockRegisterTranche(aqo_state->tranche_id, "aqo_dsa");
+
+	if (aqo_state->dsa == DSM_HANDLE_INVALID)
+	{
+		aqo_dsa = dsa_create(aqo_state->tranche_id);
+		dsa_pin(aqo_dsa);
+		aqo_state->dsa = dsa_get_handle(aqo_dsa);
+	}
+	else
+		aqo_dsa = dsa_attach(aqo_state->dsa);
+
+	/* Keep the area mapped until the end of the backend. */
+	dsa_pin_mapping(aqo_dsa);
+
+	LWLockRelease(aqo_state->lock);
+	MemoryContextSwitchTo(oldcxt);
+	return true;
+}
+
+/*
+ * Get the shared table. If it doesn't exist yet, create it or return NULL,
+ * according to the 'create' flag.
+ */
+dshash_table *
+aqo_shared_table(AQOSharedTableId id, bool create)
+{
+	AQOSharedTableDesc *desc = &tables_desc[id];
+	MemoryContext		oldcxt;
+
+	if (aqo_htabs[id] != NULL)
+		return aqo_htabs[id];
+
+	if (desc->name == NULL || aqo_state == NULL)
+		return NULL;
+
+	if (!create && aqo_state->dsa == DSM_HANDLE_INVALID)
+		/* Nobody used the shared tables yet. */
+		return NULL;
+
+	if (!attach_dsa())
+		return NULL;
+
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+	LWLockAcquire(aqo_state->lock, LW_EXCLUSIVE);
+
+	desc->params.tranche_id = aqo_state->tranche_id;
+	if (DsaPointerIsValid(aqo_state->tables[id]))
+		aqo_htabs[id] = dshash_attach(aqo_dsa, &desc->params,
+									  aqo_state->tables[id], NULL);
+	else if (create)
+	{
+		aqo_htabs[id] = dshash_create(aqo_dsa, &desc->params, NULL);
+		aqo_state->tables[id] = dshash_get_hash_table_handle(aqo_htabs[id]);
+	}
+
+	LWLockRelease(aqo_state->lock);
+	MemoryContextSwitchTo(oldcxt);
+	return aqo_htabs[id];
+}
+
+static int
+stamp_cmp(const void *a, const void *b)
+{
+	uint64	sa = *(const uint64 *) a;
+	uint64	sb = *(const uint64 *) b;
+
+	return (sa > sb) - (sa < sb);
+}
+
+/*
+ * Remove up to 'nevict' least recently used entries from the table.
+ * Concurrent eviction makes the same job, so just wait for it in this case.
+ */
+static void
+evict_entries(AQOSharedTableId id, uint32 nevict)
+{
+	dshash_table	   *htab = aqo_shared_table(id, false);
+	dshash_seq_status	status;
+	uint64			   *stamps;
+	uint32				nstamps = 0;
+	uint32				maxstamps;
+	uint32				removed = 0;
+	uint64				threshold;
+	void			   *entry;
+
+	if (htab == NULL || nevict == 0)
+		return;
+
+	if (!LWLockConditionalAcquire(aqo_state->evict_lock, LW_EXCLUSIVE))
+	{
+		LWLockAcquire(aqo_state->evict_lock, LW_SHARED);
+		LWLockRelease(aqo_state->evict_lock);
+		return;
+	}
+
+	/* Find the LRU stamp of the last entry to evict. */
+	maxstamps = pg_atomic_read_u32(&aqo_state->nentries[id]) + 1;
+	stamps = palloc(sizeof(uint64) * maxstamps);
+
+	dshash_seq_init(&status, htab, false);
+	while ((entry = dshash_seq_next(&status)) != NULL)
+	{
+		if (nstamps >= maxstamps)
+		{
+			maxstamps *= 2;
+			stamps = repalloc(stamps, sizeof(uint64) * maxstamps);
+		}
+		stamps[nstamps++] = pg_atomic_read_u64(lru_stamp(id, entry));
+	}
+	dshash_seq_term(&status);
+
+	if (nstamps > 0)
+	{
+		nevict = Min(nevict, nstamps);
+		qsort(stamps, nstamps, sizeof(uint64), stamp_cmp);
+		threshold = stamps[nevict - 1];
+
+		dshash_seq_init(&status, htab, true);
+		while (removed < nevict && (entry = dshash_seq_next(&status)) != NULL)
+		{
+			if (pg_atomic_read_u64(lru_stamp(id, entry)) > threshold)
+				continue;
+
+			dshash_delete_current(&status);
+			pg_atomic_fetch_sub_u32(&aqo_state->nentries[id], 1);
+			removed++;
+		}
+		dshash_seq_term(&status);
+		dsa_trim(aqo_dsa);
+	}
+
+	LWLockRelease(aqo_state->evict_lock);
+	pfree(stamps);
+
+	elog(DEBUG1, "AQO: %u entries evicted from the shared table \"%s\"",
+		 removed, tables_desc[id].name);
+}
+
+/*
+ * Approximate size of memory, used by the shared tables.
+ */
+static Size
+shared_tables_size(AQOSharedTableId *largest)
+{
+	Size	total = 0;
+	Size	max_size = 0;
+	int		i;
+
+	for (i = 0; i < AQO_SHARED_TABLES_NUM; i++)
+	{
+		Size size;
+
+		if (tables_desc[i].name == NULL || tables_desc[i].max_entries == NULL)
+			continue;
+
+		size = (Size) pg_atomic_read_u32(&aqo_state->nentries[i]) *
+											tables_desc[i].params.entry_size;
+		total += size;
+		if (size > max_size)
+		{
+			max_size = size;
+			*largest = (AQOSharedTableId) i;
+		}
+	}
+	return total;
+}
+
+/*
+ * Does a new entry of the table fit into aqo.dsm_size_max? Returns the largest
+ * table too.
+ */
+static bool
+fits_size_max(AQOSharedTableId id, AQOSharedTableId *largest)
+{
+	*largest = id;
+	return shared_tables_size(largest) + tables_desc[id].params.entry_size <=
+										(Size) aqo_dsm_size_max * 1024 * 1024;
+}
+
+/*
+ * Make room for a new entry of the table, if any limit is reached.
+ * Returns false, if the room can't be made.
+ */
+static bool
+make_room(AQOSharedTableId id)
+{
+	AQOSharedTableDesc *desc = &tables_desc[id];
+	uint32				nentries;
+	uint32				max_entries;
+	AQOSharedTableId	largest;
+
+	if (desc->max_entries == NULL)
+		return true;
+
+	max_entries = (uint32) *desc->max_entries;
+	nentries = pg_atomic_read_u32(&aqo_state->nentries[id]);
+	if (nentries >= max_entries)
+		/* The limit could be decreased. Shrink the table too. */
+		evict_entries(id, nentries - max_entries +
+						  Max(max_entries / AQO_EVICTION_FRACTION, 1));
+	else if (!fits_size_max(id, &largest))
+	{
+		/* Evict from the table itself, if possible, then from the largest. */
+		if (nentries > 0)
+			evict_entries(id, Max(nentries / AQO_EVICTION_FRACTION, 1));
+
+		if (!fits_size_max(id, &largest))
+		{
+			nentries = pg_atomic_read_u32(&aqo_state->nentries[largest]);
+			evict_entries(largest, Max(nentries / AQO_EVICTION_FRACTION, 1));
+		}
+	}
+	else
+		return true;
+
+	/* The room could be taken by concurrent insertions already. */
+	return pg_atomic_read_u32(&aqo_state->nentries[id]) < max_entries &&
+		   fits_size_max(id, &largest);
+}
+
+/*
+ * Find an entry. Returns locked entry or NULL.
+ */
+void *
+aqo_shared_find(AQOSharedTableId id, const void *key, bool exclusive)
+{
+	dshash_table   *htab = aqo_shared_table(id, false);
+	void		   *entry;
+
+	if (htab == NULL)
+		return NULL;
+
+	entry = dshash_find(htab, key, exclusive);
+	if (entry != NULL)
+		touch_entry(id, entry);
+	return entry;
+}
+
+/*
+ * Find or insert an entry. Returns exclusively locked entry or NULL, if the
+ * table is disabled or there is no room for a new entry. Fields of a new entry
+ * are zeroed.
+ */
+void *
+aqo_shared_insert(AQOSharedTableId id, const void *key, bool *found)
+{
+	AQOSharedTableDesc *desc = &tables_desc[id];
+	dshash_table	   *htab;
+	void			   *entry;
+
+	if (desc->name == NULL ||
+		(desc->max_entries != NULL && *desc->max_entries <= 0))
+		return NULL;
+
+	htab = aqo_shared_table(id, true);
+	if (htab == NULL)
+		return NULL;
+
+	entry = dshash_find(htab, key, true);
+	if (entry == NULL)
+	{
+		/* Don't hold any lock during an eviction. */
+		if (!make_room(id))
+			return NULL;
+
+		entry = dshash_find_or_insert(htab, key, found);
+		if (!*found)
+		{
+			memset((char *) entry + desc->params.key_size, 0,
+				   desc->params.entry_size - desc->params.key_size);
+			pg_atomic_init_u64(lru_stamp(id, entry), 0);
+			pg_atomic_fetch_add_u32(&aqo_state->nentries[id], 1);
+		}
+	}
+	else
+		*found = true;
+
+	touch_entry(id, entry);
+	return entry;
+}
+
+void
+aqo_shared_release(AQOSharedTableId id, void *entry)
+{
+	Assert(aqo_htabs[id] != NULL);
+	dshash_release_lock(aqo_htabs[id], entry);
+}
+
+/*
+ * Delete an entry. Returns false if nothing was found.
+ */
+bool
+aqo_shared_delete(AQOSharedTableId id, const void *key)
+{
+	dshash_table *htab = aqo_shared_table(id, false);
+
+	if (htab == NULL || !dshash_delete_key(htab, key))
+		return false;
+
+	pg_atomic_fetch_sub_u32(&aqo_state->nentries[id], 1);
+	return true;
+}
+
+/*
+ * Delete an entry, locked by the caller. The lock is released.
+ */
+void
+aqo_shared_delete_entry(AQOSharedTableId id, void *entry)
+{
+	Assert(aqo_htabs[id] != NULL);
+	dshash_delete_entry(aqo_htabs[id], entry);
+	pg_atomic_fetch_sub_u32(&aqo_state->nentries[id], 1);
+}
+
+/*
+ * Remove all entries which satisfy the filter. NULL filter removes all entries.
+ * Returns number of removed entries.
+ */
+long
+aqo_shared_remove(AQOSharedTableId id, aqo_shared_filter filter, void *arg)
+{
+	dshash_table	   *htab = aqo_shared_table(id, false);
+	dshash_seq_status	status;
+	void			   *entry;
+	long				removed = 0;
+
+	if (htab == NULL)
+		return 0;
+
+	dshash_seq_init(&status, htab, true);
+	while ((entry = dshash_seq_next(&status)) != NULL)
+	{
+		if (filter != NULL && !filter(entry, arg))
+			continue;
+
+		dshash_delete_current(&status);
+		pg_atomic_fetch_sub_u32(&aqo_state->nentries[id], 1);
+		removed++;
+	}
+	dshash_seq_term(&status);
+
+	if (removed > 0)
+		dsa_trim(aqo_dsa);
+
+	return removed;
+}
+
+static bool
+database_filter(void *entry, void *arg)
+{
+	/* Keys of the tables start with the database Oid. */
+	return *(Oid *) entry == *(Oid *) arg;
+}
+
+/*
+ * Remove all entries of the database. InvalidOid means all databases.
+ * Returns number of removed entries.
+ */
+long
+aqo_shared_remove_database(AQOSharedTableId id, Oid dbid)
+{
+	if (!OidIsValid(dbid))
+		return aqo_shared_remove(id, NULL, NULL);
+
+	return aqo_shared_remove(id, database_filter, &dbid);
+}
+
+uint32
+aqo_shared_nentries(AQOSharedTableId id)
+{
+	if (aqo_state == NULL)
+		return 0;
+
+	return pg_atomic_read_u32(&aqo_state->nentries[id]);
+}
+
+/*
+ * Get the DSA area to allocate data, referenced by entries of shared tables.
+ */
+dsa_area *
+aqo_shared_area(void)
+{
+	if (!attach_dsa())
+		elog(ERROR, "AQO shared memory isn't available");
+
+	return aqo_dsa;
+}
+
+/*
+ * The generation of the shared data. It includes local changes of the current
+ * backend, which aren't committed yet. Generations can be compared for
+ * equality within one backend only.
+ */
+uint64
+aqo_shared_generation(AQOGenerationId id)
+{
+	if (aqo_state == NULL)
+		return local_generations[id];
+
+	return pg_atomic_read_u64(&aqo_state->generations[id]) +
+		   local_generations[id];
+}
+
+void
+aqo_shared_next_generation(AQOGenerationId id)
+{
+	Assert(aqo_state != NULL);
+	pg_atomic_fetch_add_u64(&aqo_state->generations[id], 1);
+}
+
+static void
+generations_xact_callback(XactEvent event, void *arg)
+{
+	int i;
+
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PREPARE:
+			/*
+			 * The changes are visible to other backends now. A commit of a
+			 * prepared transaction can't be caught, so it is advanced earlier.
+			 */
+			for (i = 0; i < AQO_GENERATIONS_NUM; i++)
+				if (pending_generations[i] && aqo_state != NULL)
+					aqo_shared_next_generation(i);
+			break;
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			/* Forget the data, copied with the changes of the transaction. */
+			for (i = 0; i < AQO_GENERATIONS_NUM; i++)
+				if (pending_generations[i])
+					local_generations[i]++;
+			break;
+		default:
+			return;
+	}
+
+	memset(pending_generations, 0, sizeof(pending_generations));
+}
+
+/*
+ * Advance the generation for a change of a table, made by the current
+ * transaction. The current backend sees the change immediately, and other
+ * backends see it after the commit only: if the generation were advanced
+ * before, another backend could copy the old data and keep them.
+ */
+void
+aqo_shared_next_generation_at_commit(AQOGenerationId id)
+{
+	if (!generations_callback)
+	{
+		RegisterXactCallback(generations_xact_callback, NULL);
+		generations_callback = true;
+	}
+
+	pending_generations[id] = true;
+	local_generations[id]++;
+}
+
+uint64
+aqo_shared_counter(AQOCounterId id)
+{
+	if (aqo_state == NULL)
+		return 0;
+
+	return pg_atomic_read_u64(&aqo_state->counters[id]);
+}
+
+void
+aqo_shared_count(AQOCounterId id)
+{
+	if (aqo_state != NULL)
+		pg_atomic_fetch_add_u64(&aqo_state->counters[id], 1);
+}
+
+void
+aqo_shared_init(void)
+{
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = aqo_shared_shmem_request;
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = aqo_shared_shmem_startup;
+}
+
+/*
+ * shmem_request hook: request the fixed part of the shared state and locks.
+ */
+void
+aqo_shared_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(MAXALIGN(sizeof(AQOSharedState)));
+	RequestNamedLWLockTranche("aqo_shared", 2);
+}
+
+/*
+ * shmem_startup hook: allocate or attach to the fixed part of the shared state.
+ * The DSA area and the tables are created on demand.
+ */
+void
+aqo_shared_shmem_startup(void)
+{
+	bool	found;
+	int		i;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	aqo_state = ShmemInitStruct("AQO shared state", sizeof(AQOSharedState),
+								&found);
+	if (!found)
+	{
+		LWLockPadded *locks = GetNamedLWLockTranche("aqo_shared");
+
+		aqo_state->lock = &locks[0].lock;
+		aqo_state->evict_lock = &locks[1].lock;
+		aqo_state->tranche_id = LWLockNewTrancheId();
+		aqo_state->dsa = DSM_HANDLE_INVALID;
+
+		for (i = 0; i < AQO_SHARED_TABLES_NUM; i++)
+		{
+			aqo_state->tables[i] = InvalidDsaPointer;
+			pg_atomic_init_u32(&aqo_state->nentries[i], 0);
+		}
+		pg_atomic_init_u64(&aqo_state->lru_clock, 0);
+		for (i = 0; i < AQO_GENERATIONS_NUM; i++)
+			pg_atomic_init_u64(&aqo_state->generations[i], 0);
+		for (i = 0; i < AQO_COUNTERS_NUM; i++)
+			pg_atomic_init_u64(&aqo_state->counters[i], 0);
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
@@ -0,0 +1,106 @@
+#ifndef AQO_SHARED_H
+#define AQO_SHARED_H
+
+#include "lib/dshash.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "utils/dsa.h"
+
+/*
+ * Shared tables of AQO. All of them live in one DSA area, so they can grow and
+ * shrink at runtime.
+ */
+typedef enum AQOSharedTableId
+{
+	AQO_PROFILE_TABLE = 0,	/* Profiling of query classes */
+	AQO_FSS_TABLE,			/* Cache of feature subspaces */
+	AQO_SETTINGS_TABLE,		/* Cache of aqo_queries records */
+	AQO_SNAPSHOT_TABLE,		/* Published images of knowledge bases */
+	AQO_USAGE_TABLE,		/* Usage counters of feature subspaces */
+	AQO_ADMISSION_TABLE,	/* Sightings of unknown query classes */
+	AQO_COARSE_TABLE,		/* Index of feature subspaces by relations */
+	AQO_DRIFT_TABLE,		/* Baselines of the drift detection */
+	AQO_TUNING_TABLE,		/* Posteriors of the auto tuning */
+	AQO_FASTPATH_TABLE,		/* Negative cache of cheap query classes */
+	AQO_REPLAN_TABLE,		/* Invalidations of cached plans */
+	AQO_SHADOW_TABLE,		/* Errors of the shadow mode */
+
+	AQO_SHARED_TABLES_NUM
+} AQOSharedTableId;
+
+/*
+ * Generation counters. Backends use them to detect changes of shared data,
+ * which they have copied locally.
+ */
+typedef enum AQOGenerationId
+{
+	AQO_SNAPSHOT_GENERATION = 0,
+	AQO_MODEL_GENERATION,
+	AQO_BASELINE_GENERATION,
+
+	AQO_GENERATIONS_NUM
+} AQOGenerationId;
+
+/* Statistics counters, accumulated since the server start. */
+typedef enum AQOCounterId
+{
+	AQO_TRIVIAL_COUNTER = 0,	/* Trivial queries, planned without AQO */
+	AQO_BUDGET_COUNTER,			/* Plannings with exhausted budget */
+	AQO_REPLAN_COUNTER,			/* Invalidations of cached plans */
+
+	AQO_COUNTERS_NUM
+} AQOCounterId;
+
+typedef struct AQOSharedState
+{
+	LWLock			   *lock;	/* protects handles below */
+	LWLock			   *evict_lock;	/* serializes evictions */
+	int					tranche_id;
+	dsa_handle			dsa;
+	dshash_table_handle	tables[AQO_SHARED_TABLES_NUM];
+
+	/* Number of entries in each table. Used for the memory accounting. */
+	pg_atomic_uint32	nentries[AQO_SHARED_TABLES_NUM];
+
+	/* Logical clock for the LRU eviction */
+	pg_atomic_uint64	lru_clock;
+
+	pg_atomic_uint64	generations[AQO_GENERATIONS_NUM];
+	pg_atomic_uint64	counters[AQO_COUNTERS_NUM];
+} AQOSharedState;
+
+typedef bool (*aqo_shared_filter) (void *entry, void *arg);
+
+extern PGDLLIMPORT int aqo_dsm_size_max;
+extern PGDLLIMPORT shmem_request_hook_type prev_shmem_request_hook;
+extern PGDLLIMPORT shmem_startup_hook_type prev_shmem_startup_hook;
+
+extern void aqo_shared_register_table(AQOSharedTableId id, const char *name,
+									  Size keysize, Size entrysize,
+									  Size lru_offset, int *max_entries);
+extern dshash_table *aqo_shared_table(AQOSharedTableId id, bool create);
+extern void *aqo_shared_find(AQOSharedTableId id, const void *key,
+							 bool exclusive);
+extern void *aqo_shared_insert(AQOSharedTableId id, const void *key,
+							   bool *found);
+extern void aqo_shared_release(AQOSharedTableId id, void *entry);
+extern bool aqo_shared_delete(AQOSharedTableId id, const void *key);
+extern void aqo_shared_delete_entry(AQOSharedTableId id, void *entry);
+extern long aqo_shared_remove(AQOSharedTableId id, aqo_shared_filter filter,
+							  void *arg);
+extern long aqo_shared_remove_database(AQOSharedTableId id, Oid dbid);
+extern uint32 aqo_shared_nentries(AQOSharedTableId id);
+extern dsa_area *aqo_shared_area(void);
+extern uint64 aqo_shared_generation(AQOGenerationId id);
+extern void aqo_shared_next_generation(AQOGenerationId id);
+extern void aqo_shared_next_generation_at_commit(AQOGenerationId id);
+extern uint64 aqo_shared_counter(AQOCounterId id);
+extern void aqo_shared_count(AQOCounterId id);
+
+extern void aqo_shared_init(void);
+extern void aqo_shared_shmem_request(void);
+extern void aqo_shared_shmem_startup(void);
+
+#endif /* AQO_SHARED_H */
@@ -0,0 +1,532 @@
+/*
+ *******************************************************************************
+ *
+ *	PUBLISHED SNAPSHOT OF THE KNOWLEDGE BASE
+ *
+ * In the frozen mode nothing is written into the knowledge base. So, it can be
+ * serialized into a compact read-only image by the aqo_publish_snapshot()
+ * call. The image is stored in the AQO DSA area (see aqo_shared.c) and is
+ * never changed after the publication, so backends read it in place.
+ *
+ * A backend pins the image, when it notices a new publication, and unpins the
+ * previous one. The publication holds a pin too. The last one, who unpins a
+ * replaced image, frees it.
+ *
+ * If an image of the current database is published, the frozen mode uses it
+ * instead of the aqo_queries and aqo_data tables: planning doesn't open any
+ * AQO relation, doesn't take any lock and doesn't need a snapshot. Other modes
+ * aren't affected.
+ *
+ * The image contains a header, an array of query settings, sorted by the query
+ * hash, an array of feature subspace descriptors, sorted by the feature space
+ * and subspace hashes, and the data of all subspaces.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/aqo_snapshot.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "utils/array.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "aqo_snapshot.h"
+
+
+#define AQO_SNAPSHOT_MAGIC	(0xA0051AB0)
+
+typedef struct SnapshotQuery
+{
+	int		qhash;
+	int		fspace_hash;
+	bool	learn_aqo;
+	bool	use_aqo;
+	bool	auto_tuning;
+} SnapshotQuery;
+
+typedef struct SnapshotFss
+{
+	int		fhash;
+	int		fss_hash;
+	int		ncols;
+	int		nrows;
+	Size	offset;		/* in doubles from the start of the data section */
+} SnapshotFss;
+
+typedef struct SnapshotImage
+{
+	uint32				magic;
+	pg_atomic_uint32	refcount;	/* pins of backends and the publication */
+	int		nqueries;
+	int		nfss;
+	Size	size;		/* Total size of the image */
+	Size	fss_off;
+	Size	data_off;
+
+	/* Arrays of queries and feature subspaces and the data follow */
+} SnapshotImage;
+
+#define SnapshotQueries(image) \
+	((SnapshotQuery *) ((char *) (image) + MAXALIGN(sizeof(SnapshotImage))))
+#define SnapshotFssArray(image) \
+	((SnapshotFss *) ((char *) (image) + (image)->fss_off))
+#define SnapshotData(image) \
+	((double *) ((char *) (image) + (image)->data_off))
+
+typedef struct SnapshotEntry
+{
+	Oid					dbid;
+	pg_atomic_uint64	lru;
+	dsa_pointer			image;
+	Size				size;
+} SnapshotEntry;
+
+/* The image, pinned by the backend */
+static dsa_pointer local_ptr = InvalidDsaPointer;
+static SnapshotImage *local_image = NULL;
+static uint64 local_generation = 0;
+static bool exit_callback = false;
+
+PG_FUNCTION_INFO_V1(aqo_publish_snapshot);
+PG_FUNCTION_INFO_V1(aqo_drop_snapshot);
+
+
+/*
+ * Unpin the image. Free it, if it isn't published and pinned anymore.
+ */
+static void
+release_image(dsa_pointer ptr)
+{
+	dsa_area	   *area = aqo_shared_area();
+	SnapshotImage  *image = (SnapshotImage *) dsa_get_address(area, ptr);
+
+	if (pg_atomic_sub_fetch_u32(&image->refcount, 1) == 0)
+		dsa_free(area, ptr);
+}
+
+static void
+snapshot_shmem_exit(int code, Datum arg)
+{
+	if (DsaPointerIsValid(local_ptr))
+		release_image(local_ptr);
+	local_ptr = InvalidDsaPointer;
+	local_image = NULL;
+}
+
+/*
+ * Pin the published image of the current database, if it was changed since
+ * the last call.
+ */
+static void
+refresh_local_image(void)
+{
+	uint64			generation = aqo_shared_generation(AQO_SNAPSHOT_GENERATION);
+	SnapshotEntry  *entry;
+
+	if (generation == local_generation)
+		return;
+
+	if (DsaPointerIsValid(local_ptr))
+		release_image(local_ptr);
+	local_ptr = InvalidDsaPointer;
+	local_image = NULL;
+
+	entry = (SnapshotEntry *) aqo_shared_find(AQO_SNAPSHOT_TABLE,
+											  &MyDatabaseId, false);
+	if (entry != NULL)
+	{
+		/* The publication can't unpin the image under the entry lock. */
+		if (DsaPointerIsValid(entry->image))
+		{
+			local_ptr = entry->image;
+			local_image = (SnapshotImage *) dsa_get_address(aqo_shared_area(),
+															local_ptr);
+			Assert(local_image->magic == AQO_SNAPSHOT_MAGIC);
+			pg_atomic_fetch_add_u32(&local_image->refcount, 1);
+		}
+		aqo_shared_release(AQO_SNAPSHOT_TABLE, entry);
+	}
+
+	if (DsaPointerIsValid(local_ptr) && !exit_callback)
+	{
+		before_shmem_exit(snapshot_shmem_exit, (Datum) 0);
+		exit_callback = true;
+	}
+
+	local_generation = generation;
+}
+
+/*
+ * Is an image of the knowledge base published for the current database?
+ */
+bool
+snapshot_is_active(void)
+{
+	refresh_local_image();
+	return (local_image != NULL);
+}
+
+static int
+query_cmp(const void *a, const void *b)
+{
+	int		qa = ((const SnapshotQuery *) a)->qhash;
+	int		qb = ((const SnapshotQuery *) b)->qhash;
+
+	return (qa > qb) - (qa < qb);
+}
+
+static int
+fss_cmp(const void *a, const void *b)
+{
+	const SnapshotFss *fa = (const SnapshotFss *) a;
+	const SnapshotFss *fb = (const SnapshotFss *) b;
+
+	if (fa->fhash != fb->fhash)
+		return (fa->fhash > fb->fhash) - (fa->fhash < fb->fhash);
+	return (fa->fss_hash > fb->fss_hash) - (fa->fss_hash < fb->fss_hash);
+}
+
+/*
+ * Search settings of the query class in the image.
+ * Interface is the same as in the find_query() routine.
+ */
+bool
+snapshot_find_query(int qhash, Datum *values, bool *nulls)
+{
+	SnapshotQuery	key;
+	SnapshotQuery  *query;
+
+	Assert(local_image != NULL);
+
+	key.qhash = qhash;
+	query = (SnapshotQuery *) bsearch(&key, SnapshotQueries(local_image),
+									  local_image->nqueries,
+									  sizeof(SnapshotQuery), query_cmp);
+	if (query == NULL)
+		return false;
+
+	if (values != NULL)
+	{
+		values[0] = Int32GetDatum(qhash);
+		values[1] = BoolGetDatum(query->learn_aqo);
+		values[2] = BoolGetDatum(query->use_aqo);
+		values[3] = Int32GetDatum(query->fspace_hash);
+		values[4] = BoolGetDatum(query->auto_tuning);
+		memset(nulls, 0, sizeof(bool) * 5);
+	}
+	return true;
+}
+
+/*
+ * Load the feature subspace from the image.
+ * Interface is the same as in the load_fss() routine.
+ */
+bool
+snapshot_load_fss(int fhash, int fss_hash, int ncols,
+				  double **matrix, double *targets, int *rows)
+{
+	SnapshotFss		key;
+	SnapshotFss	   *fss;
+	double		   *data;
+	int				i;
+
+	Assert(local_image != NULL);
+
+	key.fhash = fhash;
+	key.fss_hash = fss_hash;
+	fss = (SnapshotFss *) bsearch(&key, SnapshotFssArray(local_image),
+								  local_image->nfss,
+								  sizeof(SnapshotFss), fss_cmp);
+	if (fss == NULL)
+		return false;
+
+	if (matrix == NULL && targets == NULL && rows == NULL)
+		/* Just check availability */
+		return true;
+
+	if (fss->ncols != ncols)
+		return false;
+
+	data = SnapshotData(local_image) + fss->offset;
+	if (matrix != NULL && ncols > 0)
+		for (i = 0; i < fss->nrows; ++i)
+			memcpy(matrix[i], data + i * ncols, sizeof(double) * ncols);
+
+	if (targets != NULL)
+		memcpy(targets, data + fss->nrows * ncols,
+			   sizeof(double) * fss->nrows);
+
+	if (rows != NULL)
+		*rows = fss->nrows;
+
+	return true;
+}
+
+static int
+array_nitems(Datum datum)
+{
+	ArrayType *array = DatumGetArrayTypeP(datum);
+
+	return ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+}
+
+/*
+ * Copy elements of a float8 array into the buffer.
+ */
+static void
+copy_array(Datum datum, double *dest, int nitems)
+{
+	ArrayType  *array = DatumGetArrayTypeP(datum);
+	Datum	   *elems;
+	int			nelems;
+	int			i;
+
+	deconstruct_array(array, FLOAT8OID, 8, FLOAT8PASSBYVAL, 'd',
+					  &elems, NULL, &nelems);
+	if (nelems != nitems)
+		elog(ERROR, "AQO snapshot: unexpected number of array elements: %d instead of %d",
+			 nelems, nitems);
+
+	for (i = 0; i < nelems; ++i)
+		dest[i] = DatumGetFloat8(elems[i]);
+	pfree(elems);
+}
+
+/*
+ * Serialize the knowledge base of the current database.
+ */
+static SnapshotImage *
+build_image(void)
+{
+	MemoryContext	caller_cxt = CurrentMemoryContext;
+	SPITupleTable  *queries;
+	SPITupleTable  *data;
+	int				nqueries;
+	int				nfss;
+	Size			ndoubles = 0;
+	Size			size;
+	SnapshotImage  *image;
+	SnapshotQuery  *qarray;
+	SnapshotFss	   *farray;
+	double		   *darray;
+	int				ret;
+	int				i;
+	bool			isnull;
+
+	SPI_connect();
+
+	ret = SPI_execute("SELECT query_hash, fspace_hash, learn_aqo, use_aqo, "
+					  "auto_tuning FROM public.aqo_queries "
+					  "ORDER BY query_hash", true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "AQO snapshot: SPI_execute failed: error code %d", ret);
+	queries = SPI_tuptable;
+	nqueries = (int) SPI_processed;
+
+	ret = SPI_execute("SELECT fspace_hash, fsspace_hash, nfeatures, features, "
+					  "targets FROM public.aqo_data "
+					  "ORDER BY fspace_hash, fsspace_hash", true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "AQO snapshot: SPI_execute failed: error code %d", ret);
+	data = SPI_tuptable;
+	nfss = (int) SPI_processed;
+
+	for (i = 0; i < nfss; i++)
+	{
+		Datum	targets = SPI_getbinval(data->vals[i], data->tupdesc, 5, &isnull);
+		int		ncols = DatumGetInt32(SPI_getbinval(data->vals[i],
+													data->tupdesc, 3, &isnull));
+
+		if (!isnull)
+			ndoubles += (Size) array_nitems(targets) * (ncols + 1);
+	}
+
+	size = MAXALIGN(sizeof(SnapshotImage)) +
+		   MAXALIGN(sizeof(SnapshotQuery) * nqueries) +
+		   MAXALIGN(sizeof(SnapshotFss) * nfss) +
+		   sizeof(double) * ndoubles;
+	image = (SnapshotImage *) MemoryContextAllocHuge(caller_cxt, size);
+	memset(image, 0, size);
+
+	image->magic = AQO_SNAPSHOT_MAGIC;
+	image->nqueries = nqueries;
+	image->nfss = nfss;
+	image->size = size;
+	image->fss_off = MAXALIGN(sizeof(SnapshotImage)) +
+					 MAXALIGN(sizeof(SnapshotQuery) * nqueries);
+	image->data_off = image->fss_off + MAXALIGN(sizeof(SnapshotFss) * nfss);
+
+	qarray = SnapshotQueries(image);
+	for (i = 0; i < nqueries; i++)
+	{
+		HeapTuple	tuple = queries->vals[i];
+		TupleDesc	tupdesc = queries->tupdesc;
+
+		qarray[i].qhash = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+		qarray[i].fspace_hash = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+		qarray[i].learn_aqo = DatumGetBool(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+		qarray[i].use_aqo = DatumGetBool(SPI_getbinval(tuple, tupdesc, 4, &isnull));
+		qarray[i].auto_tuning = DatumGetBool(SPI_getbinval(tuple, tupdesc, 5, &isnull));
+	}
+
+	farray = SnapshotFssArray(image);
+	darray = SnapshotData(image);
+	ndoubles = 0;
+	for (i = 0; i < nfss; i++)
+	{
+		HeapTuple	tuple = data->vals[i];
+		TupleDesc	tupdesc = data->tupdesc;
+		Datum		features;
+		Datum		targets;
+		bool		features_isnull;
+
+		farray[i].fhash = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+		farray[i].fss_hash = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+		farray[i].ncols = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+		farray[i].offset = ndoubles;
+
+		targets = SPI_getbinval(tuple, tupdesc, 5, &isnull);
+		if (isnull)
+			continue;
+
+		farray[i].nrows = array_nitems(targets);
+		features = SPI_getbinval(tuple, tupdesc, 4, &features_isnull);
+		if (farray[i].ncols > 0 && !features_isnull)
+			copy_array(features, darray + ndoubles,
+					   farray[i].nrows * farray[i].ncols);
+		ndoubles += (Size) farray[i].nrows * farray[i].ncols;
+
+		copy_array(targets, darray + ndoubles, farray[i].nrows);
+		ndoubles += farray[i].nrows;
+	}
+
+	SPI_finish();
+	return image;
+}
+
+/*
+ * Publish the image of the current database. Replace a previous one.
+ */
+static void
+publish_image(SnapshotImage *image)
+{
+	dsa_area	   *area = aqo_shared_area();
+	dsa_pointer		ptr;
+	dsa_pointer		old = InvalidDsaPointer;
+	SnapshotEntry  *entry;
+	bool			found;
+
+	ptr = dsa_allocate_extended(area, image->size, DSA_ALLOC_HUGE);
+	memcpy(dsa_get_address(area, ptr), image, image->size);
+	pg_atomic_init_u32(&((SnapshotImage *) dsa_get_address(area, ptr))->refcount,
+					   1);
+
+	entry = (SnapshotEntry *) aqo_shared_insert(AQO_SNAPSHOT_TABLE,
+												&MyDatabaseId, &found);
+	if (entry == NULL)
+	{
+		dsa_free(area, ptr);
+		elog(ERROR, "AQO shared memory isn't available");
+	}
+
+	if (found)
+		old = entry->image;
+	entry->image = ptr;
+	entry->size = image->size;
+	aqo_shared_release(AQO_SNAPSHOT_TABLE, entry);
+
+	/* Readers of the old image could still have it pinned. */
+	if (DsaPointerIsValid(old))
+		release_image(old);
+
+	aqo_shared_next_generation(AQO_SNAPSHOT_GENERATION);
+}
+
+/*
+ * Remove the published image of the database.
+ * Returns number of removed images.
+ */
+long
+snapshot_drop(Oid dbid)
+{
+	SnapshotEntry  *entry;
+	dsa_pointer		ptr;
+
+	entry = (SnapshotEntry *) aqo_shared_find(AQO_SNAPSHOT_TABLE, &dbid, true);
+	if (entry == NULL)
+		return 0;
+
+	ptr = entry->image;
+	aqo_shared_delete_entry(AQO_SNAPSHOT_TABLE, entry);
+
+	if (DsaPointerIsValid(ptr))
+		release_image(ptr);
+
+	aqo_shared_next_generation(AQO_SNAPSHOT_GENERATION);
+	return 1;
+}
+
+/*
+ * Serialize the knowledge base of the current database and publish it for the
+ * frozen mode. Returns number of feature subspaces in the image.
+ */
+Datum
+aqo_publish_snapshot(PG_FUNCTION_ARGS)
+{
+	SnapshotImage *image;
+	int64		nfss;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("only superuser can publish a snapshot of the AQO knowledge base")));
+
+	image = build_image();
+
+	if (image->size > (Size) aqo_dsm_size_max * 1024 * 1024)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("snapshot of the AQO knowledge base is too large: %zu bytes",
+						image->size),
+				 errhint("Increase the aqo.dsm_size_max value.")));
+
+	publish_image(image);
+	nfss = image->nfss;
+	pfree(image);
+
+	PG_RETURN_INT64(nfss);
+}
+
+/*
+ * Remove the published snapshot of the current database. The frozen mode
+ * will use the AQO tables again.
+ */
+Datum
+aqo_drop_snapshot(PG_FUNCTION_ARGS)
+{
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("only superuser can drop a snapshot of the AQO knowledge base")));
+
+	PG_RETURN_BOOL(snapshot_drop(MyDatabaseId) > 0);
+}
+
+void
+snapshot_init(void)
+{
+	/* Images are never evicted. */
+	aqo_shared_register_table(AQO_SNAPSHOT_TABLE, "aqo_snapshots",
+							  sizeof(Oid), sizeof(SnapshotEntry),
+							  offsetof(SnapshotEntry, lru), NULL);
+}
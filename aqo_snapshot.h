@@ -0,0 +1,14 @@
+#ifndef AQO_SNAPSHOT_H
+#define AQO_SNAPSHOT_H
+
+#include "postgres.h"
+
+extern bool snapshot_is_active(void);
+extern bool snapshot_find_query(int qhash, Datum *values, bool *nulls);
+extern bool snapshot_load_fss(int fhash, int fss_hash, int ncols,
+							  double **matrix, double *targets, int *rows);
+extern long snapshot_drop(Oid dbid);
+
+extern void snapshot_init(void);
+
+#endif /* AQO_SNAPSHOT_H */
@@ -6,6 +6,16 @@
  * This module automatically implements basic strategies of tuning AQO for best
  * PostgreSQL performance.
  *
+ * Two methods are available (aqo.auto_tuning_method):
+ * "legacy" - decides with a sigmoid over windowed means of execution times and
+ *	stores the decision into the aqo_queries table after each execution.
+ * "thompson" - a two-armed bandit {without AQO, with AQO}. Each arm has a
+ *	posterior of the total (planning and execution) time of the query class,
+ *	kept in a shared table (see aqo_shared.c). The planner samples both
+ *	posteriors and uses the arm with the least sampled time, so the worse arm
+ *	is explored less and less. The aqo_queries table is updated only when the
+ *	arm with the least mean time changes.
+ *
  *******************************************************************************
  *
  * Copyright (c) 2016-2021, Postgres Professional
@@ -17,7 +27,10 @@
 
 #include "postgres.h"
 
+#include "miscadmin.h"
+
 #include "aqo.h"
+#include "aqo_shared.h"
 
 /*
  * Auto tuning criteria criteria of an query convergence by overall cardinality
@@ -25,11 +38,37 @@
  */
 double auto_tuning_convergence_error = 0.01;
 
+int		auto_tuning_method = AQO_TUNING_LEGACY;
+int		auto_tuning_size = 10000;
+
+/* Posterior of the total time of the query class with or without AQO. */
+typedef struct TuningArm
+{
+	int		n;			/* number of samples, up to aqo_stat_size */
+	double	mean;
+	double	variance;
+} TuningArm;
+
+typedef struct TuningKey
+{
+	Oid		dbid;
+	int		qhash;
+} TuningKey;
+
+typedef struct TuningEntry
+{
+	TuningKey			key;
+
+	pg_atomic_uint64	lru;
+	TuningArm			arms[2];	/* indexed by use_aqo */
+	bool				use_aqo;	/* the decision, stored in aqo_queries */
+} TuningEntry;
+
 static double get_mean(double *elems, int nelems);
 static double get_estimation(double *elems, int nelems);
 static bool is_stable(double *elems, int nelems);
-static bool converged_cq(double *elems, int nelems);
 static bool is_in_infinite_loop_cq(double *elems, int nelems);
+static void thompson_query_tuning(int query_hash, QueryStat *stat);
 
 
 /*
@@ -152,6 +191,12 @@ automatical_query_tuning(int query_hash, QueryStat * stat)
 	double		p_use = -1;
 	int64		num_iterations;
 
+	if (auto_tuning_method == AQO_TUNING_THOMPSON)
+	{
+		thompson_query_tuning(query_hash, stat);
+		return;
+	}
+
 	num_iterations = stat->executions_with_aqo + stat->executions_without_aqo;
 	query_context.learn_aqo = true;
 	if (stat->executions_without_aqo < auto_tuning_window_size + 1)
@@ -212,3 +257,176 @@ automatical_query_tuning(int query_hash, QueryStat * stat)
 	else
 		update_query(query_hash, query_context.fspace_hash, false, false, false);
 }
+
+static inline double
+get_last(double *elems, int nelems)
+{
+	AssertArg(nelems > 0);
+	return elems[nelems - 1];
+}
+
+static inline void
+init_tuning_key(TuningKey *key, int qhash)
+{
+	memset(key, 0, sizeof(TuningKey));
+	key->dbid = MyDatabaseId;
+	key->qhash = qhash;
+}
+
+/*
+ * Account a new sample of the arm. Statistics of the last aqo_stat_size samples
+ * weigh most: the time of the query class changes while AQO learns.
+ */
+static void
+arm_add_sample(TuningArm *arm, double value)
+{
+	double	alpha;
+	double	delta;
+
+	arm->n = Min(arm->n + 1, aqo_stat_size);
+	alpha = 1. / arm->n;
+	delta = value - arm->mean;
+
+	arm->mean += alpha * delta;
+	arm->variance = (1. - alpha) * (arm->variance + alpha * delta * delta);
+}
+
+/*
+ * Draw the mean time of the arm from its posterior. The Gaussian sample is
+ * made by the Box-Muller transform.
+ */
+static double
+arm_sample(const TuningArm *arm)
+{
+	double	u1 = random() / ((double) MAX_RANDOM_VALUE + 1);
+	double	u2 = random() / ((double) MAX_RANDOM_VALUE + 1);
+	double	sd;
+
+	/* Don't let a few equal samples make the posterior degenerate. */
+	sd = Max(sqrt(arm->variance / arm->n),
+			 auto_tuning_convergence_error * arm->mean);
+
+	return arm->mean + sd * sqrt(-2. * log(1. - u1)) * cos(2. * M_PI * u2);
+}
+
+/*
+ * Choose, whether to use AQO for the next execution of the query class.
+ * Arms with less than two samples are explored first. If nothing is known
+ * about the class, the decision, stored in aqo_queries, is kept.
+ */
+bool
+auto_tuning_choose(int query_hash, bool use_aqo)
+{
+	TuningKey		key;
+	TuningEntry	   *entry;
+	TuningArm		arms[2];
+
+	if (auto_tuning_method != AQO_TUNING_THOMPSON)
+		return use_aqo;
+
+	init_tuning_key(&key, query_hash);
+	entry = (TuningEntry *) aqo_shared_find(AQO_TUNING_TABLE, &key, false);
+	if (entry == NULL)
+		return use_aqo;
+
+	arms[0] = entry->arms[0];
+	arms[1] = entry->arms[1];
+	aqo_shared_release(AQO_TUNING_TABLE, entry);
+
+	if (arms[0].n < 2 || arms[1].n < 2)
+		return (arms[1].n < arms[0].n);
+
+	return arm_sample(&arms[1]) < arm_sample(&arms[0]);
+}
+
+/*
+ * Learn the execution of the query class by the bandit. The time of the
+ * execution is the last one in the statistics of the used arm.
+ */
+static void
+thompson_query_tuning(int query_hash, QueryStat *stat)
+{
+	TuningKey		key;
+	TuningEntry	   *entry;
+	bool			found;
+	bool			use_aqo = query_context.use_aqo;
+	double			time;
+	double			planning_time;
+	bool			decision;
+	bool			changed;
+	int64			num_iterations;
+
+	if (use_aqo)
+	{
+		time = get_last(stat->execution_time_with_aqo,
+						stat->execution_time_with_aqo_size);
+		planning_time = get_last(stat->planning_time_with_aqo,
+								 stat->planning_time_with_aqo_size);
+	}
+	else
+	{
+		time = get_last(stat->execution_time_without_aqo,
+						stat->execution_time_without_aqo_size);
+		planning_time = get_last(stat->planning_time_without_aqo,
+								 stat->planning_time_without_aqo_size);
+	}
+
+	/* A plan from the plan cache has a negative planning time. */
+	time += Max(planning_time, 0.);
+
+	init_tuning_key(&key, query_hash);
+	entry = (TuningEntry *) aqo_shared_insert(AQO_TUNING_TABLE, &key, &found);
+	if (entry == NULL)
+		/* The shared table is disabled. */
+		return;
+
+	if (!found)
+	{
+		memset(entry->arms, 0, sizeof(entry->arms));
+		entry->use_aqo = use_aqo;
+	}
+
+	arm_add_sample(&entry->arms[use_aqo], time);
+
+	/* The decision is the arm with the least mean time. */
+	decision = entry->use_aqo;
+	if (entry->arms[0].n >= 2 && entry->arms[1].n >= 2)
+		decision = (entry->arms[1].mean < entry->arms[0].mean);
+
+	changed = (decision != entry->use_aqo);
+	entry->use_aqo = decision;
+	aqo_shared_release(AQO_TUNING_TABLE, entry);
+
+	num_iterations = stat->executions_with_aqo + stat->executions_without_aqo;
+	if (num_iterations > auto_tuning_max_iterations && !decision)
+	{
+		/* AQO doesn't help this query class. Stop the tuning. */
+		update_query(query_hash, query_context.fspace_hash, false, false, false);
+		(void) aqo_shared_delete(AQO_TUNING_TABLE, &key);
+	}
+	else if (changed)
+	{
+		elog(DEBUG1, "AQO: auto tuning of the class %d %s AQO", query_hash,
+			 decision ? "enables" : "disables");
+		update_query(query_hash, query_context.fspace_hash, true, decision,
+					 true);
+	}
+}
+
+/*
+ * Remove the bandit state of the database. InvalidOid means all databases.
+ * Returns number of removed entries.
+ */
+long
+auto_tuning_reset(Oid dbid)
+{
+	return aqo_shared_remove_database(AQO_TUNING_TABLE, dbid);
+}
+
+void
+auto_tuning_init(void)
+{
+	aqo_shared_register_table(AQO_TUNING_TABLE, "aqo_auto_tuning",
+							  sizeof(TuningKey), sizeof(TuningEntry),
+							  offsetof(TuningEntry, lru), &auto_tuning_size);
+}
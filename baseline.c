@@ -0,0 +1,611 @@
+/*
+ *******************************************************************************
+ *
+ *	PLAN BASELINES OF CONVERGED QUERY CLASSES
+ *
+ * When learning of a query class has converged (see converged_cq in
+ * auto_tuning.c), its plan is stable, but AQO still predicts cardinalities of
+ * each plan node at each planning.
+ *
+ * This module captures the shape of the converged plan as a baseline of the
+ * class: the join tree with join methods and scan methods of relations. It is
+ * stored in the aqo_plan_baselines table as a string, for example
+ * "H(N(S1,I2),S3)": a hash join of a nested loop and a sequential scan of the
+ * third relation of the range table. The codes are: S - sequential scan,
+ * I - index scan, O - index only scan, B - bitmap heap scan, N - nested loop,
+ * M - merge join, H - hash join. Nodes, which don't change the join tree, like
+ * Sort or Hash, are skipped. Plans with other nodes, subplans and parallel
+ * plans have no baseline.
+ *
+ * With aqo.plan_baselines enabled, planning of a class with a baseline skips
+ * the predictions and the learning. The pathlists of relations and joins are
+ * restricted to the methods of the baseline, and the join tree is built in
+ * the order of the baseline. Each aqo.baseline_revalidation-th planning of the
+ * class in a backend is made by the predictions: if the plan differs, the
+ * baseline is replaced by the new plan of a converged class or removed. A
+ * baseline can be pinned by the aqo_pin_baseline() function: it is never
+ * replaced or removed by AQO. The steering is soft: if the baseline method
+ * can't be used for a relation, other methods remain available.
+ *
+ * Backends cache baselines locally. A committed change of the
+ * aqo_plan_baselines table advances the shared generation counter, which
+ * invalidates these caches.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/baseline.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "commands/trigger.h"
+#include "miscadmin.h"
+#include "optimizer/geqo.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "baseline.h"
+
+
+bool	aqo_plan_baselines = false;
+int		aqo_baseline_revalidation = 100;
+
+set_rel_pathlist_hook_type	prev_set_rel_pathlist_hook = NULL;
+join_search_hook_type		prev_join_search_hook = NULL;
+
+typedef struct BaselineEntry
+{
+	int		qhash;
+	bool	exists;
+	bool	pinned;
+	uint32	nplanned;	/* plannings since the entry was loaded */
+	char	signature[AQO_BASELINE_MAXLEN];
+} BaselineEntry;
+
+/* Node of a parsed baseline */
+typedef struct BaselineNode
+{
+	char				code;
+	Index				relid;		/* range table index of a scan */
+	struct BaselineNode *outer;
+	struct BaselineNode *inner;
+} BaselineNode;
+
+static const struct
+{
+	char	code;
+	NodeTag	tag;
+} baseline_codes[] =
+{
+	{'S', T_SeqScan},
+	{'I', T_IndexScan},
+	{'O', T_IndexOnlyScan},
+	{'B', T_BitmapHeapScan},
+	{'N', T_NestLoop},
+	{'M', T_MergeJoin},
+	{'H', T_HashJoin}
+};
+
+static HTAB	   *baselines = NULL;
+static uint64	baselines_generation = 0;
+
+/* The baseline of the query, which is planning now. */
+static Query		   *baseline_query = NULL;
+static BaselineNode	   *baseline_tree = NULL;
+
+
+static char
+baseline_code(NodeTag tag)
+{
+	int i;
+
+	for (i = 0; i < lengthof(baseline_codes); i++)
+		if (baseline_codes[i].tag == tag)
+			return baseline_codes[i].code;
+
+	return '\0';
+}
+
+static NodeTag
+baseline_tag(char code)
+{
+	int i;
+
+	for (i = 0; i < lengthof(baseline_codes); i++)
+		if (baseline_codes[i].code == code)
+			return baseline_codes[i].tag;
+
+	return T_Invalid;
+}
+
+/*
+ * Append the signature of the plan tree to the buffer.
+ * Returns false, if the plan can't be represented by a baseline.
+ */
+static bool
+append_plan_signature(Plan *plan, StringInfo buf)
+{
+	check_stack_depth();
+
+	if (plan == NULL || plan->initPlan != NIL)
+		return false;
+
+	switch (nodeTag(plan))
+	{
+		case T_SeqScan:
+		case T_IndexScan:
+		case T_IndexOnlyScan:
+		case T_BitmapHeapScan:
+			appendStringInfo(buf, "%c%u", baseline_code(nodeTag(plan)),
+							 ((Scan *) plan)->scanrelid);
+			return true;
+
+		case T_NestLoop:
+		case T_MergeJoin:
+		case T_HashJoin:
+			appendStringInfo(buf, "%c(", baseline_code(nodeTag(plan)));
+			if (!append_plan_signature(plan->lefttree, buf))
+				return false;
+			appendStringInfoChar(buf, ',');
+			if (!append_plan_signature(plan->righttree, buf))
+				return false;
+			appendStringInfoChar(buf, ')');
+			return true;
+
+		case T_Hash:
+		case T_Sort:
+		case T_IncrementalSort:
+		case T_Material:
+		case T_Memoize:
+		case T_Agg:
+		case T_Group:
+		case T_WindowAgg:
+		case T_Unique:
+		case T_Limit:
+		case T_LockRows:
+		case T_Result:
+		case T_ModifyTable:
+			/* These nodes don't change the join tree. */
+			return append_plan_signature(plan->lefttree, buf);
+
+		default:
+			return false;
+	}
+}
+
+/*
+ * Returns the baseline signature of the plan or NULL, if the plan can't be
+ * represented by a baseline.
+ */
+char *
+baseline_signature(PlannedStmt *stmt)
+{
+	StringInfoData buf;
+
+	if (stmt->subplans != NIL)
+		return NULL;
+
+	initStringInfo(&buf);
+	if (!append_plan_signature(stmt->planTree, &buf) ||
+		buf.len >= AQO_BASELINE_MAXLEN)
+	{
+		pfree(buf.data);
+		return NULL;
+	}
+
+	return buf.data;
+}
+
+/*
+ * Parse a node of the baseline. Returns NULL on a syntax error.
+ */
+static BaselineNode *
+parse_baseline_node(const char **str)
+{
+	BaselineNode   *node = palloc0(sizeof(BaselineNode));
+	char		   *end;
+
+	check_stack_depth();
+
+	node->code = **str;
+	switch (baseline_tag(node->code))
+	{
+		case T_SeqScan:
+		case T_IndexScan:
+		case T_IndexOnlyScan:
+		case T_BitmapHeapScan:
+			(*str)++;
+			node->relid = (Index) strtoul(*str, &end, 10);
+			if (end == *str || node->relid == 0)
+				return NULL;
+			*str = end;
+			return node;
+
+		case T_NestLoop:
+		case T_MergeJoin:
+		case T_HashJoin:
+			(*str)++;
+			if (**str != '(')
+				return NULL;
+			(*str)++;
+			node->outer = parse_baseline_node(str);
+			if (node->outer == NULL || **str != ',')
+				return NULL;
+			(*str)++;
+			node->inner = parse_baseline_node(str);
+			if (node->inner == NULL || **str != ')')
+				return NULL;
+			(*str)++;
+			return node;
+
+		default:
+			return NULL;
+	}
+}
+
+static void
+read_baseline(int qhash, BaselineEntry *entry)
+{
+	Datum	values[Natts_baselines];
+	bool	nulls[Natts_baselines];
+	char   *signature;
+
+	entry->exists = false;
+	entry->pinned = false;
+	entry->nplanned = 0;
+	entry->signature[0] = '\0';
+
+	if (!find_baseline(qhash, values, nulls))
+		return;
+
+	signature = TextDatumGetCString(values[Anum_baseline_signature - 1]);
+	if (strlen(signature) >= AQO_BASELINE_MAXLEN)
+	{
+		elog(WARNING, "AQO: baseline of the query class %d is too long",
+			 qhash);
+		return;
+	}
+
+	strlcpy(entry->signature, signature, AQO_BASELINE_MAXLEN);
+	entry->pinned = DatumGetBool(values[Anum_baseline_pinned - 1]);
+	entry->exists = true;
+}
+
+/*
+ * Get the cached baseline of the query class.
+ * The entry is valid until the next call only.
+ */
+static BaselineEntry *
+get_baseline(int qhash)
+{
+	uint64			generation = aqo_shared_generation(AQO_BASELINE_GENERATION);
+	BaselineEntry  *entry;
+	bool			found;
+
+	if (baselines == NULL || generation != baselines_generation)
+	{
+		HASHCTL ctl;
+
+		if (baselines != NULL)
+			hash_destroy(baselines);
+
+		ctl.keysize = sizeof(int);
+		ctl.entrysize = sizeof(BaselineEntry);
+		baselines = hash_create("AQO plan baselines", 64,
+								&ctl, HASH_ELEM | HASH_BLOBS);
+		baselines_generation = generation;
+	}
+
+	entry = (BaselineEntry *) hash_search(baselines, &qhash, HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		BaselineEntry baseline;
+
+		/* Read the table before the entry is created: it can fail. */
+		read_baseline(qhash, &baseline);
+		entry = (BaselineEntry *) hash_search(baselines, &qhash,
+											  HASH_ENTER, &found);
+		entry->exists = baseline.exists;
+		entry->pinned = baseline.pinned;
+		entry->nplanned = baseline.nplanned;
+		memcpy(entry->signature, baseline.signature, AQO_BASELINE_MAXLEN);
+	}
+
+	return entry;
+}
+
+/*
+ * Decide, whether the query should be planned by the baseline of its class,
+ * and activate the baseline for the planner hooks.
+ */
+void
+baseline_prepare(Query *parse)
+{
+	BaselineEntry  *entry;
+	BaselineNode   *tree;
+	const char	   *str;
+
+	if (!aqo_plan_baselines || !query_context.use_aqo)
+		return;
+
+	entry = get_baseline(query_context.query_hash);
+	if (!entry->exists)
+		return;
+
+	entry->nplanned++;
+	if (aqo_baseline_revalidation > 0 &&
+		entry->nplanned % aqo_baseline_revalidation == 0)
+	{
+		/* Plan by the predictions and compare the plan with the baseline. */
+		query_context.check_baseline = true;
+		return;
+	}
+
+	str = entry->signature;
+	tree = parse_baseline_node(&str);
+	if (tree == NULL || *str != '\0')
+	{
+		elog(WARNING, "AQO: invalid baseline \"%s\" of the query class %d",
+			 entry->signature, query_context.query_hash);
+		query_context.check_baseline = true;
+		return;
+	}
+
+	baseline_query = parse;
+	baseline_tree = tree;
+
+	/* The plan is known, nothing to learn on it. */
+	query_context.use_baseline = true;
+	query_context.learn_aqo = false;
+	query_context.auto_tuning = false;
+	query_context.collect_stat = force_collect_stat;
+}
+
+/*
+ * Deactivate the baseline after planning of the query.
+ */
+void
+baseline_finish(void)
+{
+	baseline_query = NULL;
+	baseline_tree = NULL;
+}
+
+/*
+ * Capture the baseline of a converged query class or re-validate the existing
+ * one by the executed plan.
+ */
+void
+baseline_capture(PlannedStmt *stmt, QueryStat *stat)
+{
+	BaselineEntry  *entry;
+	char		   *signature;
+	bool			converged;
+	bool			changed;
+
+	if (!aqo_plan_baselines || !query_context.use_aqo ||
+		query_context.use_baseline)
+		return;
+
+	entry = get_baseline(query_context.query_hash);
+	if (entry->exists && !query_context.check_baseline)
+		return;
+
+	converged = converged_cq(stat->cardinality_error_with_aqo,
+							 stat->cardinality_error_with_aqo_size);
+	if (!entry->exists && !converged)
+		return;
+
+	signature = baseline_signature(stmt);
+	if (!entry->exists)
+	{
+		if (signature == NULL)
+			return;
+
+		changed = update_baseline(query_context.query_hash, signature);
+	}
+	else
+	{
+		if (signature != NULL && strcmp(signature, entry->signature) == 0)
+			/* The baseline is still valid. */
+			return;
+
+		if (entry->pinned)
+			return;
+
+		if (converged && signature != NULL)
+			changed = update_baseline(query_context.query_hash, signature);
+		else
+			changed = delete_baseline(query_context.query_hash);
+	}
+
+	elog(DEBUG1, "AQO: baseline of the query class %d is %s",
+		 query_context.query_hash, signature ? signature : "removed");
+
+	if (changed)
+		aqo_shared_next_generation_at_commit(AQO_BASELINE_GENERATION);
+}
+
+static BaselineNode *
+find_baseline_scan(BaselineNode *node, Index relid)
+{
+	BaselineNode *result;
+
+	if (node->outer == NULL)
+		return (node->relid == relid) ? node : NULL;
+
+	result = find_baseline_scan(node->outer, relid);
+	return (result != NULL) ? result : find_baseline_scan(node->inner, relid);
+}
+
+/*
+ * Restrict the pathlist of the relation to paths of the given type. For a
+ * join, the outer path must belong to the given relation.
+ * Unparameterized paths of other types are kept, if there is no suitable
+ * unparameterized path: the relation must remain plannable.
+ */
+static void
+steer_pathlist(RelOptInfo *rel, NodeTag pathtype, RelOptInfo *outer)
+{
+	List	   *pathlist = NIL;
+	List	   *rest = NIL;
+	bool		has_unparameterized = false;
+	ListCell   *lc;
+
+	foreach(lc, rel->pathlist)
+	{
+		Path *path = (Path *) lfirst(lc);
+
+		if (path->pathtype == pathtype &&
+			(outer == NULL || ((JoinPath *) path)->outerjoinpath->parent == outer))
+		{
+			pathlist = lappend(pathlist, path);
+			if (path->param_info == NULL)
+				has_unparameterized = true;
+		}
+		else if (path->param_info == NULL)
+			rest = lappend(rest, path);
+	}
+
+	if (!has_unparameterized)
+		pathlist = list_concat(pathlist, rest);
+
+	rel->pathlist = pathlist;
+	rel->partial_pathlist = NIL;
+}
+
+/*
+ * Restrict scan methods of a base relation.
+ */
+void
+aqo_set_rel_pathlist(PlannerInfo *root, RelOptInfo *rel,
+					 Index rti, RangeTblEntry *rte)
+{
+	BaselineNode *node;
+
+	if (prev_set_rel_pathlist_hook)
+		prev_set_rel_pathlist_hook(root, rel, rti, rte);
+
+	if (baseline_tree == NULL || root->parse != baseline_query ||
+		rel->reloptkind != RELOPT_BASEREL)
+		return;
+
+	node = find_baseline_scan(baseline_tree, rti);
+	if (node != NULL)
+		steer_pathlist(rel, baseline_tag(node->code), NULL);
+}
+
+static RelOptInfo *
+find_initial_rel(List *initial_rels, Index relid)
+{
+	ListCell *lc;
+
+	foreach(lc, initial_rels)
+	{
+		RelOptInfo *rel = (RelOptInfo *) lfirst(lc);
+		int			member;
+
+		if (bms_get_singleton_member(rel->relids, &member) &&
+			(Index) member == relid)
+			return rel;
+	}
+
+	return NULL;
+}
+
+/*
+ * Check, that each leaf of the baseline is a relation from the list and
+ * appears once. Returns number of leaves or -1.
+ */
+static int
+count_baseline_leaves(BaselineNode *node, List *initial_rels,
+					  Bitmapset **relids)
+{
+	int nouter;
+	int ninner;
+
+	if (node->outer == NULL)
+	{
+		if (bms_is_member(node->relid, *relids) ||
+			find_initial_rel(initial_rels, node->relid) == NULL)
+			return -1;
+
+		*relids = bms_add_member(*relids, node->relid);
+		return 1;
+	}
+
+	nouter = count_baseline_leaves(node->outer, initial_rels, relids);
+	ninner = count_baseline_leaves(node->inner, initial_rels, relids);
+	return (nouter < 0 || ninner < 0) ? -1 : nouter + ninner;
+}
+
+static RelOptInfo *
+build_baseline_join(PlannerInfo *root, BaselineNode *node, List *initial_rels)
+{
+	RelOptInfo *outer;
+	RelOptInfo *inner;
+	RelOptInfo *joinrel;
+
+	if (node->outer == NULL)
+		return find_initial_rel(initial_rels, node->relid);
+
+	outer = build_baseline_join(root, node->outer, initial_rels);
+	inner = build_baseline_join(root, node->inner, initial_rels);
+	joinrel = make_join_rel(root, outer, inner);
+	if (joinrel == NULL)
+		elog(ERROR, "AQO: can't build a join of the plan baseline");
+
+	steer_pathlist(joinrel, baseline_tag(node->code), outer);
+	set_cheapest(joinrel);
+	return joinrel;
+}
+
+/*
+ * Build the join tree in the order of the baseline. Any join order is legal
+ * for inner joins without lateral references only, so other queries are
+ * planned in the usual way.
+ */
+RelOptInfo *
+aqo_join_search(PlannerInfo *root, int levels_needed, List *initial_rels)
+{
+	Bitmapset *relids = NULL;
+
+	if (baseline_tree != NULL && root->parse == baseline_query &&
+		root->join_info_list == NIL && !root->hasLateralRTEs &&
+		count_baseline_leaves(baseline_tree, initial_rels, &relids) ==
+														list_length(initial_rels))
+	{
+		bms_free(relids);
+		return build_baseline_join(root, baseline_tree, initial_rels);
+	}
+	bms_free(relids);
+
+	if (prev_join_search_hook)
+		return prev_join_search_hook(root, levels_needed, initial_rels);
+	else if (enable_geqo && levels_needed >= geqo_threshold)
+		return geqo(root, levels_needed, initial_rels);
+	else
+		return standard_join_search(root, levels_needed, initial_rels);
+}
+
+PG_FUNCTION_INFO_V1(aqo_plan_baselines_changed);
+
+/*
+ * Trigger on the aqo_plan_baselines table. Invalidate cached baselines in all
+ * backends, when the change is committed.
+ */
+Datum
+aqo_plan_baselines_changed(PG_FUNCTION_ARGS)
+{
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "aqo_plan_baselines_changed: must be called as trigger");
+
+	aqo_shared_next_generation_at_commit(AQO_BASELINE_GENERATION);
+	PG_RETURN_POINTER(NULL);
+}
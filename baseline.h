@@ -0,0 +1,37 @@
+#ifndef BASELINE_H
+#define BASELINE_H
+
+#include "postgres.h"
+
+#include "nodes/plannodes.h"
+#include "optimizer/paths.h"
+
+#include "aqo.h"
+
+/* Max length of a plan baseline */
+#define AQO_BASELINE_MAXLEN	(256)
+
+/* Columns of the aqo_plan_baselines table */
+#define Anum_baseline_query_hash	(1)
+#define Anum_baseline_signature		(2)
+#define Anum_baseline_pinned		(3)
+#define Anum_baseline_captured		(4)
+#define Natts_baselines				(4)
+
+extern PGDLLIMPORT bool aqo_plan_baselines;
+extern PGDLLIMPORT int aqo_baseline_revalidation;
+
+extern set_rel_pathlist_hook_type prev_set_rel_pathlist_hook;
+extern join_search_hook_type prev_join_search_hook;
+
+extern void baseline_prepare(Query *parse);
+extern void baseline_finish(void);
+extern void baseline_capture(PlannedStmt *stmt, QueryStat *stat);
+extern char *baseline_signature(PlannedStmt *stmt);
+
+extern void aqo_set_rel_pathlist(PlannerInfo *root, RelOptInfo *rel,
+								 Index rti, RangeTblEntry *rte);
+extern RelOptInfo *aqo_join_search(PlannerInfo *root, int levels_needed,
+								   List *initial_rels);
+
+#endif /* BASELINE_H */
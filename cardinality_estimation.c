@@ -6,6 +6,24 @@
  * This is the module in which cardinality estimation problem obtained from
  * cardinality_hooks turns into machine learning problem.
  *
+ * If aqo.shared_fss is on, the dedicated shared feature space (see
+ * AQO_SHARED_FSPACE) is used as a pool of feature subspaces: a subspace,
+ * unknown in the feature space of the query, is searched there. So, a new
+ * query class can get predictions for the plan nodes, learned on other
+ * classes.
+ *
+ * Each prediction has a confidence (see machine_learning.c). A prediction with
+ * the confidence less than aqo.confidence_refuse_threshold is refused, so the
+ * standard estimation is used. A prediction with the confidence less than
+ * aqo.confidence_blend_threshold is blended with the standard estimation by
+ * the cardinality hooks.
+ *
+ * If aqo.hybrid_model is on, the standard estimation of the node, passed by
+ * the hooks, is an additional feature. The model learns the error of the
+ * standard estimator rather than the cardinality itself, so it converges
+ * faster on the nodes with a lot of different constants or join fan-outs.
+ * The fss hash of the node, returned to the hooks, remains the basic one.
+ *
  *******************************************************************************
  *
  * Copyright (c) 2016-2021, Postgres Professional
@@ -18,25 +36,251 @@
 #include "postgres.h"
 
 #include "optimizer/optimizer.h"
+#include "utils/memutils.h"
 
 #include "aqo.h"
+#include "aqo_shared.h"
+#include "coarse_index.h"
+#include "drift.h"
+#include "eviction.h"
 #include "hash.h"
+#include "model.h"
+
+typedef struct
+{
+	int		fss_hash;
+	double	confidence;
+	double	default_rows;
+	double	shadow;
+} PredictionInfo;
+
+/*
+ * Details of predictions made during planning of the query, which can't be
+ * stored in the RelOptInfo: confidence for EXPLAIN, the standard estimation
+ * for learning of the hybrid model and the unused prediction of the shadow
+ * mode.
+ */
+static List *predictions = NIL;
+static MemoryContext PredictionContext = NULL;
+
+/*
+ * Find details of the prediction for the feature subspace or add them. Values
+ * of a new entry are unknown.
+ */
+static PredictionInfo *
+get_prediction_entry(int fss_hash)
+{
+	PredictionInfo	   *entry;
+	ListCell		   *lc;
+	MemoryContext		oldcxt;
+
+	foreach(lc, predictions)
+	{
+		entry = (PredictionInfo *) lfirst(lc);
+		if (entry->fss_hash == fss_hash)
+			return entry;
+	}
+
+	if (PredictionContext == NULL)
+		PredictionContext = AllocSetContextCreate(TopMemoryContext,
+												  "AQO predictions",
+												  ALLOCSET_SMALL_SIZES);
+
+	oldcxt = MemoryContextSwitchTo(PredictionContext);
+	entry = palloc(sizeof(PredictionInfo));
+	entry->fss_hash = fss_hash;
+	entry->confidence = -1.;
+	entry->default_rows = -1.;
+	entry->shadow = -1.;
+	predictions = lappend(predictions, entry);
+	MemoryContextSwitchTo(oldcxt);
+	return entry;
+}
+
+/*
+ * Remember details of the prediction for the plan node, created later.
+ * Negative values mean unknown ones.
+ */
+static void
+record_prediction(int fss_hash, double confidence, double default_rows)
+{
+	PredictionInfo *entry;
 
+	if (!(aqo_show_details && aqo_show_confidence) && default_rows < 0.)
+		return;
+
+	entry = get_prediction_entry(fss_hash);
+	entry->confidence = confidence;
+	entry->default_rows = default_rows;
+}
+
+/*
+ * Remember the prediction, which isn't used in the shadow mode.
+ */
+void
+record_shadow_prediction(int fss_hash, double rows)
+{
+	get_prediction_entry(fss_hash)->shadow = rows;
+}
+
+/*
+ * Returns details of the last prediction for the feature subspace. Unknown
+ * values are set to -1.
+ */
+void
+get_prediction_info(int fss_hash, double *confidence, double *default_rows,
+					double *shadow)
+{
+	ListCell *lc;
+
+	*confidence = -1.;
+	*default_rows = -1.;
+	*shadow = -1.;
+
+	foreach(lc, predictions)
+	{
+		PredictionInfo *entry = (PredictionInfo *) lfirst(lc);
+
+		if (entry->fss_hash == fss_hash)
+		{
+			*confidence = entry->confidence;
+			*default_rows = entry->default_rows;
+			*shadow = entry->shadow;
+			return;
+		}
+	}
+}
+
+/*
+ * Forget predictions of the previous query. Called at the beginning of
+ * planning.
+ */
+void
+prediction_info_clear(void)
+{
+	predictions = NIL;
+	if (PredictionContext != NULL)
+		MemoryContextReset(PredictionContext);
+}
+
+/*
+ * Check the planning budget of the query (see aqo.planning_budget and
+ * aqo.prediction_budget). Once exhausted, the budget remains exhausted till
+ * the end of the planning, so the cardinality hooks use the standard
+ * estimators.
+ */
+bool
+aqo_budget_exhausted(void)
+{
+	if (query_context.budget_exhausted)
+		return true;
+
+	if ((aqo_prediction_budget > 0 &&
+		 query_context.npredictions >= aqo_prediction_budget) ||
+		(aqo_planning_budget > 0 &&
+		 query_context.overhead_time * 1000000. >= aqo_planning_budget))
+	{
+		query_context.budget_exhausted = true;
+		aqo_shared_count(AQO_BUDGET_COUNTER);
+		elog(DEBUG1, "AQO: budget of class %d is exhausted after %d predictions, %f s",
+			 query_context.query_hash, query_context.npredictions,
+			 query_context.overhead_time);
+	}
+
+	return query_context.budget_exhausted;
+}
+
+PG_FUNCTION_INFO_V1(aqo_exhausted_budgets);
+
+/*
+ * Number of plannings with the exhausted budget since the server start.
+ */
+Datum
+aqo_exhausted_budgets(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64((int64) aqo_shared_counter(AQO_BUDGET_COUNTER));
+}
+
+/*
+ * Load the feature subspace of the feature space for a prediction.
+ * If model isn't NULL, the subspace of the feature space model is loaded and
+ * the model is returned. Otherwise, the basic subspace is loaded.
+ * If params isn't NULL, the machine learning parameters of the feature space
+ * are returned.
+ * The subspace is untrusted, if its relations have drifted since the last
+ * learning (see drift.c).
+ */
+static bool
+load_fss_of_fspace(int fhash, int fss_hash, int ncols, double **matrix,
+				   double *targets, int *rows, List *relids,
+				   const AQOModelRoutine **model, AQOModelParams *params)
+{
+	if (model != NULL)
+	{
+		*model = aqo_fspace_model(fhash);
+		fss_hash = aqo_model_fss(*model, fss_hash);
+	}
+	if (params != NULL)
+		aqo_fspace_params(fhash, params);
+
+	if (fss_drifted(fhash, fss_hash, relids))
+		return false;
+
+	if (!load_fss(fhash, fss_hash, ncols, matrix, targets, rows, NULL))
+		return false;
+
+	fss_usage_touch(fhash, fss_hash, true);
+	return true;
+}
+
+/*
+ * Load the feature subspace for a prediction. Fall back to the shared pool, if
+ * the feature space of the query doesn't contain it.
+ */
+bool
+load_fss_for_prediction(int fss_hash, int ncols, double **matrix,
+						double *targets, int *rows, List *relids,
+						const AQOModelRoutine **model, AQOModelParams *params)
+{
+	int		fhash = query_context.fspace_hash;
+
+	if (load_fss_of_fspace(fhash, fss_hash, ncols, matrix, targets, rows,
+						   relids, model, params))
+		return true;
+
+	if (!aqo_shared_fss || fhash == AQO_SHARED_FSPACE)
+		return false;
+
+	return load_fss_of_fspace(AQO_SHARED_FSPACE, fss_hash, ncols, matrix,
+							  targets, rows, relids, model, params);
+}
 
 /*
  * General method for prediction the cardinality of given relation.
+ * default_rows is the standard estimation for the hybrid model or -1.
+ * A weight of the prediction for blending with the standard estimation is
+ * returned in the confidence: one, if the prediction should be used as is.
  */
 double
-predict_for_relation(List *clauses, List *selectivities,
-					 List *relids, int *fss_hash)
+predict_for_relation(List *clauses, List *selectivities, List *relids,
+					 double default_rows, int *fss_hash, double *confidence)
 {
+	int		model_fss;
 	int		nfeatures;
 	double	*matrix[aqo_K];
 	double	targets[aqo_K];
 	double	*features;
+	int		*feature_hashes = NULL;
+	const AQOModelRoutine *model;
+	AQOModelParams params;
 	double	result;
+	bool	coarse = false;
 	int		rows;
 	int		i;
+	instr_time	start;
+	instr_time	end;
+
+	*confidence = 1.;
 
 	if (relids == NIL)
 		/*
@@ -45,16 +289,29 @@ predict_for_relation(List *clauses, List *selectivities,
 		 */
 		return -4.;
 
-	*fss_hash = get_fss_for_object(relids, clauses,
-								   selectivities, &nfeatures, &features);
+	INSTR_TIME_SET_CURRENT(start);
+	query_context.npredictions++;
+
+	*fss_hash = get_fss_signature(relids, clauses, selectivities,
+								  &nfeatures, &features,
+								  aqo_coarse_fallback ? &feature_hashes : NULL);
+
+	model_fss = *fss_hash;
+	if (!aqo_hybrid_model)
+		default_rows = -1.;
+	else if (default_rows >= 0.)
+		model_fss = add_default_estimate_feature(*fss_hash, default_rows,
+												 &nfeatures, &features,
+												 &feature_hashes);
 
 	if (nfeatures > 0)
 		for (i = 0; i < aqo_K; ++i)
 			matrix[i] = palloc0(sizeof(**matrix) * nfeatures);
 
-	if (load_fss(query_context.fspace_hash, *fss_hash, nfeatures, matrix,
-				 targets, &rows, NULL))
-		result = OkNNr_predict(rows, nfeatures, matrix, targets, features);
+	if (load_fss_for_prediction(model_fss, nfeatures, matrix, targets, &rows,
+								relids, &model, &params))
+		result = model->predict(rows, nfeatures, matrix, targets, features,
+								confidence, &params);
 	else
 	{
 		/*
@@ -64,15 +321,52 @@ predict_for_relation(List *clauses, List *selectivities,
 		 * knowledge base.
 		 */
 		result = -1;
+
+		if (feature_hashes != NULL)
+			result = coarse_predict(query_context.fspace_hash, relids,
+									nfeatures, features, feature_hashes,
+									confidence);
+
+		if (result < 0 && feature_hashes != NULL && aqo_shared_fss &&
+			query_context.fspace_hash != AQO_SHARED_FSPACE)
+			result = coarse_predict(AQO_SHARED_FSPACE, relids, nfeatures,
+									features, feature_hashes, confidence);
+		coarse = (result >= 0);
+	}
+
+	record_prediction(*fss_hash, (result >= 0) ? *confidence : -1.,
+					  default_rows);
+
+	if (result >= 0)
+	{
+		if (*confidence < aqo_confidence_refuse_threshold)
+		{
+			elog(DEBUG1, "AQO: prediction for fss %d is refused, confidence %f",
+				 model_fss, *confidence);
+			result = -1;
+		}
+		else if (!coarse && *confidence >= aqo_confidence_blend_threshold)
+			/*
+			 * Use the prediction as is. A prediction by a coarser model is
+			 * always blended.
+			 */
+			*confidence = 1.;
 	}
 
 	pfree(features);
+	if (feature_hashes != NULL)
+		pfree(feature_hashes);
 	if (nfeatures > 0)
 	{
 		for (i = 0; i < aqo_K; ++i)
 			pfree(matrix[i]);
 	}
 
+	/* The prediction is an overhead of AQO (see fast_path.c). */
+	INSTR_TIME_SET_CURRENT(end);
+	INSTR_TIME_SUBTRACT(end, start);
+	query_context.overhead_time += INSTR_TIME_GET_DOUBLE(end);
+
 	if (result < 0)
 		return -1;
 	else
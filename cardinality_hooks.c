@@ -15,6 +15,12 @@
  * to be true cardinality for given relation. Negative returned value means
  * refusal to predict cardinality. In this case hooks also use default
  * postgreSQL cardinality estimator.
+ * A prediction with a confidence less than one is blended with the default
+ * estimation.
+ * For the hybrid model the default estimation is made before the prediction
+ * and passed to predict_for_relation as a feature.
+ * In the shadow mode the prediction is remembered for the plan node, but the
+ * default estimation is used (see shadow.c).
  *
  *******************************************************************************
  *
@@ -27,6 +33,8 @@
 
 #include "postgres.h"
 
+#include "optimizer/optimizer.h"
+
 #include "aqo.h"
 #include "cardinality_hooks.h"
 #include "hash.h"
@@ -129,6 +137,47 @@ default_estimate_num_groups(PlannerInfo *root, List *groupExprs,
 		return estimate_num_groups(root, groupExprs, input_rows, pgset, estinfo);
 }
 
+/*
+ * Blend a prediction with the default estimation according to the confidence
+ * of the prediction. Errors of cardinality estimation are multiplicative, so
+ * the blending is made in the logarithmic scale.
+ */
+static double
+blend_prediction(double predicted, double confidence, double default_rows)
+{
+	if (confidence >= 1. || default_rows <= 0.)
+		return predicted;
+
+	return clamp_row_est(exp(confidence * log(predicted) +
+							 (1. - confidence) * log(default_rows)));
+}
+
+/*
+ * Predictions aren't needed, if AQO isn't used for the query, the planning is
+ * steered by a plan baseline, or the budget of the planning is exhausted.
+ */
+static inline bool
+skip_prediction(void)
+{
+	return (!query_context.use_aqo && !query_context.shadow) ||
+		   query_context.use_baseline || aqo_budget_exhausted();
+}
+
+/*
+ * In the shadow mode, remember the prediction for the plan node and refuse to
+ * use it.
+ */
+static inline double
+shadow_prediction(int fss, double predicted)
+{
+	if (!query_context.shadow)
+		return predicted;
+
+	if (predicted >= 0)
+		record_shadow_prediction(fss, predicted);
+	return -1.;
+}
+
 /*
  * Our hook for setting baserel rows estimate.
  * Extracts clauses, their selectivities and list of relation relids and
@@ -143,20 +192,21 @@ aqo_set_baserel_rows_estimate(PlannerInfo *root, RelOptInfo *rel)
 	List	   *selectivities = NULL;
 	List	*clauses;
 	int fss = 0;
+	double		confidence;
+	double		default_rows = -1.;
 
 	if (IsQueryDisabled())
 		/* Fast path. */
 		goto default_estimator;
 
-	if (query_context.use_aqo || query_context.learn_aqo)
+	if (query_context.use_aqo || query_context.learn_aqo ||
+		query_context.shadow)
 		selectivities = get_selectivities(root, rel->baserestrictinfo, 0,
 										  JOIN_INNER, NULL);
 
-	if (!query_context.use_aqo)
+	if (skip_prediction())
 	{
-		if (query_context.learn_aqo)
-			list_free_deep(selectivities);
-
+		list_free_deep(selectivities);
 		goto default_estimator;
 	}
 
@@ -165,15 +215,32 @@ aqo_set_baserel_rows_estimate(PlannerInfo *root, RelOptInfo *rel)
 		/* Predict for a plane table only. */
 		relids = list_make1_int(relid);
 
+	if (aqo_hybrid_model)
+	{
+		default_set_baserel_rows_estimate(root, rel);
+		default_rows = rel->rows;
+	}
+
 	clauses = aqo_get_clauses(root, rel->baserestrictinfo);
-	predicted = predict_for_relation(clauses, selectivities,
-									 relids, &fss);
+	predicted = predict_for_relation(clauses, selectivities, relids,
+									 default_rows, &fss, &confidence);
 	rel->fss_hash = fss;
 
 	list_free_deep(selectivities);
 	list_free(clauses);
 	list_free(relids);
 
+	if (predicted >= 0 && confidence < 1.)
+	{
+		if (default_rows < 0.)
+		{
+			default_set_baserel_rows_estimate(root, rel);
+			default_rows = rel->rows;
+		}
+		predicted = blend_prediction(predicted, confidence, default_rows);
+	}
+	predicted = shadow_prediction(fss, predicted);
+
 	if (predicted >= 0)
 	{
 		rel->rows = predicted;
@@ -181,6 +248,14 @@ aqo_set_baserel_rows_estimate(PlannerInfo *root, RelOptInfo *rel)
 		return;
 	}
 
+	if (default_rows >= 0.)
+	{
+		/* The default estimation is made already. */
+		rel->predicted_cardinality = -1.;
+		rel->rows = default_rows;
+		return;
+	}
+
 default_estimator:
 	rel->predicted_cardinality = -1.;
 	default_set_baserel_rows_estimate(root, rel);
@@ -219,12 +294,15 @@ aqo_get_parameterized_baserel_size(PlannerInfo *root,
 	int		   *eclass_hash;
 	int			current_hash;
 	int fss = 0;
+	double		confidence;
+	double		default_rows = -1.;
 
 	if (IsQueryDisabled())
 		/* Fast path */
 		goto default_estimator;
 
-	if (query_context.use_aqo || query_context.learn_aqo)
+	if (query_context.use_aqo || query_context.learn_aqo ||
+		query_context.shadow)
 	{
 		MemoryContext mcxt;
 
@@ -250,14 +328,10 @@ aqo_get_parameterized_baserel_size(PlannerInfo *root,
 		pfree(eclass_hash);
 	}
 
-	if (!query_context.use_aqo)
+	if (skip_prediction())
 	{
-		if (query_context.learn_aqo)
-		{
-			list_free_deep(selectivities);
-			list_free(allclauses);
-		}
-
+		list_free_deep(selectivities);
+		list_free(allclauses);
 		goto default_estimator;
 	}
 
@@ -265,13 +339,29 @@ aqo_get_parameterized_baserel_size(PlannerInfo *root,
 		/* Predict for a plane table only. */
 		relids = list_make1_int(relid);
 
-	predicted = predict_for_relation(allclauses, selectivities, relids, &fss);
+	if (aqo_hybrid_model)
+		default_rows = default_get_parameterized_baserel_size(root, rel,
+															  param_clauses);
+
+	predicted = predict_for_relation(allclauses, selectivities, relids,
+									 default_rows, &fss, &confidence);
+
+	if (predicted >= 0 && confidence < 1.)
+	{
+		if (default_rows < 0.)
+			default_rows = default_get_parameterized_baserel_size(root, rel,
+																  param_clauses);
+		predicted = blend_prediction(predicted, confidence, default_rows);
+	}
 
+	predicted = shadow_prediction(fss, predicted);
 	predicted_ppi_rows = predicted;
 	fss_ppi_hash = fss;
 
 	if (predicted >= 0)
 		return predicted;
+	else if (default_rows >= 0.)
+		return default_rows;
 
 default_estimator:
 	return default_get_parameterized_baserel_size(root, rel, param_clauses);
@@ -299,20 +389,21 @@ aqo_set_joinrel_size_estimates(PlannerInfo *root, RelOptInfo *rel,
 	List	   *outer_selectivities;
 	List	   *current_selectivities = NULL;
 	int				fss = 0;
+	double			confidence;
+	double			default_rows = -1.;
 
 	if (IsQueryDisabled())
 		/* Fast path */
 		goto default_estimator;
 
-	if (query_context.use_aqo || query_context.learn_aqo)
+	if (query_context.use_aqo || query_context.learn_aqo ||
+		query_context.shadow)
 		current_selectivities = get_selectivities(root, restrictlist, 0,
 												  sjinfo->jointype, sjinfo);
 
-	if (!query_context.use_aqo)
+	if (skip_prediction())
 	{
-		if (query_context.learn_aqo)
-			list_free_deep(current_selectivities);
-
+		list_free_deep(current_selectivities);
 		goto default_estimator;
 	}
 
@@ -327,9 +418,31 @@ aqo_set_joinrel_size_estimates(PlannerInfo *root, RelOptInfo *rel,
 								list_concat(outer_selectivities,
 											inner_selectivities));
 
-	predicted = predict_for_relation(allclauses, selectivities, relids, &fss);
+	if (aqo_hybrid_model)
+	{
+		default_set_joinrel_size_estimates(root, rel,
+										   outer_rel, inner_rel,
+										   sjinfo, restrictlist);
+		default_rows = rel->rows;
+	}
+
+	predicted = predict_for_relation(allclauses, selectivities, relids,
+									 default_rows, &fss, &confidence);
 	rel->fss_hash = fss;
 
+	if (predicted >= 0 && confidence < 1.)
+	{
+		if (default_rows < 0.)
+		{
+			default_set_joinrel_size_estimates(root, rel,
+											   outer_rel, inner_rel,
+											   sjinfo, restrictlist);
+			default_rows = rel->rows;
+		}
+		predicted = blend_prediction(predicted, confidence, default_rows);
+	}
+	predicted = shadow_prediction(fss, predicted);
+
 	if (predicted >= 0)
 	{
 		rel->predicted_cardinality = predicted;
@@ -337,6 +450,14 @@ aqo_set_joinrel_size_estimates(PlannerInfo *root, RelOptInfo *rel,
 		return;
 	}
 
+	if (default_rows >= 0.)
+	{
+		/* The default estimation is made already. */
+		rel->predicted_cardinality = -1;
+		rel->rows = default_rows;
+		return;
+	}
+
 default_estimator:
 	rel->predicted_cardinality = -1;
 	default_set_joinrel_size_estimates(root, rel,
@@ -367,20 +488,21 @@ aqo_get_parameterized_joinrel_size(PlannerInfo *root,
 	List	   *outer_selectivities;
 	List	   *current_selectivities = NULL;
 	int			fss = 0;
+	double		confidence;
+	double		default_rows = -1.;
 
 	if (IsQueryDisabled())
 		/* Fast path */
 		goto default_estimator;
 
-	if (query_context.use_aqo || query_context.learn_aqo)
+	if (query_context.use_aqo || query_context.learn_aqo ||
+		query_context.shadow)
 		current_selectivities = get_selectivities(root, clauses, 0,
 												  sjinfo->jointype, sjinfo);
 
-	if (!query_context.use_aqo)
+	if (skip_prediction())
 	{
-		if (query_context.learn_aqo)
-			list_free_deep(current_selectivities);
-
+		list_free_deep(current_selectivities);
 		goto default_estimator;
 	}
 
@@ -393,13 +515,35 @@ aqo_get_parameterized_joinrel_size(PlannerInfo *root,
 								list_concat(outer_selectivities,
 											inner_selectivities));
 
-	predicted = predict_for_relation(allclauses, selectivities, relids, &fss);
+	if (aqo_hybrid_model)
+		default_rows = default_get_parameterized_joinrel_size(root, rel,
+															  outer_path,
+															  inner_path,
+															  sjinfo,
+															  clauses);
+
+	predicted = predict_for_relation(allclauses, selectivities, relids,
+									 default_rows, &fss, &confidence);
 
+	if (predicted >= 0 && confidence < 1.)
+	{
+		if (default_rows < 0.)
+			default_rows = default_get_parameterized_joinrel_size(root, rel,
+																  outer_path,
+																  inner_path,
+																  sjinfo,
+																  clauses);
+		predicted = blend_prediction(predicted, confidence, default_rows);
+	}
+
+	predicted = shadow_prediction(fss, predicted);
 	predicted_ppi_rows = predicted;
 	fss_ppi_hash = fss;
 
 	if (predicted >= 0)
 		return predicted;
+	else if (default_rows >= 0.)
+		return default_rows;
 
 default_estimator:
 	return default_get_parameterized_joinrel_size(root, rel,
@@ -415,24 +559,28 @@ predict_num_groups(PlannerInfo *root, Path *subpath, List *group_exprs,
 	double prediction;
 	int rows;
 	double target;
+	double confidence;
+	List *relids;
+
+	relids = get_list_of_relids(root, subpath->parent->relids);
 
 	if (subpath->parent->predicted_cardinality > 0.)
 		/* A fast path. Here we can use a fss hash of a leaf. */
 		child_fss = subpath->parent->fss_hash;
 	else
 	{
-		List *relids;
 		List *clauses;
 		List *selectivities = NIL;
 
-		relids = get_list_of_relids(root, subpath->parent->relids);
 		clauses = get_path_clauses(subpath, root, &selectivities);
-		(void) predict_for_relation(clauses, selectivities, relids, &child_fss);
+		(void) predict_for_relation(clauses, selectivities, relids, -1.,
+									&child_fss, &confidence);
 	}
 
 	*fss = get_grouped_exprs_hash(child_fss, group_exprs);
 
-	if (!load_fss(query_context.fspace_hash, *fss, 0, NULL, &target, &rows, NULL))
+	if (!load_fss_for_prediction(*fss, 0, NULL, &target, &rows, relids,
+								 NULL, NULL))
 		return -1;
 
 	Assert(rows == 1);
@@ -448,7 +596,7 @@ aqo_estimate_num_groups_hook(PlannerInfo *root, List *groupExprs,
 	int fss;
 	double predicted;
 
-	if (!query_context.use_aqo)
+	if (skip_prediction())
 		goto default_estimator;
 
 	if (pgset || groupExprs == NIL)
@@ -466,6 +614,13 @@ aqo_estimate_num_groups_hook(PlannerInfo *root, List *groupExprs,
 		return 1.0;
 
 	predicted = predict_num_groups(root, subpath, groupExprs, &fss);
+	if (query_context.shadow)
+	{
+		/* The plan node will find the prediction by the hash. */
+		grouped_rel->fss_hash = fss;
+		predicted = shadow_prediction(fss, predicted);
+	}
+
 	if (predicted > 0.)
 	{
 		grouped_rel->predicted_cardinality = predicted;
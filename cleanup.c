@@ -0,0 +1,169 @@
+/*
+ *******************************************************************************
+ *
+ *	CLEANUP OF THE KNOWLEDGE BASE
+ *
+ * Feature subspaces refer to relations by their OIDs (see the 'oids' column of
+ * the aqo_data table). When a relation is dropped, its data in the knowledge
+ * base becomes useless. An event trigger on the sql_drop event removes it
+ * within the dropping transaction: feature subspaces which refer to dropped
+ * relations and query classes which own such subspaces in their own feature
+ * space. The same rule is used by the clean_aqo_data() full sweep.
+ *
+ * Both deletions are set-based and use the GIN index on the 'oids' column.
+ * The dropping user may have no rights on the AQO tables, so the deletions are
+ * made on behalf of their owner.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/cleanup.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "catalog/namespace.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "commands/event_trigger.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "utils/array.h"
+#include "utils/lsyscache.h"
+#include "utils/syscache.h"
+
+#include "aqo.h"
+#include "cleanup.h"
+
+
+bool	aqo_cleanup_dropped = true;
+
+PG_FUNCTION_INFO_V1(aqo_drop_cleanup);
+
+
+/*
+ * Collect OIDs of dropped relations. Returns NULL if no one relation was
+ * dropped.
+ */
+static ArrayType *
+get_dropped_relations(void)
+{
+	Datum	   *oids;
+	ArrayType  *array;
+	uint64		i;
+	int			ret;
+
+	ret = SPI_execute("SELECT objid FROM pg_catalog.pg_event_trigger_dropped_objects() "
+					  "WHERE classid = 'pg_catalog.pg_class'::regclass "
+					  "AND objsubid = 0", true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "AQO cleanup: SPI_execute failed: error code %d", ret);
+
+	if (SPI_processed == 0)
+		return NULL;
+
+	oids = (Datum *) palloc(sizeof(Datum) * SPI_processed);
+	for (i = 0; i < SPI_processed; i++)
+	{
+		bool	isnull;
+
+		oids[i] = SPI_getbinval(SPI_tuptable->vals[i],
+								SPI_tuptable->tupdesc, 1, &isnull);
+	}
+
+	array = construct_array(oids, (int) SPI_processed, OIDOID, sizeof(Oid),
+							true, TYPALIGN_INT);
+	pfree(oids);
+	return array;
+}
+
+/*
+ * Owner of the relation. It is the owner of the AQO extension for its tables.
+ */
+static Oid
+get_relation_owner(Oid relid)
+{
+	HeapTuple	tuple;
+	Oid			owner;
+
+	tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+	if (!HeapTupleIsValid(tuple))
+		elog(ERROR, "cache lookup failed for relation %u", relid);
+
+	owner = ((Form_pg_class) GETSTRUCT(tuple))->relowner;
+	ReleaseSysCache(tuple);
+	return owner;
+}
+
+/*
+ * Event trigger on the sql_drop event.
+ */
+Datum
+aqo_drop_cleanup(PG_FUNCTION_ARGS)
+{
+	ArrayType  *dropped;
+	Oid			argtypes[1] = { OIDARRAYOID };
+	Datum		args[1];
+	Oid			nspoid;
+	Oid			relid;
+	Oid			save_userid;
+	int			save_sec_context;
+	int			ret;
+
+	if (!CALLED_AS_EVENT_TRIGGER(fcinfo))
+		elog(ERROR, "aqo_drop_cleanup: must be called as event trigger");
+
+	if (!aqo_cleanup_dropped)
+		PG_RETURN_VOID();
+
+	/* The AQO extension itself could be dropped by the command. */
+	nspoid = get_namespace_oid("public", true);
+	if (!OidIsValid(nspoid))
+		PG_RETURN_VOID();
+	relid = get_relname_relid("aqo_data", nspoid);
+	if (!OidIsValid(relid) ||
+		!OidIsValid(get_relname_relid("aqo_queries", nspoid)))
+		PG_RETURN_VOID();
+
+	SPI_connect();
+
+	dropped = get_dropped_relations();
+	if (dropped == NULL)
+	{
+		SPI_finish();
+		PG_RETURN_VOID();
+	}
+	args[0] = PointerGetDatum(dropped);
+
+	/* An error restores the user at the abort of the transaction. */
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(get_relation_owner(relid),
+						   save_sec_context | SECURITY_LOCAL_USERID_CHANGE |
+						   SECURITY_RESTRICTED_OPERATION);
+
+	/*
+	 * Remove query classes. The foreign keys remove all their data. The COMMON
+	 * feature space and the shared pool (AQO_SHARED_FSPACE) are kept.
+	 */
+	ret = SPI_execute_with_args("DELETE FROM public.aqo_queries "
+								"WHERE query_hash NOT IN (0, -1) AND "
+								"query_hash = fspace_hash AND "
+								"fspace_hash IN (SELECT fspace_hash "
+								"FROM public.aqo_data WHERE oids && $1)",
+								1, argtypes, args, NULL, false, 0);
+	if (ret != SPI_OK_DELETE)
+		elog(ERROR, "AQO cleanup: SPI_execute failed: error code %d", ret);
+
+	/* Remove subspaces of other feature spaces, related to the relations. */
+	ret = SPI_execute_with_args("DELETE FROM public.aqo_data WHERE oids && $1",
+								1, argtypes, args, NULL, false, 0);
+	if (ret != SPI_OK_DELETE)
+		elog(ERROR, "AQO cleanup: SPI_execute failed: error code %d", ret);
+
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+	SPI_finish();
+	PG_RETURN_VOID();
+}
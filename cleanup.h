@@ -0,0 +1,8 @@
+#ifndef CLEANUP_H
+#define CLEANUP_H
+
+#include "postgres.h"
+
+extern PGDLLIMPORT bool aqo_cleanup_dropped;
+
+#endif /* CLEANUP_H */
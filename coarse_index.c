@@ -0,0 +1,290 @@
+/*
+ *******************************************************************************
+ *
+ *	FALLBACK PREDICTIONS BY COARSER MODELS
+ *
+ * A feature subspace is identified by a set of relations, a set of clauses and
+ * equivalence classes. If a plan node differs from a learned one by a clause
+ * or by an equivalence class only, it gets another feature subspace, and AQO
+ * can't predict its cardinality.
+ *
+ * This module keeps a secondary index over coarser signatures: for each set of
+ * relations of a feature space it remembers a few learned feature subspaces
+ * with hashes of their features (clauses). If the subspace of a node is
+ * unknown, the nearest coarser model is used: the learned subspace of the same
+ * relations, whose clauses are a subset of the node clauses, with the least
+ * number of missed clauses. The model predicts by the common features, and
+ * selectivities of the missed clauses are applied as if they were independent.
+ *
+ * Such a prediction is less reliable. Confidence of the model prediction is
+ * discounted by aqo.coarse_confidence in the power of (1 + number of missed
+ * clauses). The cardinality hooks blend the prediction with the standard
+ * estimate according to the confidence.
+ *
+ * The index stores basic hashes of subspaces, the model of the feature space
+ * is applied at prediction time (see model.c).
+ *
+ * The index is a shared table (see aqo_shared.c), filled by the learning
+ * procedure. It isn't stored on disk, so after a restart it is rebuilt by new
+ * learning samples.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/coarse_index.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "coarse_index.h"
+#include "drift.h"
+#include "eviction.h"
+#include "hash.h"
+#include "model.h"
+
+
+/* Max number of remembered subspaces for a set of relations. */
+#define AQO_COARSE_MAX_CANDIDATES	(4)
+
+/* Max number of features of a remembered subspace. */
+#define AQO_COARSE_MAX_FEATURES		(16)
+
+bool	aqo_coarse_fallback = false;
+int		aqo_coarse_max_missing = 1;
+double	aqo_coarse_confidence = 0.5;
+int		aqo_coarse_index_size = 10000;
+
+typedef struct CoarseKey
+{
+	Oid		dbid;
+	int		fhash;
+	int		relids_hash;
+} CoarseKey;
+
+typedef struct CoarseCandidate
+{
+	int		fss_hash;
+	int		nfeatures;
+	int		hashes[AQO_COARSE_MAX_FEATURES];
+} CoarseCandidate;
+
+typedef struct CoarseEntry
+{
+	CoarseKey			key;
+
+	pg_atomic_uint64	lru;
+	int					ncandidates;
+	int					next;		/* candidate to replace */
+	CoarseCandidate		candidates[AQO_COARSE_MAX_CANDIDATES];
+} CoarseEntry;
+
+
+static inline void
+init_coarse_key(CoarseKey *key, int fhash, List *relids)
+{
+	memset(key, 0, sizeof(CoarseKey));
+	key->dbid = MyDatabaseId;
+	key->fhash = fhash;
+	key->relids_hash = get_relidslist_hash(relids);
+}
+
+/*
+ * Remember the learned feature subspace in the index.
+ */
+void
+coarse_index_add(int fhash, List *relids, int fss_hash,
+				 int nfeatures, const int *feature_hashes)
+{
+	CoarseKey			key;
+	CoarseEntry		   *entry;
+	CoarseCandidate	   *candidate;
+	bool				found;
+	int					i;
+
+	if (!aqo_coarse_fallback || relids == NIL ||
+		nfeatures > AQO_COARSE_MAX_FEATURES)
+		return;
+
+	init_coarse_key(&key, fhash, relids);
+	entry = (CoarseEntry *) aqo_shared_find(AQO_COARSE_TABLE, &key, false);
+	if (entry != NULL)
+	{
+		/* Fast path: the subspace is already known. */
+		for (i = 0; i < entry->ncandidates; i++)
+			if (entry->candidates[i].fss_hash == fss_hash)
+				break;
+
+		found = (i < entry->ncandidates);
+		aqo_shared_release(AQO_COARSE_TABLE, entry);
+		if (found)
+			return;
+	}
+
+	entry = (CoarseEntry *) aqo_shared_insert(AQO_COARSE_TABLE, &key, &found);
+	if (entry == NULL)
+		return;
+
+	for (i = 0; i < entry->ncandidates; i++)
+		if (entry->candidates[i].fss_hash == fss_hash)
+			break;
+
+	if (i == entry->ncandidates)
+	{
+		/* Replace the oldest candidate, if there is no free place. */
+		if (entry->ncandidates < AQO_COARSE_MAX_CANDIDATES)
+			candidate = &entry->candidates[entry->ncandidates++];
+		else
+		{
+			candidate = &entry->candidates[entry->next];
+			entry->next = (entry->next + 1) % AQO_COARSE_MAX_CANDIDATES;
+		}
+
+		candidate->fss_hash = fss_hash;
+		candidate->nfeatures = nfeatures;
+		memcpy(candidate->hashes, feature_hashes, sizeof(int) * nfeatures);
+	}
+
+	aqo_shared_release(AQO_COARSE_TABLE, entry);
+}
+
+/*
+ * Check that features of the candidate are a subset of the given features.
+ * Both arrays of hashes are sorted. Returns number of missed features or -1.
+ */
+static int
+count_missing(const CoarseCandidate *candidate,
+			  int nfeatures, const int *feature_hashes)
+{
+	int		i = 0;
+	int		j;
+
+	if (candidate->nfeatures > nfeatures)
+		return -1;
+
+	for (j = 0; j < nfeatures && i < candidate->nfeatures; j++)
+	{
+		if (candidate->hashes[i] == feature_hashes[j])
+			i++;
+		else if (candidate->hashes[i] < feature_hashes[j])
+			return -1;
+	}
+
+	return (i == candidate->nfeatures) ? nfeatures - candidate->nfeatures : -1;
+}
+
+/*
+ * Predict logarithm of cardinality by the nearest coarser model.
+ * Returns -1 if there is no suitable model.
+ */
+double
+coarse_predict(int fhash, List *relids, int nfeatures, const double *features,
+			   const int *feature_hashes, double *confidence)
+{
+	CoarseKey			key;
+	CoarseEntry		   *entry;
+	CoarseCandidate		candidate;
+	double			   *matrix[aqo_K];
+	double				targets[aqo_K];
+	double			   *projected;
+	double				missed = 0.;
+	double				model_confidence;
+	const AQOModelRoutine *model;
+	AQOModelParams		params;
+	int					fss_hash;
+	int					nmissing = -1;
+	int					rows;
+	int					i;
+	int					j;
+	double				result = -1.;
+
+	if (!aqo_coarse_fallback || relids == NIL)
+		return -1.;
+
+	init_coarse_key(&key, fhash, relids);
+	entry = (CoarseEntry *) aqo_shared_find(AQO_COARSE_TABLE, &key, false);
+	if (entry == NULL)
+		return -1.;
+
+	for (i = 0; i < entry->ncandidates; i++)
+	{
+		int n = count_missing(&entry->candidates[i], nfeatures, feature_hashes);
+
+		if (n < 0 || n > aqo_coarse_max_missing ||
+			(nmissing >= 0 && n >= nmissing))
+			continue;
+
+		nmissing = n;
+		candidate = entry->candidates[i];
+	}
+	aqo_shared_release(AQO_COARSE_TABLE, entry);
+
+	if (nmissing < 0)
+		return -1.;
+
+	/* Project the features on the model and sum selectivities of the rest. */
+	projected = palloc(sizeof(double) * Max(candidate.nfeatures, 1));
+	for (i = 0, j = 0; j < nfeatures; j++)
+	{
+		if (i < candidate.nfeatures &&
+			candidate.hashes[i] == feature_hashes[j])
+			projected[i++] = features[j];
+		else
+			/* Only a selectivity can reduce the cardinality. */
+			missed += Min(features[j], 0.);
+	}
+
+	for (i = 0; i < aqo_K; i++)
+		matrix[i] = palloc0(sizeof(double) * Max(candidate.nfeatures, 1));
+
+	model = aqo_fspace_model(fhash);
+	aqo_fspace_params(fhash, &params);
+	fss_hash = aqo_model_fss(model, candidate.fss_hash);
+	if (!fss_drifted(fhash, fss_hash, relids) &&
+		load_fss(fhash, fss_hash, candidate.nfeatures, matrix, targets, &rows,
+				 NULL))
+	{
+		result = model->predict(rows, candidate.nfeatures, matrix, targets,
+								projected, &model_confidence, &params);
+		if (result >= 0.)
+		{
+			result = Max(result + missed, 0.);
+			*confidence = model_confidence *
+						  pow(aqo_coarse_confidence, nmissing + 1);
+			fss_usage_touch(fhash, fss_hash, true);
+		}
+	}
+
+	for (i = 0; i < aqo_K; i++)
+		pfree(matrix[i]);
+	pfree(projected);
+
+	elog(DEBUG1, "AQO: coarse prediction by fss %d with %d missed features: %f",
+		 candidate.fss_hash, nmissing, result);
+	return result;
+}
+
+/*
+ * Remove the index of the database. InvalidOid means all databases.
+ * Returns number of removed entries.
+ */
+long
+coarse_index_reset(Oid dbid)
+{
+	return aqo_shared_remove_database(AQO_COARSE_TABLE, dbid);
+}
+
+void
+coarse_index_init(void)
+{
+	aqo_shared_register_table(AQO_COARSE_TABLE, "aqo_coarse_index",
+							  sizeof(CoarseKey), sizeof(CoarseEntry),
+							  offsetof(CoarseEntry, lru),
+							  &aqo_coarse_index_size);
+}
@@ -0,0 +1,22 @@
+#ifndef COARSE_INDEX_H
+#define COARSE_INDEX_H
+
+#include "postgres.h"
+
+#include "nodes/pg_list.h"
+
+extern PGDLLIMPORT bool aqo_coarse_fallback;
+extern PGDLLIMPORT int aqo_coarse_max_missing;
+extern PGDLLIMPORT double aqo_coarse_confidence;
+extern PGDLLIMPORT int aqo_coarse_index_size;
+
+extern void coarse_index_add(int fhash, List *relids, int fss_hash,
+							 int nfeatures, const int *feature_hashes);
+extern double coarse_predict(int fhash, List *relids, int nfeatures,
+							 const double *features,
+							 const int *feature_hashes, double *confidence);
+extern long coarse_index_reset(Oid dbid);
+
+extern void coarse_index_init(void);
+
+#endif /* COARSE_INDEX_H */
@@ -0,0 +1,184 @@
+/*
+ *******************************************************************************
+ *
+ *	DRIFT DETECTION OF FEATURE SUBSPACES
+ *
+ * The learning procedure smooths new objects into the learned ones, so after a
+ * bulk load or a massive delete the model of a feature subspace produces stale
+ * predictions until many new samples overwrite it.
+ *
+ * This module remembers, for each learned feature subspace, cumulative numbers
+ * of inserted, updated and deleted tuples and the number of live tuples of its
+ * relations at the moment of the last learning (see pgstat). The drift of the
+ * subspace is the number of tuple modifications since the last learning,
+ * relative to the number of live tuples at that moment. If it exceeds
+ * aqo.drift_threshold:
+ * 1. The subspace is untrusted: its predictions are refused, and the standard
+ *	estimation (already aware of the new table sizes) is used.
+ * 2. The next learning forgets the learned objects and starts the model from
+ *	the new sample.
+ *
+ * Baselines are kept in a shared table (see aqo_shared.c). It isn't stored on
+ * disk, so after a restart the drift is measured from the next learning.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/drift.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "drift.h"
+
+
+double	aqo_drift_threshold = 0.;
+int		aqo_drift_table_size = 10000;
+
+typedef struct DriftKey
+{
+	Oid		dbid;
+	int		fhash;
+	int		fss_hash;
+} DriftKey;
+
+typedef struct DriftEntry
+{
+	DriftKey			key;
+
+	pg_atomic_uint64	lru;
+	int64				nmod;		/* modifications of the relations */
+	int64				ntuples;	/* live tuples of the relations */
+} DriftEntry;
+
+
+static inline void
+init_drift_key(DriftKey *key, int fhash, int fss_hash)
+{
+	memset(key, 0, sizeof(DriftKey));
+	key->dbid = MyDatabaseId;
+	key->fhash = fhash;
+	key->fss_hash = fss_hash;
+}
+
+/*
+ * Sum counters of the relations, collected by the cumulative statistics system.
+ */
+static void
+get_relations_counters(List *relids, int64 *nmod, int64 *ntuples)
+{
+	ListCell *lc;
+
+	*nmod = 0;
+	*ntuples = 0;
+
+	foreach(lc, relids)
+	{
+		PgStat_StatTabEntry *tabentry;
+
+		tabentry = pgstat_fetch_stat_tabentry((Oid) lfirst_int(lc));
+		if (tabentry == NULL)
+			continue;
+
+		*nmod += tabentry->tuples_inserted + tabentry->tuples_updated +
+				 tabentry->tuples_deleted;
+		*ntuples += tabentry->n_live_tuples;
+	}
+}
+
+/*
+ * Have the relations of the feature subspace drifted since its last learning?
+ */
+bool
+fss_drifted(int fhash, int fss_hash, List *relids)
+{
+	DriftKey	key;
+	DriftEntry *entry;
+	int64		base_nmod;
+	int64		base_ntuples;
+	int64		nmod;
+	int64		ntuples;
+	double		drift;
+
+	if (aqo_drift_threshold <= 0. || relids == NIL)
+		return false;
+
+	init_drift_key(&key, fhash, fss_hash);
+	entry = (DriftEntry *) aqo_shared_find(AQO_DRIFT_TABLE, &key, false);
+	if (entry == NULL)
+		/* Nothing is known about the last learning. */
+		return false;
+
+	base_nmod = entry->nmod;
+	base_ntuples = entry->ntuples;
+	aqo_shared_release(AQO_DRIFT_TABLE, entry);
+
+	get_relations_counters(relids, &nmod, &ntuples);
+
+	/* Counters could be reset. Measure the drift from scratch then. */
+	if (nmod < base_nmod)
+		base_nmod = 0;
+
+	drift = (double) (nmod - base_nmod) / Max(base_ntuples, 1);
+	if (drift < aqo_drift_threshold)
+		return false;
+
+	elog(DEBUG1, "AQO: feature subspace (%d, %d) has drifted by %f",
+		 fhash, fss_hash, drift);
+	return true;
+}
+
+/*
+ * Remember counters of the relations at the learning of the feature subspace.
+ */
+void
+fss_drift_baseline(int fhash, int fss_hash, List *relids)
+{
+	DriftKey	key;
+	DriftEntry *entry;
+	int64		nmod;
+	int64		ntuples;
+	bool		found;
+
+	if (aqo_drift_threshold <= 0. || relids == NIL)
+		return;
+
+	get_relations_counters(relids, &nmod, &ntuples);
+
+	init_drift_key(&key, fhash, fss_hash);
+	entry = (DriftEntry *) aqo_shared_insert(AQO_DRIFT_TABLE, &key, &found);
+	if (entry == NULL)
+		/* The shared table is disabled. */
+		return;
+
+	entry->nmod = nmod;
+	entry->ntuples = ntuples;
+	aqo_shared_release(AQO_DRIFT_TABLE, entry);
+}
+
+/*
+ * Remove baselines of the database. InvalidOid means all databases.
+ * Returns number of removed entries.
+ */
+long
+drift_reset(Oid dbid)
+{
+	return aqo_shared_remove_database(AQO_DRIFT_TABLE, dbid);
+}
+
+void
+drift_init(void)
+{
+	aqo_shared_register_table(AQO_DRIFT_TABLE, "aqo_drift",
+							  sizeof(DriftKey), sizeof(DriftEntry),
+							  offsetof(DriftEntry, lru),
+							  &aqo_drift_table_size);
+}
@@ -0,0 +1,17 @@
+#ifndef DRIFT_H
+#define DRIFT_H
+
+#include "postgres.h"
+
+#include "nodes/pg_list.h"
+
+extern PGDLLIMPORT double aqo_drift_threshold;
+extern PGDLLIMPORT int aqo_drift_table_size;
+
+extern bool fss_drifted(int fhash, int fss_hash, List *relids);
+extern void fss_drift_baseline(int fhash, int fss_hash, List *relids);
+extern long drift_reset(Oid dbid);
+
+extern void drift_init(void);
+
+#endif /* DRIFT_H */
@@ -0,0 +1,506 @@
+/*
+ *******************************************************************************
+ *
+ *	BOUNDED KNOWLEDGE BASE
+ *
+ * Each new query class adds its own feature space, so the aqo_data table grows
+ * without limit under an ad-hoc workload. This module tracks usage of feature
+ * subspaces and evicts the least valuable ones, when the knowledge base
+ * exceeds the configured limits.
+ *
+ * Usage counters (time of the last use and number of predictions) are kept in
+ * a shared table (see aqo_shared.c) and flushed lazily into the aqo_fss_usage
+ * table. The flushed counters are kept until the end of the transaction and
+ * are put back into shared memory, if it aborts.
+ *
+ * The eviction removes subspaces above the limits of the database and of each
+ * feature space, ordered by the aqo.eviction_policy. It is made by the
+ * aqo_evict() call or periodically by a background worker.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/eviction.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "commands/extension.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "eviction.h"
+#include "prewarm.h"
+
+
+int		aqo_fss_usage_size = 10000;
+int		aqo_max_fss = 0;
+int		aqo_max_fss_per_fspace = 0;
+int		aqo_max_kb_size = 0;
+int		aqo_eviction_policy = AQO_EVICTION_LRU;
+bool	aqo_eviction_enable = false;
+int		aqo_eviction_naptime = 60;
+
+typedef struct UsageKey
+{
+	Oid		dbid;
+	int		fhash;
+	int		fss_hash;
+} UsageKey;
+
+typedef struct UsageEntry
+{
+	UsageKey			key;
+	pg_atomic_uint64	lru;
+	pg_atomic_uint64	nhits;
+	pg_atomic_uint64	last_used;	/* TimestampTz */
+} UsageEntry;
+
+/* Usage counters of a database, removed from shared memory to be flushed. */
+typedef struct UsageCollector
+{
+	int			max;
+	int			n;
+	Datum	   *fhash;
+	Datum	   *fss_hash;
+	Datum	   *last_used;
+	Datum	   *nhits;
+
+	SubTransactionId subxid;	/* subtransaction, which flushed them */
+} UsageCollector;
+
+/* Collectors of the current transaction, allocated in its memory context */
+static List *flushed_usage = NIL;
+static bool usage_callbacks = false;
+
+PG_FUNCTION_INFO_V1(aqo_evict);
+
+
+/*
+ * Account usage of the feature subspace. A hit means that it was used for a
+ * prediction, otherwise it was just learned.
+ */
+void
+fss_usage_touch(int fhash, int fss_hash, bool hit)
+{
+	UsageKey	key;
+	UsageEntry *entry;
+	bool		found;
+
+	if (aqo_fss_usage_size <= 0)
+		return;
+
+	memset(&key, 0, sizeof(UsageKey));
+	key.dbid = MyDatabaseId;
+	key.fhash = fhash;
+	key.fss_hash = fss_hash;
+
+	entry = (UsageEntry *) aqo_shared_find(AQO_USAGE_TABLE, &key, false);
+	if (entry == NULL)
+	{
+		entry = (UsageEntry *) aqo_shared_insert(AQO_USAGE_TABLE, &key, &found);
+		if (entry == NULL)
+			return;
+
+		if (!found)
+		{
+			pg_atomic_init_u64(&entry->nhits, 0);
+			pg_atomic_init_u64(&entry->last_used, 0);
+		}
+	}
+
+	if (hit)
+		pg_atomic_fetch_add_u64(&entry->nhits, 1);
+	pg_atomic_write_u64(&entry->last_used,
+						(uint64) GetCurrentStatementStartTimestamp());
+	aqo_shared_release(AQO_USAGE_TABLE, entry);
+}
+
+static bool
+collect_usage(void *entry, void *arg)
+{
+	UsageEntry	   *usage = (UsageEntry *) entry;
+	UsageCollector *collector = (UsageCollector *) arg;
+	int				i = collector->n;
+
+	if (usage->key.dbid != MyDatabaseId || i >= collector->max)
+		return false;
+
+	collector->fhash[i] = Int32GetDatum(usage->key.fhash);
+	collector->fss_hash[i] = Int32GetDatum(usage->key.fss_hash);
+	collector->last_used[i] = TimestampTzGetDatum(
+							(TimestampTz) pg_atomic_read_u64(&usage->last_used));
+	collector->nhits[i] = Int64GetDatum(
+							(int64) pg_atomic_read_u64(&usage->nhits));
+	collector->n++;
+	return true;
+}
+
+/*
+ * Put the counters of the aborted flush back into shared memory. Counters of
+ * the same subspaces could be added since the flush, so they are merged.
+ */
+static void
+restore_usage(UsageCollector *collector)
+{
+	UsageKey	key;
+	UsageEntry *entry;
+	bool		found;
+	uint64		last_used;
+	int			i;
+
+	for (i = 0; i < collector->n; i++)
+	{
+		memset(&key, 0, sizeof(UsageKey));
+		key.dbid = MyDatabaseId;
+		key.fhash = DatumGetInt32(collector->fhash[i]);
+		key.fss_hash = DatumGetInt32(collector->fss_hash[i]);
+
+		entry = (UsageEntry *) aqo_shared_insert(AQO_USAGE_TABLE, &key, &found);
+		if (entry == NULL)
+			return;
+
+		if (!found)
+		{
+			pg_atomic_init_u64(&entry->nhits, 0);
+			pg_atomic_init_u64(&entry->last_used, 0);
+		}
+
+		pg_atomic_fetch_add_u64(&entry->nhits,
+								(uint64) DatumGetInt64(collector->nhits[i]));
+		last_used = (uint64) DatumGetTimestampTz(collector->last_used[i]);
+		if (pg_atomic_read_u64(&entry->last_used) < last_used)
+			pg_atomic_write_u64(&entry->last_used, last_used);
+		aqo_shared_release(AQO_USAGE_TABLE, entry);
+	}
+}
+
+static void
+usage_xact_callback(XactEvent event, void *arg)
+{
+	ListCell *lc;
+
+	if (flushed_usage == NIL)
+		return;
+
+	switch (event)
+	{
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			foreach(lc, flushed_usage)
+				restore_usage((UsageCollector *) lfirst(lc));
+			/* FALLTHROUGH */
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PREPARE:
+			/* The memory of the transaction is released. */
+			flushed_usage = NIL;
+			break;
+		default:
+			break;
+	}
+}
+
+static void
+usage_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+					   SubTransactionId parentSubid, void *arg)
+{
+	ListCell *lc;
+
+	foreach(lc, flushed_usage)
+	{
+		UsageCollector *collector = (UsageCollector *) lfirst(lc);
+
+		if (collector->subxid != mySubid)
+			continue;
+
+		if (event == SUBXACT_EVENT_COMMIT_SUB)
+			collector->subxid = parentSubid;
+		else if (event == SUBXACT_EVENT_ABORT_SUB)
+		{
+			restore_usage(collector);
+			flushed_usage = foreach_delete_current(flushed_usage, lc);
+		}
+	}
+}
+
+/*
+ * Remove usage counters of the database from shared memory. InvalidOid means
+ * all databases. Returns number of removed entries.
+ */
+long
+fss_usage_reset(Oid dbid)
+{
+	return aqo_shared_remove_database(AQO_USAGE_TABLE, dbid);
+}
+
+/*
+ * Move usage counters of the current database from shared memory into the
+ * aqo_fss_usage table. Counters of subspaces, which aren't in the knowledge
+ * base anymore, are dropped. Caller must be connected to SPI.
+ * Returns number of flushed counters.
+ */
+int64
+fss_usage_flush(void)
+{
+	UsageCollector *collector;
+	MemoryContext	oldcxt;
+	Oid				argtypes[4] = { INT4ARRAYOID, INT4ARRAYOID,
+									TIMESTAMPTZARRAYOID, INT8ARRAYOID };
+	Datum			args[4];
+	int				ret;
+	int				max = aqo_shared_nentries(AQO_USAGE_TABLE);
+
+	if (max == 0)
+		return 0;
+
+	if (!usage_callbacks)
+	{
+		RegisterXactCallback(usage_xact_callback, NULL);
+		RegisterSubXactCallback(usage_subxact_callback, NULL);
+		usage_callbacks = true;
+	}
+
+	/* The counters must live until the end of the transaction. */
+	oldcxt = MemoryContextSwitchTo(TopTransactionContext);
+	collector = palloc(sizeof(UsageCollector));
+	collector->max = max;
+	collector->n = 0;
+	collector->fhash = palloc(sizeof(Datum) * max);
+	collector->fss_hash = palloc(sizeof(Datum) * max);
+	collector->last_used = palloc(sizeof(Datum) * max);
+	collector->nhits = palloc(sizeof(Datum) * max);
+	collector->subxid = GetCurrentSubTransactionId();
+
+	(void) aqo_shared_remove(AQO_USAGE_TABLE, collect_usage, collector);
+	if (collector->n > 0)
+		flushed_usage = lappend(flushed_usage, collector);
+	MemoryContextSwitchTo(oldcxt);
+
+	if (collector->n == 0)
+		return 0;
+
+	args[0] = PointerGetDatum(construct_array(collector->fhash, collector->n,
+											  INT4OID, sizeof(int32), true,
+											  TYPALIGN_INT));
+	args[1] = PointerGetDatum(construct_array(collector->fss_hash, collector->n,
+											  INT4OID, sizeof(int32), true,
+											  TYPALIGN_INT));
+	args[2] = PointerGetDatum(construct_array(collector->last_used, collector->n,
+											  TIMESTAMPTZOID,
+											  sizeof(TimestampTz),
+											  FLOAT8PASSBYVAL, TYPALIGN_DOUBLE));
+	args[3] = PointerGetDatum(construct_array(collector->nhits, collector->n,
+											  INT8OID, sizeof(int64),
+											  FLOAT8PASSBYVAL, TYPALIGN_DOUBLE));
+
+	ret = SPI_execute_with_args("INSERT INTO public.aqo_fss_usage AS u "
+								"(fspace_hash, fsspace_hash, last_used, nhits) "
+								"SELECT * FROM unnest($1, $2, $3, $4) AS n(f, s, t, h) "
+								"WHERE EXISTS (SELECT 1 FROM public.aqo_data d "
+								"WHERE d.fspace_hash = n.f AND d.fsspace_hash = n.s) "
+								"ON CONFLICT (fspace_hash, fsspace_hash) "
+								"DO UPDATE SET "
+								"last_used = greatest(u.last_used, excluded.last_used), "
+								"nhits = u.nhits + excluded.nhits",
+								4, argtypes, args, NULL, false, 0);
+	if (ret != SPI_OK_INSERT)
+		elog(ERROR, "AQO eviction: SPI_execute failed: error code %d", ret);
+
+	return collector->n;
+}
+
+/*
+ * Remove subspaces, which rank exceeds the limit. The rank is computed by the
+ * window function over subspaces of the database or of each feature space,
+ * ordered from the most valuable one.
+ */
+static int64
+evict_by_rank(const char *rank, bool per_fspace, int64 limit)
+{
+	const char *order;
+	char	   *query;
+	Oid			argtypes[1] = { INT8OID };
+	Datum		args[1];
+	int			ret;
+
+	if (aqo_eviction_policy == AQO_EVICTION_LFU)
+		order = "u.nhits DESC NULLS LAST, u.last_used DESC NULLS LAST";
+	else
+		order = "u.last_used DESC NULLS LAST";
+
+	query = psprintf("DELETE FROM public.aqo_data d USING "
+					 "(SELECT fspace_hash, fsspace_hash FROM "
+					 "(SELECT k.fspace_hash, k.fsspace_hash, %s "
+					 "OVER (%s ORDER BY %s ROWS UNBOUNDED PRECEDING) AS pos "
+					 "FROM public.aqo_data k LEFT JOIN public.aqo_fss_usage u "
+					 "USING (fspace_hash, fsspace_hash)) r "
+					 "WHERE r.pos > $1) e "
+					 "WHERE d.fspace_hash = e.fspace_hash AND "
+					 "d.fsspace_hash = e.fsspace_hash",
+					 rank,
+					 per_fspace ? "PARTITION BY k.fspace_hash" : "",
+					 order);
+
+	args[0] = Int64GetDatum(limit);
+	ret = SPI_execute_with_args(query, 1, argtypes, args, NULL, false, 0);
+	if (ret != SPI_OK_DELETE)
+		elog(ERROR, "AQO eviction: SPI_execute failed: error code %d", ret);
+
+	pfree(query);
+	return (int64) SPI_processed;
+}
+
+/*
+ * Enforce limits of the knowledge base of the current database. Caller must be
+ * connected to SPI.
+ * Returns number of evicted feature subspaces.
+ */
+int64
+evict_fss(void)
+{
+	int64	evicted = 0;
+	int		ret;
+
+	(void) fss_usage_flush();
+
+	if (aqo_max_fss_per_fspace > 0)
+		evicted += evict_by_rank("row_number()", true,
+								 aqo_max_fss_per_fspace);
+	if (aqo_max_fss > 0)
+		evicted += evict_by_rank("row_number()", false, aqo_max_fss);
+	if (aqo_max_kb_size > 0)
+		evicted += evict_by_rank("sum(pg_column_size(k.*))", false,
+								 (int64) aqo_max_kb_size * 1024);
+
+	/* Forget usage of removed subspaces. */
+	ret = SPI_execute("DELETE FROM public.aqo_fss_usage u WHERE NOT EXISTS "
+					  "(SELECT 1 FROM public.aqo_data d "
+					  "WHERE d.fspace_hash = u.fspace_hash AND "
+					  "d.fsspace_hash = u.fsspace_hash)", false, 0);
+	if (ret != SPI_OK_DELETE)
+		elog(ERROR, "AQO eviction: SPI_execute failed: error code %d", ret);
+
+	return evicted;
+}
+
+/*
+ * Register the eviction worker, if needed. Must be called from the _PG_init()
+ * routine.
+ */
+void
+eviction_init(void)
+{
+	BackgroundWorker worker;
+
+	aqo_shared_register_table(AQO_USAGE_TABLE, "aqo_fss_usage",
+							  sizeof(UsageKey), sizeof(UsageEntry),
+							  offsetof(UsageEntry, lru),
+							  &aqo_fss_usage_size);
+
+	if (!aqo_eviction_enable)
+		return;
+
+	memset(&worker, 0, sizeof(BackgroundWorker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+					   BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = aqo_eviction_naptime;
+	strcpy(worker.bgw_library_name, "aqo");
+	strcpy(worker.bgw_function_name, "aqo_eviction_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "aqo eviction");
+	snprintf(worker.bgw_type, BGW_MAXLEN, "aqo eviction");
+	RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * Entry point of the eviction worker. It connects to the aqo.bgworker_database
+ * and enforces limits of its knowledge base each aqo.eviction_naptime seconds.
+ */
+void
+aqo_eviction_main(Datum main_arg)
+{
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	BackgroundWorkerInitializeConnection(aqo_bgworker_database, NULL, 0);
+
+	for (;;)
+	{
+		int64	evicted = 0;
+
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 aqo_eviction_naptime * 1000L,
+						 PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+
+		if (ConfigReloadPending)
+		{
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+
+		if (OidIsValid(get_extension_oid("aqo", true)))
+		{
+			SPI_connect();
+			PushActiveSnapshot(GetTransactionSnapshot());
+			pgstat_report_activity(STATE_RUNNING, "evicting feature subspaces");
+
+			evicted = evict_fss();
+
+			SPI_finish();
+			PopActiveSnapshot();
+		}
+
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+		if (evicted > 0)
+			elog(LOG, "AQO eviction: " INT64_FORMAT " feature subspaces evicted",
+				 evicted);
+	}
+}
+
+/*
+ * Flush usage counters and enforce limits of the knowledge base of the current
+ * database. Returns number of evicted feature subspaces.
+ */
+Datum
+aqo_evict(PG_FUNCTION_ARGS)
+{
+	int64	evicted;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("only superuser can evict data of the AQO knowledge base")));
+
+	SPI_connect();
+	evicted = evict_fss();
+	SPI_finish();
+
+	PG_RETURN_INT64(evicted);
+}
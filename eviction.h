@@ -0,0 +1,28 @@
+#ifndef EVICTION_H
+#define EVICTION_H
+
+#include "postgres.h"
+
+typedef enum
+{
+	AQO_EVICTION_LRU = 0,	/* Least recently used subspaces are evicted */
+	AQO_EVICTION_LFU		/* Least frequently used subspaces are evicted */
+} AQOEvictionPolicy;
+
+extern PGDLLIMPORT int aqo_fss_usage_size;
+extern PGDLLIMPORT int aqo_max_fss;
+extern PGDLLIMPORT int aqo_max_fss_per_fspace;
+extern PGDLLIMPORT int aqo_max_kb_size;
+extern PGDLLIMPORT int aqo_eviction_policy;
+extern PGDLLIMPORT bool aqo_eviction_enable;
+extern PGDLLIMPORT int aqo_eviction_naptime;
+
+extern void fss_usage_touch(int fhash, int fss_hash, bool hit);
+extern long fss_usage_reset(Oid dbid);
+extern int64 fss_usage_flush(void);
+extern int64 evict_fss(void);
+
+extern void eviction_init(void);
+extern PGDLLEXPORT void aqo_eviction_main(Datum main_arg);
+
+#endif /* EVICTION_H */
@@ -0,0 +1,171 @@
+/*
+ *******************************************************************************
+ *
+ *	FAST PATH FOR CHEAP QUERY CLASSES
+ *
+ * The AQO machinery isn't free: the query hash is computed from the whole
+ * query tree, settings of the class are looked up, each plan node gets a
+ * feature subspace, and the learning walks through the executed plan. For
+ * short OLTP statements this overhead may be comparable with the execution
+ * time, and the predictions can't win anything.
+ *
+ * This module measures the overhead of AQO per query class: the time spent on
+ * preprocessing and predictions during planning, and on learning after
+ * execution. If the mean overhead exceeds aqo.fast_path_overhead part of the
+ * mean execution time, the class is placed into a shared negative cache for
+ * aqo.fast_path_ttl seconds. Planning of a class from the cache skips the AQO
+ * machinery at all, including the query hash computation. When the entry
+ * expires, the class is measured again.
+ *
+ * The cache is keyed by the core query identifier, so the check costs one
+ * lookup in the shared table (see aqo_shared.c). The identifier is computed
+ * only if compute_query_id is on (or a module, like pg_stat_statements, asks
+ * for it). Statements without the identifier are never gated.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/fast_path.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "utils/timestamp.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "fast_path.h"
+
+
+/* Minimal number of measured executions before the decision. */
+#define FAST_PATH_MIN_SAMPLES	(3)
+
+double	aqo_fast_path_overhead = 0.;
+int		aqo_fast_path_ttl = 300;
+int		aqo_fast_path_size = 10000;
+
+typedef struct FastPathKey
+{
+	Oid		dbid;
+	uint64	query_id;
+} FastPathKey;
+
+typedef struct FastPathEntry
+{
+	FastPathKey			key;
+
+	pg_atomic_uint64	lru;
+	int					nsamples;
+	double				overhead;	/* mean overhead of AQO, seconds */
+	double				exec_time;	/* mean execution time, seconds */
+	TimestampTz			until;		/* the class is gated till this moment */
+} FastPathEntry;
+
+
+static inline void
+init_fast_path_key(FastPathKey *key, uint64 query_id)
+{
+	memset(key, 0, sizeof(FastPathKey));
+	key->dbid = MyDatabaseId;
+	key->query_id = query_id;
+}
+
+/*
+ * Check, whether the query class should be planned without AQO.
+ */
+bool
+fast_path_check(uint64 query_id)
+{
+	FastPathKey		key;
+	FastPathEntry  *entry;
+	bool			gated;
+
+	if (aqo_fast_path_overhead <= 0. || query_id == UINT64CONST(0))
+		return false;
+
+	init_fast_path_key(&key, query_id);
+	entry = (FastPathEntry *) aqo_shared_find(AQO_FASTPATH_TABLE, &key, false);
+	if (entry == NULL)
+		return false;
+
+	gated = (entry->until != 0 &&
+			 entry->until > GetCurrentStatementStartTimestamp());
+	aqo_shared_release(AQO_FASTPATH_TABLE, entry);
+
+	if (gated)
+		elog(DEBUG1, "AQO: fast path for query " UINT64_FORMAT, query_id);
+	return gated;
+}
+
+/*
+ * Account the measured overhead of AQO and the execution time of the query.
+ * Puts the class into the negative cache, if AQO is too expensive for it.
+ */
+void
+fast_path_account(uint64 query_id, double overhead, double exec_time)
+{
+	FastPathKey		key;
+	FastPathEntry  *entry;
+	TimestampTz		now;
+	bool			found;
+
+	if (aqo_fast_path_overhead <= 0. || query_id == UINT64CONST(0))
+		return;
+
+	init_fast_path_key(&key, query_id);
+	entry = (FastPathEntry *) aqo_shared_insert(AQO_FASTPATH_TABLE,
+												&key, &found);
+	if (entry == NULL)
+		/* The shared table is disabled. */
+		return;
+
+	now = GetCurrentStatementStartTimestamp();
+	if (!found || (entry->until != 0 && entry->until <= now))
+	{
+		/* Start measurements from scratch. */
+		entry->nsamples = 0;
+		entry->overhead = 0.;
+		entry->exec_time = 0.;
+		entry->until = 0;
+	}
+
+	/* Running means over the last aqo_stat_size executions. */
+	entry->nsamples = Min(entry->nsamples + 1, Max(aqo_stat_size, 1));
+	entry->overhead += (overhead - entry->overhead) / entry->nsamples;
+	entry->exec_time += (exec_time - entry->exec_time) / entry->nsamples;
+
+	if (entry->nsamples >= FAST_PATH_MIN_SAMPLES &&
+		entry->overhead > aqo_fast_path_overhead * entry->exec_time)
+	{
+		entry->until = TimestampTzPlusMilliseconds(now,
+												   aqo_fast_path_ttl * 1000L);
+		elog(DEBUG1, "AQO: query " UINT64_FORMAT " goes to the fast path, overhead %f, execution time %f",
+			 query_id, entry->overhead, entry->exec_time);
+	}
+
+	aqo_shared_release(AQO_FASTPATH_TABLE, entry);
+}
+
+/*
+ * Remove the negative cache of the database. InvalidOid means all databases.
+ * Returns number of removed entries.
+ */
+long
+fast_path_reset(Oid dbid)
+{
+	return aqo_shared_remove_database(AQO_FASTPATH_TABLE, dbid);
+}
+
+void
+fast_path_init(void)
+{
+	aqo_shared_register_table(AQO_FASTPATH_TABLE, "aqo_fast_path",
+							  sizeof(FastPathKey), sizeof(FastPathEntry),
+							  offsetof(FastPathEntry, lru),
+							  &aqo_fast_path_size);
+}
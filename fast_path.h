@@ -0,0 +1,17 @@
+#ifndef FAST_PATH_H
+#define FAST_PATH_H
+
+#include "postgres.h"
+
+extern PGDLLIMPORT double aqo_fast_path_overhead;
+extern PGDLLIMPORT int aqo_fast_path_ttl;
+extern PGDLLIMPORT int aqo_fast_path_size;
+
+extern bool fast_path_check(uint64 query_id);
+extern void fast_path_account(uint64 query_id, double overhead,
+							  double exec_time);
+extern long fast_path_reset(Oid dbid);
+
+extern void fast_path_init(void);
+
+#endif /* FAST_PATH_H */
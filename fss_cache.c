@@ -0,0 +1,211 @@
+/*
+ *******************************************************************************
+ *
+ *	SHARED CACHE OF FEATURE SUBSPACES
+ *
+ * Each prediction loads a feature subspace (fss) from the aqo_data table. It
+ * costs an index scan and a heap fetch per plan node, which is paid by every
+ * planning of a query. This module keeps recently used feature subspaces in
+ * a shared table (see aqo_shared.c), so a prediction can be made without any
+ * access to the AQO relations.
+ *
+ * The cache is write-through: update_fss() stores a new state of the subspace
+ * in the cache too. So, the cache can contain learning results of a
+ * transaction that hasn't committed yet or is aborted. It is acceptable
+ * because AQO already reads the knowledge base with a dirty snapshot.
+ * Manual changes of the aqo_data table are tracked by a trigger which resets
+ * all cached subspaces of the database.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/fss_cache.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "commands/trigger.h"
+#include "miscadmin.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "fss_cache.h"
+
+
+int		aqo_fss_cache_size;
+
+typedef struct FssCacheKey
+{
+	Oid		dbid;
+	int		fhash;
+	int		fss_hash;
+} FssCacheKey;
+
+typedef struct FssCacheEntry
+{
+	FssCacheKey	key;
+
+	pg_atomic_uint64 lru;
+	int			nrows;
+	int			ncols;
+	double		targets[aqo_K];
+	double		matrix[aqo_K][AQO_FSS_CACHE_MAX_FEATURES];
+} FssCacheEntry;
+
+PG_FUNCTION_INFO_V1(aqo_invalidate_fss_cache);
+
+
+static inline void
+init_cache_key(FssCacheKey *key, int fhash, int fss_hash)
+{
+	memset(key, 0, sizeof(FssCacheKey));
+	key->dbid = MyDatabaseId;
+	key->fhash = fhash;
+	key->fss_hash = fss_hash;
+}
+
+/*
+ * Search the feature subspace in the cache.
+ * Interface is the same as in the load_fss() routine: if matrix, targets and
+ * rows are NULL, it just checks an existence of the subspace.
+ * Returns false if the subspace isn't cached, true otherwise.
+ */
+bool
+fss_cache_lookup(int fhash, int fss_hash, int ncols,
+				 double **matrix, double *targets, int *rows)
+{
+	FssCacheKey		key;
+	FssCacheEntry  *entry;
+	int				i;
+
+	if (aqo_fss_cache_size <= 0 || ncols > AQO_FSS_CACHE_MAX_FEATURES)
+		return false;
+
+	init_cache_key(&key, fhash, fss_hash);
+
+	entry = (FssCacheEntry *) aqo_shared_find(AQO_FSS_TABLE, &key, false);
+	if (entry == NULL)
+		return false;
+
+	if (entry->ncols != ncols &&
+		(matrix != NULL || targets != NULL || rows != NULL))
+	{
+		/*
+		 * The caller expects another number of features. Let the storage
+		 * routine to report the problem.
+		 */
+		aqo_shared_release(AQO_FSS_TABLE, entry);
+		return false;
+	}
+
+	if (matrix != NULL && ncols > 0)
+		for (i = 0; i < entry->nrows; ++i)
+			memcpy(matrix[i], entry->matrix[i], sizeof(double) * ncols);
+
+	if (targets != NULL)
+		memcpy(targets, entry->targets, sizeof(double) * entry->nrows);
+
+	if (rows != NULL)
+		*rows = entry->nrows;
+
+	aqo_shared_release(AQO_FSS_TABLE, entry);
+	return true;
+}
+
+/*
+ * Store the feature subspace into the cache. Replace a previous state of the
+ * subspace, if it exists. If the cache is full, the least recently used
+ * subspaces are evicted.
+ * Returns false if the subspace can't be stored.
+ */
+bool
+fss_cache_store(int fhash, int fss_hash, int nrows, int ncols,
+				double **matrix, double *targets)
+{
+	FssCacheKey		key;
+	FssCacheEntry  *entry;
+	bool			found;
+	int				i;
+
+	Assert(nrows == 0 || targets != NULL);
+	Assert(ncols == 0 || matrix != NULL);
+
+	init_cache_key(&key, fhash, fss_hash);
+
+	if (aqo_fss_cache_size <= 0 || ncols > AQO_FSS_CACHE_MAX_FEATURES ||
+		nrows > aqo_K)
+	{
+		/*
+		 * The cache could be disabled at runtime. Don't leave an outdated
+		 * state of the subspace in it.
+		 */
+		(void) aqo_shared_delete(AQO_FSS_TABLE, &key);
+		return false;
+	}
+
+	entry = (FssCacheEntry *) aqo_shared_insert(AQO_FSS_TABLE, &key, &found);
+	if (entry == NULL)
+		return false;
+
+	entry->nrows = nrows;
+	entry->ncols = ncols;
+
+	for (i = 0; i < nrows; ++i)
+	{
+		if (ncols > 0)
+			memcpy(entry->matrix[i], matrix[i], sizeof(double) * ncols);
+		entry->targets[i] = targets[i];
+	}
+
+	aqo_shared_release(AQO_FSS_TABLE, entry);
+	return true;
+}
+
+/*
+ * Check whether any free slot exists in the cache.
+ */
+bool
+fss_cache_is_full(void)
+{
+	if (aqo_fss_cache_size <= 0)
+		return true;
+
+	return (aqo_shared_nentries(AQO_FSS_TABLE) >= (uint32) aqo_fss_cache_size);
+}
+
+/*
+ * Remove all cached subspaces, related to the database. InvalidOid means all
+ * databases.
+ * Return a number of removed entries. Just for info.
+ */
+long
+fss_cache_reset(Oid dbid)
+{
+	return aqo_shared_remove_database(AQO_FSS_TABLE, dbid);
+}
+
+/*
+ * Trigger on the aqo_data table. Someone changed the knowledge base manually,
+ * so we can't trust cached subspaces of this database anymore.
+ */
+Datum
+aqo_invalidate_fss_cache(PG_FUNCTION_ARGS)
+{
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "aqo_invalidate_fss_cache: must be called as trigger");
+
+	(void) fss_cache_reset(MyDatabaseId);
+	PG_RETURN_POINTER(NULL);
+}
+
+void
+fss_cache_init(void)
+{
+	aqo_shared_register_table(AQO_FSS_TABLE, "aqo_fss_cache",
+							  sizeof(FssCacheKey), sizeof(FssCacheEntry),
+							  offsetof(FssCacheEntry, lru),
+							  &aqo_fss_cache_size);
+}
@@ -0,0 +1,23 @@
+#ifndef FSS_CACHE_H
+#define FSS_CACHE_H
+
+#include "utils/guc.h"
+
+/*
+ * Max number of features of a feature subspace which can be stored in the
+ * shared cache. Bigger subspaces are always loaded from the aqo_data table.
+ */
+#define AQO_FSS_CACHE_MAX_FEATURES	(16)
+
+extern PGDLLIMPORT int aqo_fss_cache_size;
+
+extern bool fss_cache_lookup(int fhash, int fss_hash, int ncols,
+							 double **matrix, double *targets, int *rows);
+extern bool fss_cache_store(int fhash, int fss_hash, int nrows, int ncols,
+							double **matrix, double *targets);
+extern bool fss_cache_is_full(void);
+extern long fss_cache_reset(Oid dbid);
+
+extern void fss_cache_init(void);
+
+#endif /* FSS_CACHE_H */
@@ -10,6 +10,14 @@
  * only in the values of their constants. We want query_hash, clause_hash and
  * fss_hash to satisfy this property.
  *
+ * An IN-list or a multi-row VALUES of constants is treated as a constant too:
+ * lists of any length are mapped into the same hash value. The length of the
+ * list may be used as an additional feature of the feature subspace.
+ *
+ * In the hybrid model the standard estimation of the node cardinality is one
+ * more feature. Such a feature subspace gets another hash, so the hybrid
+ * models and the basic ones never mix.
+ *
  *******************************************************************************
  *
  * Copyright (c) 2016-2021, Postgres Professional
@@ -25,13 +33,28 @@
 
 #include "aqo.h"
 #include "hash.h"
+#include "model.h"
+
+/* Salt of the hash of a list length feature. */
+#define AQO_LIST_LENGTH_SALT	(0x4C454E)
+
+/*
+ * Hash of the standard estimation feature. It is the maximum value, so this
+ * feature is always the last one in the sorted array of features.
+ */
+#define AQO_DEFAULT_ESTIMATE_HASH	(INT_MAX)
+
+bool	aqo_normalize_lists = false;
+bool	aqo_list_length_feature = false;
+bool	aqo_hybrid_model = false;
 
+static Node *normalize_lists_mutator(Node *node, void *context);
+static bool get_list_length(Expr *clause, int *length);
 static int	get_str_hash(const char *str);
 static int	get_node_hash(Node *node);
 static int	get_unsorted_unsafe_int_array_hash(int *arr, int len);
 static int	get_unordered_int_list_hash(List *lst);
 
-static int	get_relidslist_hash(List *relidslist);
 static int get_fss_hash(int clauses_hash, int eclasses_hash,
 			 int relidslist_hash);
 
@@ -66,6 +89,9 @@ get_query_hash(Query *parse, const char *query_text)
 	char	   *str_repr;
 	int			hash;
 
+	if (aqo_normalize_lists)
+		parse = (Query *) normalize_lists_mutator((Node *) parse, NULL);
+
 	/* XXX: remove_locations and remove_consts are heavy routines. */
 	str_repr = remove_locations(remove_consts(nodeToString(parse)));
 	hash = DatumGetInt32(hash_any((const unsigned char *) str_repr,
@@ -75,6 +101,86 @@ get_query_hash(Query *parse, const char *query_text)
 	return hash;
 }
 
+/*
+ * Is each element of the list a constant or a parameter, maybe coerced? ORMs
+ * send IN-lists as lists of parameters.
+ */
+static bool
+is_const_list(List *lst)
+{
+	ListCell *lc;
+
+	foreach(lc, lst)
+	{
+		Node *node = (Node *) lfirst(lc);
+
+		if (IsA(node, RelabelType))
+			node = (Node *) ((RelabelType *) node)->arg;
+		else if (IsA(node, CoerceViaIO))
+			node = (Node *) ((CoerceViaIO *) node)->arg;
+
+		if (!IsA(node, Const) && !IsA(node, Param))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Make a copy of the query tree, where each array of constants and each VALUES
+ * list of constant rows is reduced to its first element. So, the query hash
+ * doesn't depend on lengths of IN-lists and VALUES lists.
+ */
+static Node *
+normalize_lists_mutator(Node *node, void *context)
+{
+	if (node == NULL)
+		return NULL;
+
+	if (IsA(node, Query))
+	{
+		Query	   *query;
+		ListCell   *lc;
+
+		query = query_tree_mutator((Query *) node, normalize_lists_mutator,
+								   context, 0);
+
+		/* The range table is already copied by the mutator. */
+		foreach(lc, query->rtable)
+		{
+			RangeTblEntry  *rte = lfirst_node(RangeTblEntry, lc);
+			ListCell	   *lc1;
+
+			if (rte->rtekind != RTE_VALUES ||
+				list_length(rte->values_lists) < 2)
+				continue;
+
+			foreach(lc1, rte->values_lists)
+				if (!is_const_list((List *) lfirst(lc1)))
+					break;
+
+			if (lc1 == NULL)
+				rte->values_lists = list_make1(linitial(rte->values_lists));
+		}
+		return (Node *) query;
+	}
+
+	if (IsA(node, ArrayExpr))
+	{
+		ArrayExpr *array = (ArrayExpr *) node;
+
+		if (list_length(array->elements) > 1 && is_const_list(array->elements))
+		{
+			ArrayExpr *newarray = makeNode(ArrayExpr);
+
+			memcpy(newarray, array, sizeof(ArrayExpr));
+			newarray->elements = list_make1(copyObject(linitial(array->elements)));
+			return (Node *) newarray;
+		}
+	}
+
+	return expression_tree_mutator(node, normalize_lists_mutator, context);
+}
+
 int
 get_grouped_exprs_hash(int child_fss, List *group_exprs)
 {
@@ -107,12 +213,36 @@ get_grouped_exprs_hash(int child_fss, List *group_exprs)
  *		transforms selectivities to features
  *
  * Special case for nfeatures == NULL: don't calculate features.
+ *
+ * See get_fss_signature() to get hashes of the features too.
+ *
+ * If aqo.list_length_feature is on, each IN-list clause adds one more feature:
+ * logarithm of the list length. It is treated as a separate clause with its
+ * own hash.
+ *
+ * Selectivities are bounded from below by the log_selectivity_lower_bound
+ * parameter of the feature space of the current query.
  */
 int
 get_fss_for_object(List *relidslist, List *clauselist,
 				   List *selectivities, int *nfeatures, double **features)
+{
+	return get_fss_signature(relidslist, clauselist, selectivities,
+							 nfeatures, features, NULL);
+}
+
+/*
+ * The same as get_fss_for_object(), but also returns a sorted array of hashes
+ * of the features, if 'feature_hashes' isn't NULL. Number of the hashes is
+ * equal to the number of features.
+ */
+int
+get_fss_signature(List *relidslist, List *clauselist, List *selectivities,
+				  int *nfeatures, double **features, int **feature_hashes)
 {
 	int			n;
+	int			nclauses;
+	int		   *list_lengths;
 	int		   *clause_hashes;
 	int		   *sorted_clauses;
 	int		   *idx;
@@ -133,18 +263,22 @@ get_fss_for_object(List *relidslist, List *clauselist,
 	int			sh = 0,
 				old_sh;
 	int fss_hash;
+	double		lower_bound = log_selectivity_lower_bound;
 
-	n = list_length(clauselist);
+	nclauses = list_length(clauselist);
 
 	/* Check parameters state invariant. */
-	Assert(n == list_length(selectivities) ||
+	Assert(nclauses == list_length(selectivities) ||
 		   (nfeatures == NULL && features == NULL));
 
 	get_eclasses(clauselist, &nargs, &args_hash, &eclass_hash);
 
+	/* Reserve space for features of list lengths. */
+	n = (aqo_list_length_feature) ? 2 * nclauses : nclauses;
 	clause_hashes = palloc(sizeof(*clause_hashes) * n);
 	clause_has_consts = palloc(sizeof(*clause_has_consts) * n);
 	sorted_clauses = palloc(sizeof(*sorted_clauses) * n);
+	list_lengths = palloc(sizeof(*list_lengths) * n);
 
 	if (nfeatures != NULL)
 		*features = palloc0(sizeof(**features) * n);
@@ -161,16 +295,40 @@ get_fss_for_object(List *relidslist, List *clauselist,
 		i++;
 	}
 
-	idx = argsort(clause_hashes, n, sizeof(*clause_hashes), int_cmp);
-	inverse_idx = inverse_permutation(idx, n);
-
+	/* Add pseudo clauses for lengths of lists */
+	n = nclauses;
 	i = 0;
 	foreach(lc, clauselist)
 	{
-		sorted_clauses[inverse_idx[i]] = clause_hashes[i];
+		RestrictInfo   *rinfo = lfirst_node(RestrictInfo, lc);
+		int				hashes[2];
+
+		if (aqo_list_length_feature &&
+			get_list_length(rinfo->clause, &list_lengths[n]))
+		{
+			hashes[0] = clause_hashes[i];
+			hashes[1] = AQO_LIST_LENGTH_SALT;
+			clause_hashes[n] = get_int_array_hash(hashes, 2);
+			clause_has_consts[n] = true;
+			n++;
+		}
 		i++;
 	}
 
+	idx = argsort(clause_hashes, n, sizeof(*clause_hashes), int_cmp);
+	inverse_idx = inverse_permutation(idx, n);
+
+	for (i = 0; i < n; i++)
+		sorted_clauses[inverse_idx[i]] = clause_hashes[i];
+
+	if (nfeatures != NULL && selectivities != NIL)
+	{
+		AQOModelParams params;
+
+		aqo_fspace_params(query_context.fspace_hash, &params);
+		lower_bound = params.log_selectivity_lower_bound;
+	}
+
 	i = 0;
 	foreach(lc, selectivities)
 	{
@@ -179,12 +337,16 @@ get_fss_for_object(List *relidslist, List *clauselist,
 		if (nfeatures != NULL)
 		{
 			(*features)[inverse_idx[i]] = log(*s);
-			if ((*features)[inverse_idx[i]] < log_selectivity_lower_bound)
-				(*features)[inverse_idx[i]] = log_selectivity_lower_bound;
+			if ((*features)[inverse_idx[i]] < lower_bound)
+				(*features)[inverse_idx[i]] = lower_bound;
 		}
 		i++;
 	}
 
+	if (nfeatures != NULL)
+		for (i = nclauses; i < n; i++)
+			(*features)[inverse_idx[i]] = log((double) list_lengths[i]);
+
 	for (i = 0; i < n;)
 	{
 		k = 0;
@@ -218,11 +380,19 @@ get_fss_for_object(List *relidslist, List *clauselist,
 	relidslist_hash = get_relidslist_hash(relidslist);
 	fss_hash = get_fss_hash(clauses_hash, eclasses_hash, relidslist_hash);
 
+	if (feature_hashes != NULL)
+	{
+		*feature_hashes = palloc(sizeof(**feature_hashes) * Max(n - sh, 1));
+		memcpy(*feature_hashes, sorted_clauses,
+			   sizeof(**feature_hashes) * (n - sh));
+	}
+
 	pfree(clause_hashes);
 	pfree(sorted_clauses);
 	pfree(idx);
 	pfree(inverse_idx);
 	pfree(clause_has_consts);
+	pfree(list_lengths);
 	pfree(args_hash);
 	pfree(eclass_hash);
 
@@ -234,19 +404,57 @@ get_fss_for_object(List *relidslist, List *clauselist,
 	return fss_hash;
 }
 
+/*
+ * Turns the feature subspace, made by get_fss_signature(), into the subspace of
+ * the hybrid model: adds the logarithm of the standard estimation as the last
+ * feature and returns the new fss hash. Feature hashes are optional.
+ */
+int
+add_default_estimate_feature(int fss_hash, double default_rows,
+							 int *nfeatures, double **features,
+							 int **feature_hashes)
+{
+	int		hashes[2];
+	int		n = *nfeatures;
+
+	*features = repalloc(*features, (n + 1) * sizeof(**features));
+	(*features)[n] = log(Max(default_rows, 1.));
+
+	if (feature_hashes != NULL && *feature_hashes != NULL)
+	{
+		*feature_hashes = repalloc(*feature_hashes,
+								   (n + 1) * sizeof(**feature_hashes));
+		(*feature_hashes)[n] = AQO_DEFAULT_ESTIMATE_HASH;
+	}
+	*nfeatures = n + 1;
+
+	hashes[0] = fss_hash;
+	hashes[1] = AQO_DEFAULT_ESTIMATE_HASH;
+	return get_int_array_hash(hashes, 2);
+}
+
 /*
  * Computes hash for given clause.
  * Hash is supposed to be constant-insensitive.
  * Also args-order-insensitiveness for equal clause is required.
+ *
+ * The planner folds an IN-list of constants into an array constant, but in a
+ * generic plan an IN-list of parameters stays an ArrayExpr. So, with
+ * aqo.normalize_lists on, such arrays are cut down to the first element here
+ * too, and the hash doesn't depend on the list length.
  */
 int
 get_clause_hash(Expr *clause, int nargs, int *args_hash, int *eclass_hash)
 {
 	Expr	   *cclause;
-	List	  **args = get_clause_args_ptr(clause);
+	List	  **args;
 	int			arg_eclass;
 	ListCell   *l;
 
+	if (aqo_normalize_lists && IsA(clause, ScalarArrayOpExpr))
+		clause = (Expr *) normalize_lists_mutator((Node *) clause, NULL);
+
+	args = get_clause_args_ptr(clause);
 	if (args == NULL)
 		return get_node_hash((Node *) clause);
 
@@ -267,6 +475,37 @@ get_clause_hash(Expr *clause, int nargs, int *args_hash, int *eclass_hash)
 	return get_node_hash((Node *) linitial(*args));
 }
 
+/*
+ * Check, that the clause compares an expression with a list of values, and get
+ * the length of the list. If the length is unknown before execution, one is
+ * returned.
+ */
+static bool
+get_list_length(Expr *clause, int *length)
+{
+	ScalarArrayOpExpr  *saop;
+	Node			   *array;
+
+	if (!IsA(clause, ScalarArrayOpExpr))
+		return false;
+
+	saop = (ScalarArrayOpExpr *) clause;
+	array = (Node *) lsecond(saop->args);
+	*length = 1;
+
+	if (IsA(array, Const) && !((Const *) array)->constisnull)
+	{
+		ArrayType *arr = DatumGetArrayTypeP(((Const *) array)->constvalue);
+
+		*length = ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr));
+	}
+	else if (IsA(array, ArrayExpr))
+		*length = list_length(((ArrayExpr *) array)->elements);
+
+	*length = Max(*length, 1);
+	return true;
+}
+
 /*
  * Computes hash for given string.
  */
@@ -3,10 +3,21 @@
 
 #include "nodes/pg_list.h"
 
+extern PGDLLIMPORT bool aqo_normalize_lists;
+extern PGDLLIMPORT bool aqo_list_length_feature;
+extern PGDLLIMPORT bool aqo_hybrid_model;
+
 extern int get_query_hash(Query *parse, const char *query_text);
 extern int get_fss_for_object(List *relidslist, List *clauselist,
 							  List *selectivities, int *nfeatures,
 							  double **features);
+extern int get_fss_signature(List *relidslist, List *clauselist,
+							 List *selectivities, int *nfeatures,
+							 double **features, int **feature_hashes);
+extern int add_default_estimate_feature(int fss_hash, double default_rows,
+										int *nfeatures, double **features,
+										int **feature_hashes);
+extern int get_relidslist_hash(List *relidslist);
 extern int get_int_array_hash(int *arr, int len);
 extern int get_grouped_exprs_hash(int fss, List *group_exprs);
 
@@ -10,6 +10,15 @@
  * setting after learning procedure. This property also allows to adapt to
  * workloads which properties are slowly changed.
  *
+ * A prediction is supplied with a confidence in (0, 1]. It decreases with the
+ * distance from the object to its nearest neighbors (an extrapolation) and with
+ * the spread of the neighbors targets (a noisy or a non-smooth subspace).
+ *
+ * Besides of the OkNNr method, the module implements an online linear
+ * regression, learned by the normalized least mean squares (NLMS) method. It
+ * stores only weights of the features, a bias and a mean squared error of
+ * the model, so its size and prediction cost are O(nfeatures).
+ *
  *******************************************************************************
  *
  * Copyright (c) 2016-2021, Postgres Professional
@@ -25,7 +34,14 @@
 
 static double fs_distance(double *a, double *b, int len);
 static double fs_similarity(double dist);
-static double compute_weights(double *distances, int nrows, double *w, int *idx);
+static double compute_weights(double *distances, int nrows, double *w, int *idx,
+							  int k);
+
+/* Step of the NLMS learning. */
+#define NLMS_STEP	(0.5)
+
+/* Number of matrix rows, used by the linear model. */
+#define NLMS_NROWS	(2)
 
 
 /*
@@ -56,12 +72,13 @@ fs_similarity(double dist)
 /*
  * Compute weights necessary for both prediction and learning.
  * Creates and returns w, w_sum and idx based on given distances ad matrix_rows.
+ * Only k nearest neighbors are used.
  *
  * Appeared as a separate function because of "don't repeat your code"
  * principle.
  */
 double
-compute_weights(double *distances, int nrows, double *w, int *idx)
+compute_weights(double *distances, int nrows, double *w, int *idx, int k)
 {
 	int		i,
 			j;
@@ -69,16 +86,16 @@ compute_weights(double *distances, int nrows, double *w, int *idx)
 			tmp;
 	double	w_sum = 0;
 
-	for (i = 0; i < aqo_k; ++i)
+	for (i = 0; i < k; ++i)
 		idx[i] = -1;
 
 	/* Choose from all neighbors only several nearest objects */
 	for (i = 0; i < nrows; ++i)
-		for (j = 0; j < aqo_k; ++j)
+		for (j = 0; j < k; ++j)
 			if (idx[j] == -1 || distances[i] < distances[idx[j]])
 			{
 				to_insert = i;
-				for (; j < aqo_k; ++j)
+				for (; j < k; ++j)
 				{
 					tmp = idx[j];
 					idx[j] = to_insert;
@@ -88,7 +105,7 @@ compute_weights(double *distances, int nrows, double *w, int *idx)
 			}
 
 	/* Compute weights by the nearest neighbors distances */
-	for (j = 0; j < aqo_k && idx[j] != -1; ++j)
+	for (j = 0; j < k && idx[j] != -1; ++j)
 	{
 		w[j] = fs_similarity(distances[idx[j]]);
 		w_sum += w[j];
@@ -101,10 +118,16 @@ compute_weights(double *distances, int nrows, double *w, int *idx)
  *
  * Returns negative value in the case of refusal to make a prediction, because
  * positive targets are assumed.
+ * If confidence isn't NULL, the confidence of the prediction is returned too.
+ * Features and targets are logarithms, so the weighted distance to the
+ * neighbors and the weighted standard deviation of their targets are
+ * measured in the same scale, and each of them halves the confidence at the
+ * value of one.
  */
 double
 OkNNr_predict(int nrows, int ncols, double **matrix, const double *targets,
-			  double *features)
+			  double *features, double *confidence,
+			  const AQOModelParams *params)
 {
 	double	distances[aqo_K];
 	int		i;
@@ -112,13 +135,15 @@ OkNNr_predict(int nrows, int ncols, double **matrix, const double *targets,
 	double	w[aqo_K];
 	double	w_sum;
 	double	result = 0;
+	double	distance = 0;
+	double	variance = 0;
 
 	for (i = 0; i < nrows; ++i)
 		distances[i] = fs_distance(matrix[i], features, ncols);
 
-	w_sum = compute_weights(distances, nrows, w, idx);
+	w_sum = compute_weights(distances, nrows, w, idx, params->k);
 
-	for (i = 0; i < aqo_k; ++i)
+	for (i = 0; i < params->k; ++i)
 		if (idx[i] != -1)
 			result += targets[idx[i]] * w[i] / w_sum;
 
@@ -129,6 +154,19 @@ OkNNr_predict(int nrows, int ncols, double **matrix, const double *targets,
 	if (idx[0] == -1)
 		result = -1;
 
+	if (confidence != NULL)
+	{
+		for (i = 0; i < params->k && idx[i] != -1; ++i)
+		{
+			distance += distances[idx[i]] * w[i] / w_sum;
+			variance += (targets[idx[i]] - result) *
+						(targets[idx[i]] - result) * w[i] / w_sum;
+		}
+
+		*confidence = (result < 0) ? 0. :
+						1. / ((1. + distance) * (1. + sqrt(variance)));
+	}
+
 	return result;
 }
 
@@ -142,7 +180,7 @@ OkNNr_predict(int nrows, int ncols, double **matrix, const double *targets,
  */
 int
 OkNNr_learn(int nrows, int nfeatures, double **matrix, double *targets,
-			double *features, double target)
+			double *features, double target, const AQOModelParams *params)
 {
 	double	   distances[aqo_K];
 	int			i,
@@ -165,11 +203,12 @@ OkNNr_learn(int nrows, int nfeatures, double **matrix, double *targets,
 	 * replace data for the neighbor to avoid some fluctuations.
 	 * We will change it's row with linear smoothing by learning_rate.
 	 */
-	if (nrows > 0 && distances[mid] < object_selection_threshold)
+	if (nrows > 0 && distances[mid] < params->object_selection_threshold)
 	{
 		for (j = 0; j < nfeatures; ++j)
-			matrix[mid][j] += learning_rate * (features[j] - matrix[mid][j]);
-		targets[mid] += learning_rate * (target - targets[mid]);
+			matrix[mid][j] += params->learning_rate *
+							  (features[j] - matrix[mid][j]);
+		targets[mid] += params->learning_rate * (target - targets[mid]);
 
 		return nrows;
 	}
@@ -208,21 +247,21 @@ OkNNr_learn(int nrows, int nfeatures, double **matrix, double *targets,
 		 * idx array. Compute weight for each nearest neighbor and total weight
 		 * of all nearest neighbor.
 		 */
-		w_sum = compute_weights(distances, nrows, w, idx);
+		w_sum = compute_weights(distances, nrows, w, idx, params->k);
 
 		/*
 		 * Compute average value for target by nearest neighbors. We need to
 		 * check idx[i] != -1 because we may have smaller value of nearest
-		 * neighbors than aqo_k.
+		 * neighbors than k.
 		 * Semantics of coef1: it is defined distance between new object and
 		 * this superposition value (with linear smoothing).
 		 * */
-		for (i = 0; i < aqo_k && idx[i] != -1; ++i)
+		for (i = 0; i < params->k && idx[i] != -1; ++i)
 			avg_target += targets[idx[i]] * w[i] / w_sum;
-		tc_coef = learning_rate * (avg_target - target);
+		tc_coef = params->learning_rate * (avg_target - target);
 
 		/* Modify targets and features of each nearest neighbor row. */
-		for (i = 0; i < aqo_k && idx[i] != -1; ++i)
+		for (i = 0; i < params->k && idx[i] != -1; ++i)
 		{
 			fc_coef = tc_coef * (targets[idx[i]] - avg_target) * w[i] * w[i] /
 				sqrt(nfeatures) / w_sum;
@@ -239,3 +278,76 @@ OkNNr_learn(int nrows, int nfeatures, double **matrix, double *targets,
 
 	return nrows;
 }
+
+/*
+ * Predicts by the linear model. The first row of the matrix contains weights of
+ * the features, targets contain the bias and the mean squared error of the
+ * model. Confidence of the prediction is measured by the error in the same
+ * way, as the spread of neighbors targets in the OkNNr method.
+ */
+double
+NLMS_predict(int nrows, int ncols, double **matrix, const double *targets,
+			 double *features, double *confidence, const AQOModelParams *params)
+{
+	double	result;
+	int		i;
+
+	if (nrows < NLMS_NROWS)
+	{
+		/* The model isn't learned yet */
+		if (confidence != NULL)
+			*confidence = 0.;
+		return -1;
+	}
+
+	result = targets[0];
+	for (i = 0; i < ncols; ++i)
+		result += matrix[0][i] * features[i];
+
+	if (confidence != NULL)
+		*confidence = 1. / (1. + sqrt(Max(targets[1], 0.)));
+
+	return Max(result, 0.);
+}
+
+/*
+ * Makes a learning step of the linear model on the new object. The first
+ * object just sets the bias.
+ * Returns number of used rows of the matrix.
+ */
+int
+NLMS_learn(int nrows, int ncols, double **matrix, double *targets,
+		   double *features, double target, const AQOModelParams *params)
+{
+	double	error;
+	double	norm = 1.;
+	int		i;
+
+	if (nrows < NLMS_NROWS)
+	{
+		for (i = 0; i < ncols; ++i)
+		{
+			matrix[0][i] = 0.;
+			matrix[1][i] = 0.;
+		}
+		targets[0] = target;
+		targets[1] = 0.;
+		return NLMS_NROWS;
+	}
+
+	error = target - targets[0];
+	for (i = 0; i < ncols; ++i)
+	{
+		error -= matrix[0][i] * features[i];
+		norm += features[i] * features[i];
+	}
+
+	for (i = 0; i < ncols; ++i)
+		matrix[0][i] += NLMS_STEP * error * features[i] / norm;
+	targets[0] += NLMS_STEP * error / norm;
+
+	/* Smooth the error of the model by learning_rate. */
+	targets[1] += params->learning_rate * (error * error - targets[1]);
+
+	return NLMS_NROWS;
+}
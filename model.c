@@ -0,0 +1,282 @@
+/*
+ *******************************************************************************
+ *
+ *	MODELS OF FEATURE SUBSPACES
+ *
+ * A feature subspace is stored as a matrix of features and a vector of targets
+ * (see storage.c). The model of the feature space defines, how to learn them
+ * and how to predict by them:
+ *	"knn" - the OkNNr method: rows of the matrix are learned objects. This is
+ *	the default model.
+ *	"linear" - the online linear regression (see machine_learning.c). It uses
+ *	two rows only, so it is cheap for subspaces with many features, and it
+ *	extrapolates better for queries with a large domain of constants.
+ *
+ * The model of a feature space is set in the aqo_fspace_settings table. Feature
+ * spaces without a record use the aqo.model setting. Subspaces, learned by
+ * different models, have different hashes. So a change of the model doesn't
+ * mix up the learned data, but the feature space has to be learned again.
+ *
+ * The same table overrides the machine learning parameters of the feature
+ * space: number of neighbors, learning rate, object selection threshold and
+ * lower bound of logarithms of selectivities. They don't change the format of
+ * the learned data, so they can be changed online.
+ *
+ * Backends cache settings of feature spaces locally. A committed change of the
+ * aqo_fspace_settings table advances the shared generation counter, which
+ * invalidates these caches.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/model.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "commands/trigger.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "hash.h"
+#include "model.h"
+
+
+/* Salt of hashes of feature subspaces, learned by non-default models. */
+#define AQO_MODEL_SALT	(0x4D4F44)
+
+int		aqo_model = AQO_MODEL_KNN;
+
+/* Columns of the aqo_fspace_settings table */
+#define Anum_fspace_hash						(1)
+#define Anum_fspace_model						(2)
+#define Anum_fspace_k							(3)
+#define Anum_fspace_learning_rate				(4)
+#define Anum_fspace_object_selection_threshold	(5)
+#define Anum_fspace_log_selectivity_lower_bound	(6)
+#define Natts_fspace_settings					(6)
+
+typedef struct FSpaceSettingsEntry
+{
+	int				fhash;
+	int				model;		/* -1 means the default model */
+	AQOModelParams	params;
+} FSpaceSettingsEntry;
+
+static HTAB	   *fspace_settings = NULL;
+static uint64	fspace_settings_generation = 0;
+
+static int knn_merge(int nrows, int ncols, double **matrix, double *targets,
+					 int other_nrows, double **other_matrix,
+					 double *other_targets, const AQOModelParams *params);
+static int linear_merge(int nrows, int ncols, double **matrix, double *targets,
+						int other_nrows, double **other_matrix,
+						double *other_targets, const AQOModelParams *params);
+
+static const AQOModelRoutine models[AQO_MODELS_NUM] =
+{
+	{AQO_MODEL_KNN, "knn", aqo_K, OkNNr_predict, OkNNr_learn, knn_merge},
+	{AQO_MODEL_LINEAR, "linear", 2, NLMS_predict, NLMS_learn, linear_merge}
+};
+
+
+/*
+ * Learn the objects of another subspace one by one.
+ */
+static int
+knn_merge(int nrows, int ncols, double **matrix, double *targets,
+		  int other_nrows, double **other_matrix, double *other_targets,
+		  const AQOModelParams *params)
+{
+	int i;
+
+	for (i = 0; i < other_nrows; i++)
+		nrows = OkNNr_learn(nrows, ncols, matrix, targets,
+							other_matrix[i], other_targets[i], params);
+	return nrows;
+}
+
+/*
+ * Average two linear models.
+ */
+static int
+linear_merge(int nrows, int ncols, double **matrix, double *targets,
+			 int other_nrows, double **other_matrix, double *other_targets,
+			 const AQOModelParams *params)
+{
+	const int	n = models[AQO_MODEL_LINEAR].max_rows;
+	int			i;
+	int			j;
+
+	if (other_nrows < n)
+		return nrows;
+
+	for (i = 0; i < n; i++)
+	{
+		for (j = 0; j < ncols; j++)
+			matrix[i][j] = (nrows < n) ? other_matrix[i][j] :
+							(matrix[i][j] + other_matrix[i][j]) / 2.;
+		targets[i] = (nrows < n) ? other_targets[i] :
+						(targets[i] + other_targets[i]) / 2.;
+	}
+	return n;
+}
+
+const AQOModelRoutine *
+aqo_model_routine(AQOModelKind kind)
+{
+	Assert(kind >= 0 && kind < AQO_MODELS_NUM);
+	return &models[kind];
+}
+
+/*
+ * Read settings of the feature space from the aqo_fspace_settings table.
+ * Settings, which aren't set, are the default ones.
+ */
+static void
+read_fspace_settings(int fhash, FSpaceSettingsEntry *entry)
+{
+	Datum	values[Natts_fspace_settings];
+	bool	nulls[Natts_fspace_settings];
+	int		i;
+
+	entry->model = -1;
+	entry->params.k = aqo_k;
+	entry->params.learning_rate = learning_rate;
+	entry->params.object_selection_threshold = object_selection_threshold;
+	entry->params.log_selectivity_lower_bound = log_selectivity_lower_bound;
+
+	if (!find_fspace_settings(fhash, values, nulls))
+		return;
+
+	if (!nulls[Anum_fspace_model - 1])
+	{
+		char *name = TextDatumGetCString(values[Anum_fspace_model - 1]);
+
+		for (i = 0; i < AQO_MODELS_NUM; i++)
+			if (strcmp(name, models[i].name) == 0)
+				entry->model = i;
+
+		if (entry->model < 0)
+			elog(WARNING, "AQO: unknown model \"%s\" of the feature space %d",
+				 name, fhash);
+	}
+
+	if (!nulls[Anum_fspace_k - 1])
+	{
+		int k = DatumGetInt32(values[Anum_fspace_k - 1]);
+
+		/* The matrix can't contain more than aqo_K neighbors. */
+		entry->params.k = Min(Max(k, 1), aqo_K);
+	}
+	if (!nulls[Anum_fspace_learning_rate - 1])
+		entry->params.learning_rate =
+						DatumGetFloat8(values[Anum_fspace_learning_rate - 1]);
+	if (!nulls[Anum_fspace_object_selection_threshold - 1])
+		entry->params.object_selection_threshold =
+			DatumGetFloat8(values[Anum_fspace_object_selection_threshold - 1]);
+	if (!nulls[Anum_fspace_log_selectivity_lower_bound - 1])
+		entry->params.log_selectivity_lower_bound =
+			DatumGetFloat8(values[Anum_fspace_log_selectivity_lower_bound - 1]);
+}
+
+/*
+ * Get cached settings of the feature space.
+ * The entry is valid until the next call only.
+ */
+static FSpaceSettingsEntry *
+get_fspace_settings(int fhash)
+{
+	uint64				generation = aqo_shared_generation(AQO_MODEL_GENERATION);
+	FSpaceSettingsEntry *entry;
+	bool				found;
+
+	if (fspace_settings == NULL || generation != fspace_settings_generation)
+	{
+		HASHCTL ctl;
+
+		if (fspace_settings != NULL)
+			hash_destroy(fspace_settings);
+
+		ctl.keysize = sizeof(int);
+		ctl.entrysize = sizeof(FSpaceSettingsEntry);
+		fspace_settings = hash_create("AQO settings of feature spaces", 64,
+									  &ctl, HASH_ELEM | HASH_BLOBS);
+		fspace_settings_generation = generation;
+	}
+
+	entry = (FSpaceSettingsEntry *) hash_search(fspace_settings, &fhash,
+												HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		FSpaceSettingsEntry settings;
+
+		/* Read the table before the entry is created: it can fail. */
+		read_fspace_settings(fhash, &settings);
+		entry = (FSpaceSettingsEntry *) hash_search(fspace_settings, &fhash,
+													HASH_ENTER, &found);
+		entry->model = settings.model;
+		entry->params = settings.params;
+	}
+
+	return entry;
+}
+
+/*
+ * Get the model of the feature space.
+ */
+const AQOModelRoutine *
+aqo_fspace_model(int fhash)
+{
+	FSpaceSettingsEntry *entry = get_fspace_settings(fhash);
+
+	return &models[(entry->model < 0) ? aqo_model : entry->model];
+}
+
+/*
+ * Get the machine learning parameters of the feature space.
+ */
+void
+aqo_fspace_params(int fhash, AQOModelParams *params)
+{
+	*params = get_fspace_settings(fhash)->params;
+}
+
+/*
+ * Returns hash of the feature subspace for the model.
+ * The OkNNr model keeps the basic hashes, so the knowledge bases of previous
+ * versions remain valid.
+ */
+int
+aqo_model_fss(const AQOModelRoutine *model, int fss_hash)
+{
+	int hashes[2];
+
+	if (model->kind == AQO_MODEL_KNN)
+		return fss_hash;
+
+	hashes[0] = fss_hash;
+	hashes[1] = AQO_MODEL_SALT + model->kind;
+	return get_int_array_hash(hashes, 2);
+}
+
+PG_FUNCTION_INFO_V1(aqo_fspace_settings_changed);
+
+/*
+ * Trigger on the aqo_fspace_settings table. Invalidate cached models of
+ * feature spaces in all backends, when the change is committed.
+ */
+Datum
+aqo_fspace_settings_changed(PG_FUNCTION_ARGS)
+{
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "aqo_fspace_settings_changed: must be called as trigger");
+
+	aqo_shared_next_generation_at_commit(AQO_MODEL_GENERATION);
+	PG_RETURN_POINTER(NULL);
+}
@@ -0,0 +1,54 @@
+#ifndef AQO_MODEL_H
+#define AQO_MODEL_H
+
+#include "postgres.h"
+
+#include "fmgr.h"
+
+#include "aqo.h"
+
+typedef enum
+{
+	AQO_MODEL_KNN = 0,		/* OkNNr method */
+	AQO_MODEL_LINEAR,		/* Linear regression, learned by NLMS */
+
+	AQO_MODELS_NUM
+} AQOModelKind;
+
+/*
+ * Interface of a model of feature subspaces. The model is stored as a matrix
+ * of max_rows x nfeatures values and a vector of max_rows targets, so the
+ * storage, caches and the export of the knowledge base don't depend on it.
+ */
+typedef struct AQOModelRoutine
+{
+	AQOModelKind	kind;
+	const char	   *name;
+	int				max_rows;	/* rows of the matrix, used by the model */
+
+	/* Returns negative value, if the model can't predict. */
+	double	(*predict) (int nrows, int ncols, double **matrix,
+						const double *targets, double *features,
+						double *confidence, const AQOModelParams *params);
+
+	/* Learns one object. Returns new number of rows. */
+	int		(*learn) (int nrows, int ncols, double **matrix, double *targets,
+					  double *features, double target,
+					  const AQOModelParams *params);
+
+	/* Merges another model of the subspace. Returns new number of rows. */
+	int		(*merge) (int nrows, int ncols, double **matrix, double *targets,
+					  int other_nrows, double **other_matrix,
+					  double *other_targets, const AQOModelParams *params);
+} AQOModelRoutine;
+
+extern PGDLLIMPORT int aqo_model;
+
+extern const AQOModelRoutine *aqo_model_routine(AQOModelKind kind);
+extern const AQOModelRoutine *aqo_fspace_model(int fhash);
+extern void aqo_fspace_params(int fhash, AQOModelParams *params);
+extern int aqo_model_fss(const AQOModelRoutine *model, int fss_hash);
+
+extern Datum aqo_fspace_settings_changed(PG_FUNCTION_ARGS);
+
+#endif /* AQO_MODEL_H */
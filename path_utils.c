@@ -43,7 +43,10 @@ static AQOPlanNode DefaultAQOPlanNode =
 	.parallel_divisor = -1,
 	.was_parametrized = false,
 	.fss = INT_MAX,
-	.prediction = -1
+	.prediction = -1,
+	.confidence = -1,
+	.default_rows = -1,
+	.shadow_prediction = -1
 };
 
 static AQOPlanNode *
@@ -417,6 +420,8 @@ aqo_create_plan_hook(PlannerInfo *root, Path *src, Plan **dest)
 		node->prediction = src->parent->predicted_cardinality;
 		node->fss = src->parent->fss_hash;
 	}
+	get_prediction_info(node->fss, &node->confidence, &node->default_rows,
+					&node->shadow_prediction);
 
 	node->had_path = true;
 }
@@ -487,6 +492,9 @@ AQOnodeOut(struct StringInfoData *str, const struct ExtensibleNode *enode)
 	/* For Adaptive optimization DEBUG purposes */
 	WRITE_INT_FIELD(fss);
 	WRITE_FLOAT_FIELD(prediction, "%.0f");
+	WRITE_FLOAT_FIELD(confidence, "%.3f");
+	WRITE_FLOAT_FIELD(default_rows, "%.0f");
+	WRITE_FLOAT_FIELD(shadow_prediction, "%.0f");
 }
 
 /* Read an integer field (anything written as ":fldname %d") */
@@ -540,6 +548,9 @@ AQOnodeRead(struct ExtensibleNode *enode)
 	/* For Adaptive optimization DEBUG purposes */
 	READ_INT_FIELD(fss);
 	READ_FLOAT_FIELD(prediction);
+	READ_FLOAT_FIELD(confidence);
+	READ_FLOAT_FIELD(default_rows);
+	READ_FLOAT_FIELD(shadow_prediction);
 }
 
 static const ExtensibleNodeMethods method =
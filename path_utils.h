@@ -29,6 +29,9 @@ typedef struct AQOPlanNode
 	/* For Adaptive optimization DEBUG purposes */
 	int		fss;
 	double	prediction;
+	double	confidence;		/* -1, if unknown */
+	double	default_rows;	/* standard estimation for the hybrid model */
+	double	shadow_prediction;	/* unused prediction of the shadow mode */
 } AQOPlanNode;
 
 
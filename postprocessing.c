@@ -19,16 +19,26 @@
 #include "postgres.h"
 
 #include "access/parallel.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "miscadmin.h"
 #include "optimizer/optimizer.h"
 #include "postgres_fdw.h"
 #include "utils/queryenvironment.h"
 
 #include "aqo.h"
+#include "baseline.h"
+#include "coarse_index.h"
+#include "drift.h"
+#include "fast_path.h"
 #include "hash.h"
 #include "ignorance.h"
+#include "model.h"
 #include "path_utils.h"
 #include "preprocessing.h"
 #include "profile_mem.h"
+#include "replan.h"
+#include "shadow.h"
 
 
 typedef struct
@@ -37,8 +47,39 @@ typedef struct
 	List *selectivities;
 	List *relidslist;
 	bool learn;
+	bool aborted;	/* the execution was interrupted by an error */
 } aqo_obj_stat;
 
+/*
+ * Sample of a node of an aborted query. It is learned later, in another
+ * transaction, as a lower bound of the cardinality of the node.
+ */
+typedef struct AbortedSample
+{
+	int		fhash;
+	int		fss_hash;		/* not salted by the model yet */
+	bool	agg;
+	int		nfeatures;
+	double *features;
+	double	target;
+	List   *relids;
+} AbortedSample;
+
+/* Maximum number of samples of aborted queries, kept by a backend */
+#define AQO_MAX_ABORTED_SAMPLES	(1000)
+
+static List *aborted_samples = NIL;
+
+/* The samples are learned in the current transaction */
+static bool aborted_samples_learned = false;
+static bool aborted_samples_callback = false;
+
+/*
+ * Nodes of the last executed plan, which could be stopped before the end of
+ * data (see mark_incomplete_nodes()).
+ */
+static Bitmapset *incomplete_nodes = NULL;
+
 static double cardinality_sum_errors;
 static int	cardinality_num_objects;
 
@@ -55,17 +96,28 @@ static char *PlanStateInfo = "PlanStateInfo";
 
 
 /* Query execution statistics collecting utilities */
-static void atomic_fss_learn_step(int fhash, int fss_hash, int ncols,
+static void atomic_fss_learn_step(const AQOModelRoutine *model,
+								  int fhash, int fss_hash, int ncols,
 								  double **matrix, double *targets,
 								  double *features, double target,
-								  List *relids);
+								  List *relids, bool lower_bound);
+static bool learn_shared_fss(int fhash);
 static bool learnOnPlanState(PlanState *p, void *context);
+static void learn_agg_sample(List *clauselist,
+							 List *selectivities,
+							 List *relidslist,
+							 double true_cardinality,
+							 Plan *plan,
+							 bool notExecuted,
+							 bool lower_bound);
 static void learn_sample(List *clauselist,
 						 List *selectivities,
 						 List *relidslist,
 						 double true_cardinality,
+						 double predicted,
 						 Plan *plan,
-						 bool notExecuted);
+						 bool notExecuted,
+						 bool lower_bound);
 static List *restore_selectivities(List *clauselist,
 								   List *relidslist,
 								   JoinType join_type,
@@ -77,6 +129,19 @@ static void update_query_stat_row(double *et, int *et_size,
 								  double execution_time,
 								  double cardinality_error,
 								  int64 *n_exec);
+static int get_node_fss(List *clauselist, List *selectivities,
+						List *relidslist, double predicted,
+						AQOPlanNode *aqo_node, int *nfeatures,
+						double **features, int **feature_hashes);
+static void harvest_sample(List *clauselist, List *selectivities,
+						   List *relidslist, double true_cardinality,
+						   double predicted, PlanState *p);
+static void harvest_aborted_query(QueryDesc *queryDesc);
+static void learn_aborted_samples(void);
+static void aborted_samples_xact_callback(XactEvent event, void *arg);
+static void find_incomplete_nodes(PlanState *p, bool incomplete);
+static void mark_incomplete_nodes(PlanState *root, bool stopped_early);
+static bool is_incomplete_node(PlanState *p);
 static void StoreToQueryEnv(QueryDesc *queryDesc);
 static void StorePlanInternals(QueryDesc *queryDesc);
 static bool ExtractFromQueryEnv(QueryDesc *queryDesc);
@@ -86,31 +151,79 @@ static bool ExtractFromQueryEnv(QueryDesc *queryDesc);
  * This is the critical section: only one runner is allowed to be inside this
  * function for one feature subspace.
  * matrix and targets are just preallocated memory for computations.
+ * fss_hash must be already salted by the model (see aqo_model_fss()).
+ * If lower_bound is true, the target is learned only if the model predicts
+ * less.
  */
 static void
-atomic_fss_learn_step(int fhash, int fss_hash, int ncols,
+atomic_fss_learn_step(const AQOModelRoutine *model,
+					 int fhash, int fss_hash, int ncols,
 					 double **matrix, double *targets,
 					 double *features, double target,
-					 List *relids)
+					 List *relids, bool lower_bound)
 {
 	LOCKTAG	tag;
 	int		nrows;
+	AQOModelParams params;
+
+	aqo_fspace_params(fhash, &params);
 
 	init_lock_tag(&tag, (uint32) fhash, (uint32) fss_hash);
 	LockAcquire(&tag, ExclusiveLock, false, false);
 
 	if (!load_fss(fhash, fss_hash, ncols, matrix, targets, &nrows, NULL))
 		nrows = 0;
+	else if (fss_drifted(fhash, fss_hash, relids))
+		/* The learned objects are stale. Start from the new one. */
+		nrows = 0;
+	else if (lower_bound &&
+			 model->predict(nrows, ncols, matrix, targets, features, NULL,
+							&params) >= target)
+	{
+		/* The knowledge doesn't contradict the bound. */
+		LockRelease(&tag, ExclusiveLock, false);
+		return;
+	}
 
-	nrows = OkNNr_learn(nrows, ncols, matrix, targets, features, target);
+	nrows = model->learn(nrows, ncols, matrix, targets, features, target,
+						 &params);
 	update_fss(fhash, fss_hash, nrows, ncols, matrix, targets, relids);
+	fss_drift_baseline(fhash, fss_hash, relids);
 
 	LockRelease(&tag, ExclusiveLock, false);
 }
 
+/*
+ * Should the sample be learned in the shared pool of feature subspaces too?
+ */
+static bool
+learn_shared_fss(int fhash)
+{
+	Datum	values[5];
+	bool	nulls[5];
+
+	if (!aqo_shared_fss || fhash == AQO_SHARED_FSPACE)
+		/* Already learned in the pool. */
+		return false;
+
+	if ((random() / ((double) MAX_RANDOM_VALUE + 1)) >=
+												aqo_shared_fss_sample_rate)
+		return false;
+
+	/* The knowledge base refers to the virtual query of the pool. */
+	if (find_query(AQO_SHARED_FSPACE, values, nulls))
+		return true;
+
+	return update_query(AQO_SHARED_FSPACE, AQO_SHARED_FSPACE,
+						false, false, false) &&
+		   add_query_text(AQO_SHARED_FSPACE,
+						  "SHARED pool of feature subspaces (do not delete!)");
+}
+
 static void
 learn_agg_sample(List *clauselist, List *selectivities, List *relidslist,
-			 double true_cardinality, Plan *plan, bool notExecuted)
+			 double true_cardinality, Plan *plan, bool notExecuted,
+			 bool lower_bound)
 {
 	int fhash = query_context.fspace_hash;
 	int child_fss;
@@ -119,6 +232,8 @@ learn_agg_sample(List *clauselist, List *selectivities, List *relidslist,
 	double	*matrix[aqo_K];
 	double	targets[aqo_K];
 	AQOPlanNode *aqo_node = get_aqo_plan_node(plan, false);
+	/* Number of groups is predicted by the OkNNr model only. */
+	const AQOModelRoutine *model = aqo_model_routine(AQO_MODEL_KNN);
 	int i;
 
 	/*
@@ -135,33 +250,77 @@ learn_agg_sample(List *clauselist, List *selectivities, List *relidslist,
 	for (i = 0; i < aqo_K; i++)
 		matrix[i] = NULL;
 	/* Critical section */
-	atomic_fss_learn_step(fhash, fss,
+	atomic_fss_learn_step(model, fhash, fss,
 						  0, matrix, targets, NULL, target,
-						  relidslist);
+						  relidslist, lower_bound);
+	if (learn_shared_fss(fhash))
+		atomic_fss_learn_step(model, AQO_SHARED_FSPACE, fss,
+							  0, matrix, targets, NULL, target,
+							  relidslist, lower_bound);
 	/* End of critical section */
 }
 
+/*
+ * Computes the feature subspace of the node and its features.
+ *
+ * The hybrid model needs the standard estimation of the node. It is stored in
+ * the plan node, if AQO predicted the node. Otherwise, the plan has the
+ * standard estimation itself.
+ */
+static int
+get_node_fss(List *clauselist, List *selectivities, List *relidslist,
+			 double predicted, AQOPlanNode *aqo_node, int *nfeatures,
+			 double **features, int **feature_hashes)
+{
+	int		fss_hash;
+
+	fss_hash = get_fss_signature(relidslist, clauselist, selectivities,
+								 nfeatures, features, feature_hashes);
+
+	if (aqo_hybrid_model)
+	{
+		double default_rows = aqo_node->default_rows;
+
+		if (default_rows < 0. && aqo_node->prediction <= 0.)
+			default_rows = predicted;
+
+		if (default_rows >= 0.)
+			fss_hash = add_default_estimate_feature(fss_hash, default_rows,
+													nfeatures, features,
+													feature_hashes);
+	}
+
+	return fss_hash;
+}
+
 /*
  * For given object (i. e. clauselist, selectivities, relidslist, predicted and
  * true cardinalities) performs learning procedure.
+ * If lower_bound is true, the true cardinality is a lower bound only.
  */
 static void
 learn_sample(List *clauselist, List *selectivities, List *relidslist,
-			 double true_cardinality, Plan *plan, bool notExecuted)
+			 double true_cardinality, double predicted, Plan *plan,
+			 bool notExecuted, bool lower_bound)
 {
 	int		fhash = query_context.fspace_hash;
 	int		fss_hash;
+	int		model_fss;
+	const AQOModelRoutine *model;
 	int		nfeatures;
 	double	*matrix[aqo_K];
 	double	targets[aqo_K];
 	double	*features;
+	int		*feature_hashes = NULL;
 	double	target;
+	bool	shared;
 	int		i;
 	AQOPlanNode *aqo_node = get_aqo_plan_node(plan, false);
 
 	target = log(true_cardinality);
-	fss_hash = get_fss_for_object(relidslist, clauselist,
-								  selectivities, &nfeatures, &features);
+	fss_hash = get_node_fss(clauselist, selectivities, relidslist, predicted,
+							aqo_node, &nfeatures, &features,
+							aqo_coarse_fallback ? &feature_hashes : NULL);
 
 	/* Only Agg nodes can have non-empty a grouping expressions list. */
 	Assert(!IsA(plan, Agg) || aqo_node->grouping_exprs != NIL);
@@ -173,14 +332,17 @@ learn_sample(List *clauselist, List *selectivities, List *relidslist,
 	if (notExecuted && aqo_node->prediction > 0)
 		return;
 
+	model = aqo_fspace_model(fhash);
+	model_fss = aqo_model_fss(model, fss_hash);
+
 	if (aqo_log_ignorance && aqo_node->prediction <= 0 &&
-		load_fss(fhash, fss_hash, 0, NULL, NULL, NULL, NULL) )
+		load_fss(fhash, model_fss, 0, NULL, NULL, NULL, NULL) )
 	{
 		/*
 		 * If ignorance logging is enabled and the feature space was existed in
 		 * the ML knowledge base, log this issue.
 		 */
-		update_ignorance(query_context.query_hash, fhash, fss_hash, plan);
+		update_ignorance(query_context.query_hash, fhash, model_fss, plan);
 	}
 
 	if (nfeatures > 0)
@@ -188,11 +350,32 @@ learn_sample(List *clauselist, List *selectivities, List *relidslist,
 			matrix[i] = palloc(sizeof(double) * nfeatures);
 
 	/* Critical section */
-	atomic_fss_learn_step(fhash, fss_hash,
+	atomic_fss_learn_step(model, fhash, model_fss,
 						  nfeatures, matrix, targets, features, target,
-						  relidslist);
+						  relidslist, lower_bound);
+	shared = learn_shared_fss(fhash);
+	if (shared)
+	{
+		const AQOModelRoutine *pool_model = aqo_fspace_model(AQO_SHARED_FSPACE);
+
+		atomic_fss_learn_step(pool_model, AQO_SHARED_FSPACE,
+							  aqo_model_fss(pool_model, fss_hash),
+							  nfeatures, matrix, targets, features, target,
+							  relidslist, lower_bound);
+	}
 	/* End of critical section */
 
+	if (feature_hashes != NULL)
+	{
+		/* Now the subspace can be used as a coarser model for others. */
+		coarse_index_add(fhash, relidslist, fss_hash, nfeatures,
+						 feature_hashes);
+		if (shared)
+			coarse_index_add(AQO_SHARED_FSPACE, relidslist, fss_hash,
+							 nfeatures, feature_hashes);
+		pfree(feature_hashes);
+	}
+
 	if (nfeatures > 0)
 		for (i = 0; i < aqo_K; ++i)
 			pfree(matrix[i]);
@@ -200,6 +383,347 @@ learn_sample(List *clauselist, List *selectivities, List *relidslist,
 	pfree(features);
 }
 
+/*
+ * Remembers a node of an aborted query. The knowledge base can't be changed in
+ * the aborted transaction, so the sample is kept in the backend memory until
+ * learn_aborted_samples(). The number of kept samples is limited.
+ */
+static void
+harvest_sample(List *clauselist, List *selectivities, List *relidslist,
+			   double true_cardinality, double predicted, PlanState *p)
+{
+	AQOPlanNode *aqo_node = get_aqo_plan_node(p->plan, false);
+	AbortedSample *sample;
+	MemoryContext oldCxt;
+	int		fss_hash;
+	int		nfeatures = 0;
+	double *features = NULL;
+
+	if (list_length(aborted_samples) >= AQO_MAX_ABORTED_SAMPLES)
+		return;
+
+	if (!aborted_samples_callback)
+	{
+		RegisterXactCallback(aborted_samples_xact_callback, NULL);
+		aborted_samples_callback = true;
+	}
+
+	if (IsA(p, AggState))
+	{
+		fss_hash = get_fss_for_object(relidslist, clauselist, NIL, NULL, NULL);
+		fss_hash = get_grouped_exprs_hash(fss_hash, aqo_node->grouping_exprs);
+	}
+	else
+		fss_hash = get_node_fss(clauselist, selectivities, relidslist,
+								predicted, aqo_node, &nfeatures, &features,
+								NULL);
+
+	oldCxt = MemoryContextSwitchTo(AQOMemoryContext);
+	sample = palloc(sizeof(AbortedSample));
+	sample->fhash = query_context.fspace_hash;
+	sample->fss_hash = fss_hash;
+	sample->agg = IsA(p, AggState);
+	sample->nfeatures = nfeatures;
+	sample->features = NULL;
+	if (nfeatures > 0)
+	{
+		sample->features = palloc(sizeof(double) * nfeatures);
+		memcpy(sample->features, features, sizeof(double) * nfeatures);
+	}
+	sample->target = log(true_cardinality);
+	sample->relids = list_copy(relidslist);
+	aborted_samples = lappend(aborted_samples, sample);
+	MemoryContextSwitchTo(oldCxt);
+}
+
+/*
+ * Forget samples of the aborted queries.
+ */
+static void
+free_aborted_samples(void)
+{
+	ListCell *lc;
+
+	foreach(lc, aborted_samples)
+	{
+		AbortedSample *sample = (AbortedSample *) lfirst(lc);
+
+		if (sample->features != NULL)
+			pfree(sample->features);
+		list_free(sample->relids);
+	}
+
+	list_free_deep(aborted_samples);
+	aborted_samples = NIL;
+	aborted_samples_learned = false;
+}
+
+/*
+ * Learns a sample of an aborted query. A sample is a lower bound of the
+ * cardinality: the model learns it only if it predicts less.
+ */
+static void
+learn_aborted_sample(AbortedSample *sample)
+{
+	const AQOModelRoutine *model;
+	double	   *matrix[aqo_K];
+	double		targets[aqo_K];
+	int			fss_hash = sample->fss_hash;
+	int			i;
+
+	/* Number of groups is predicted by the OkNNr model only. */
+	if (sample->agg)
+		model = aqo_model_routine(AQO_MODEL_KNN);
+	else
+	{
+		model = aqo_fspace_model(sample->fhash);
+		fss_hash = aqo_model_fss(model, fss_hash);
+	}
+
+	for (i = 0; i < aqo_K; i++)
+		matrix[i] = (sample->nfeatures > 0) ?
+					palloc(sizeof(double) * sample->nfeatures) : NULL;
+
+	atomic_fss_learn_step(model, sample->fhash, fss_hash,
+						  sample->nfeatures, matrix, targets,
+						  sample->features, sample->target,
+						  sample->relids, true);
+
+	for (i = 0; i < aqo_K; i++)
+		if (matrix[i] != NULL)
+			pfree(matrix[i]);
+}
+
+/*
+ * Learns samples of the aborted queries of the backend at the end of the next
+ * statement. The learning is made in a subtransaction: an error is reported as
+ * a warning and doesn't fail the statement. The samples are forgotten at the
+ * commit of the transaction only, so they survive its rollback.
+ */
+static void
+learn_aborted_samples(void)
+{
+	MemoryContext	oldcxt = CurrentMemoryContext;
+	ResourceOwner	oldowner = CurrentResourceOwner;
+	ListCell	   *lc;
+
+	if (aborted_samples == NIL || aborted_samples_learned ||
+		IsInParallelMode())
+		return;
+
+	if (DefaultXactReadOnly || RecoveryInProgress())
+	{
+		/* The session can't learn them at all. */
+		free_aborted_samples();
+		return;
+	}
+
+	if (XactReadOnly)
+		return;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcxt);
+
+	PG_TRY();
+	{
+		foreach(lc, aborted_samples)
+			learn_aborted_sample((AbortedSample *) lfirst(lc));
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcxt);
+		CurrentResourceOwner = oldowner;
+		aborted_samples_learned = true;
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldcxt);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcxt);
+		CurrentResourceOwner = oldowner;
+
+		ereport(WARNING,
+				(errmsg("AQO: samples of aborted queries are not learned: %s",
+						edata->message)));
+		FreeErrorData(edata);
+
+		/* Don't try to learn the same samples again. */
+		free_aborted_samples();
+	}
+	PG_END_TRY();
+}
+
+/*
+ * Forget the learned samples at the commit. After a rollback they will be
+ * learned again.
+ */
+static void
+aborted_samples_xact_callback(XactEvent event, void *arg)
+{
+	if (!aborted_samples_learned)
+		return;
+
+	if (event == XACT_EVENT_COMMIT || event == XACT_EVENT_PARALLEL_COMMIT)
+		free_aborted_samples();
+	else if (event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+		aborted_samples_learned = false;
+}
+
+/*
+ * Collects samples of the query, interrupted by an error. Called in the
+ * PG_CATCH section, so the work is done in the memory of the executor, which
+ * is released at the abort of the transaction.
+ */
+static void
+harvest_aborted_query(QueryDesc *queryDesc)
+{
+	aqo_obj_stat ctx = {NIL, NIL, NIL, true, true};
+	MemoryContext oldCxt;
+
+	/* A read-only session can't learn the samples. */
+	if (DefaultXactReadOnly || RecoveryInProgress())
+		return;
+
+	if (!ExtractFromQueryEnv(queryDesc) || !query_context.learn_aqo ||
+		query_context.explain_only || queryDesc->planstate == NULL)
+		return;
+
+	oldCxt = MemoryContextSwitchTo(queryDesc->estate->es_query_cxt);
+	HOLD_INTERRUPTS();
+	learnOnPlanState(queryDesc->planstate, (void *) &ctx);
+	RESUME_INTERRUPTS();
+	MemoryContextSwitchTo(oldCxt);
+}
+
+static bool
+find_incomplete_walker(PlanState *p, void *context)
+{
+	find_incomplete_nodes(p, *(bool *) context);
+	return false;
+}
+
+/*
+ * Subplans of EXISTS, ANY and ALL sublinks are stopped at the first suitable
+ * row, if they don't use a hash table.
+ */
+static void
+find_incomplete_subplans(List *subplans)
+{
+	ListCell *lc;
+
+	foreach(lc, subplans)
+	{
+		SubPlanState   *sps = lfirst_node(SubPlanState, lc);
+		SubLinkType		type = sps->subplan->subLinkType;
+
+		find_incomplete_nodes(sps->planstate,
+							  !sps->subplan->useHashTable &&
+							  (type == EXISTS_SUBLINK || type == ANY_SUBLINK ||
+							   type == ALL_SUBLINK));
+	}
+}
+
+/*
+ * Adds the node to the set of incomplete ones, if its parent could stop it
+ * before the end of data, and walks the children. There is no way to know if
+ * the node has returned the end of data, so the check is structural:
+ *
+ * - a LIMIT node stops the subplan, if it got enough rows;
+ * - a nested loop, which needs a single match of an outer row (semi-join,
+ *   anti-join or unique inner side), stops the inner scan at the first match;
+ * - a merge join stops at the end of any of the sides;
+ * - a hash join builds the hash table of the whole inner side;
+ * - sort, hash and hashed or plain aggregation read the whole input, so
+ *   their subplans are completed anyway.
+ */
+static void
+find_incomplete_nodes(PlanState *p, bool incomplete)
+{
+	List   *saved_subplan_list = p->subPlan;
+	List   *saved_initplan_list = p->initPlan;
+	bool	children = incomplete;
+
+	if (incomplete)
+		incomplete_nodes = bms_add_member(incomplete_nodes,
+										  p->plan->plan_node_id);
+
+	switch (nodeTag(p))
+	{
+		case T_LimitState:
+			if (((LimitState *) p)->lstate != LIMIT_SUBPLANEOF)
+				children = true;
+			break;
+		case T_MergeJoinState:
+			children = true;
+			break;
+		case T_SortState:
+		case T_HashState:
+			children = false;
+			break;
+		case T_AggState:
+			if (((Agg *) p->plan)->aggstrategy == AGG_PLAIN ||
+				((Agg *) p->plan)->aggstrategy == AGG_HASHED)
+				children = false;
+			break;
+		default:
+			break;
+	}
+
+	p->subPlan = NIL;
+	p->initPlan = NIL;
+
+	if (IsA(p, NestLoopState) || IsA(p, HashJoinState))
+	{
+		find_incomplete_nodes(outerPlanState(p), children);
+		find_incomplete_nodes(innerPlanState(p),
+							  IsA(p, NestLoopState) &&
+							  (children || ((JoinState *) p)->single_match));
+	}
+	else
+		planstate_tree_walker(p, find_incomplete_walker, (void *) &children);
+
+	p->subPlan = saved_subplan_list;
+	p->initPlan = saved_initplan_list;
+
+	find_incomplete_subplans(p->initPlan);
+	find_incomplete_subplans(p->subPlan);
+}
+
+/*
+ * Finds nodes of the plan, which could be stopped before the end of data.
+ * stopped_early means that the last run of the executor was stopped by the
+ * count of rows. NULL root just forgets the last plan.
+ */
+static void
+mark_incomplete_nodes(PlanState *root, bool stopped_early)
+{
+	MemoryContext oldCxt;
+
+	bms_free(incomplete_nodes);
+	incomplete_nodes = NULL;
+
+	if (root == NULL)
+		return;
+
+	oldCxt = MemoryContextSwitchTo(AQOMemoryContext);
+	find_incomplete_nodes(root, stopped_early);
+	MemoryContextSwitchTo(oldCxt);
+}
+
+/*
+ * Could the node of the last executed plan be stopped before the end of data?
+ */
+static bool
+is_incomplete_node(PlanState *p)
+{
+	return aqo_incomplete_nodes != AQO_INCOMPLETE_LEARN &&
+		   bms_is_member(p->plan->plan_node_id, incomplete_nodes);
+}
+
 /*
  * For given node specified by clauselist, relidslist and join_type restores
  * the same selectivities of clauses as were used at query optimization stage.
@@ -288,7 +812,10 @@ learn_subplan_recurse(PlanState *p, aqo_obj_stat *ctx)
 
 	if (!p->instrument)
 		return true;
-	InstrEndLoop(p->instrument);
+
+	/* A node of an aborted query can be in the middle of a loop. */
+	if (!ctx->aborted)
+		InstrEndLoop(p->instrument);
 
 	saved_subplan_list = p->subPlan;
 	saved_initplan_list = p->initPlan;
@@ -301,7 +828,7 @@ learn_subplan_recurse(PlanState *p, aqo_obj_stat *ctx)
 	foreach(lc, saved_subplan_list)
 	{
 		SubPlanState *sps = lfirst_node(SubPlanState, lc);
-		aqo_obj_stat SPCtx = {NIL, NIL, NIL, ctx->learn};
+		aqo_obj_stat SPCtx = {NIL, NIL, NIL, ctx->learn, ctx->aborted};
 
 		if (learnOnPlanState(sps->planstate, (void *) &SPCtx))
 			return true;
@@ -310,7 +837,7 @@ learn_subplan_recurse(PlanState *p, aqo_obj_stat *ctx)
 	foreach(lc, saved_initplan_list)
 	{
 		SubPlanState *sps = lfirst_node(SubPlanState, lc);
-		aqo_obj_stat SPCtx = {NIL, NIL, NIL, ctx->learn};
+		aqo_obj_stat SPCtx = {NIL, NIL, NIL, ctx->learn, ctx->aborted};
 
 		if (learnOnPlanState(sps->planstate, (void *) &SPCtx))
 			return true;
@@ -336,11 +863,12 @@ static bool
 learnOnPlanState(PlanState *p, void *context)
 {
 	aqo_obj_stat *ctx = (aqo_obj_stat *) context;
-	aqo_obj_stat SubplanCtx = {NIL, NIL, NIL, ctx->learn};
+	aqo_obj_stat SubplanCtx = {NIL, NIL, NIL, ctx->learn, ctx->aborted};
 	double predicted = 0.;
 	double learn_rows = 0.;
 	AQOPlanNode *aqo_node;
 	bool notExecuted = false;
+	bool incomplete;
 
 	/* Recurse into subtree and collect clauses. */
 	if (learn_subplan_recurse(p, &SubplanCtx))
@@ -355,7 +883,25 @@ learnOnPlanState(PlanState *p, void *context)
 	 * If 'never executed' node will be found - set specific sign, because we
 	 * allow to learn on such node only once.
 	 */
-	if (p->instrument->nloops > 0.)
+	if (ctx->aborted)
+	{
+		/*
+		 * Rows, returned by the node of an aborted query so far, including the
+		 * unfinished loop. Rows of parallel workers are lost.
+		 */
+		double nloops = p->instrument->nloops +
+						(p->instrument->running ? 1. : 0.);
+
+		if (nloops > 0.)
+			learn_rows = (p->instrument->ntuples +
+						  p->instrument->tuplecount) / nloops;
+		else
+		{
+			learn_rows = 1.;
+			notExecuted = true;
+		}
+	}
+	else if (p->instrument->nloops > 0.)
 	{
 		/* If we can strongly calculate produced rows, do it. */
 		if (p->worker_instrument &&
@@ -417,10 +963,22 @@ learnOnPlanState(PlanState *p, void *context)
 		/* No AQO prediction. Parallel workers not used for this plan node. */
 		predicted = p->plan->plan_rows;
 
+	/* Rows of an aborted query are already a lower bound. */
+	incomplete = !ctx->aborted && is_incomplete_node(p);
+
+	/* Compare the default estimation with the unused prediction. */
+	if (query_context.shadow && aqo_node->had_path && !ctx->aborted &&
+		!notExecuted && !incomplete)
+		shadow_account(predicted, aqo_node->shadow_prediction, learn_rows);
+
 	if (!ctx->learn && query_context.collect_stat)
 	{
 		double p,l;
 
+		/* The real cardinality of an incomplete node is unknown. */
+		if (incomplete)
+			return false;
+
 		/* Special case of forced gathering of statistics. */
 		Assert(predicted >= 0 && learn_rows >= 0);
 		p = (predicted < 1) ? 0 : log(predicted);
@@ -430,7 +988,8 @@ learnOnPlanState(PlanState *p, void *context)
 		return false;
 	}
 	else if (!ctx->learn)
-		return true;
+		/* The shadow mode needs all the nodes. */
+		return !query_context.shadow;
 
 	/*
 	 * Need learn.
@@ -470,18 +1029,37 @@ learnOnPlanState(PlanState *p, void *context)
 			{
 				Assert(predicted >= 1. && learn_rows >= 1.);
 
-				if (ctx->learn)
+				if (ctx->aborted)
+				{
+					/* Only a lower bound above the prediction is useful. */
+					if (!notExecuted && learn_rows > predicted)
+						harvest_sample(SubplanCtx.clauselist,
+									   SubplanCtx.selectivities,
+									   aqo_node->relids, learn_rows,
+									   predicted, p);
+				}
+				else if (ctx->learn &&
+						 (!incomplete ||
+						  (aqo_incomplete_nodes == AQO_INCOMPLETE_LOWER_BOUND &&
+						   learn_rows > predicted)))
 				{
+					/*
+					 * Rows of a node, which could be stopped early, are a
+					 * lower bound. It is useful above the prediction only.
+					 */
 					if (IsA(p, AggState))
 						learn_agg_sample(SubplanCtx.clauselist, NULL,
 										 aqo_node->relids, learn_rows,
-										 p->plan, notExecuted);
+										 p->plan, notExecuted, incomplete);
 
 					else
 						learn_sample(SubplanCtx.clauselist,
 									 SubplanCtx.selectivities,
-									 aqo_node->relids, learn_rows,
-									 p->plan, notExecuted);
+									 aqo_node->relids, learn_rows, predicted,
+									 p->plan, notExecuted, incomplete);
+
+					if (!notExecuted && !incomplete)
+						replan_account(aqo_node->relids, predicted, learn_rows);
 				}
 			}
 		}
@@ -561,7 +1139,7 @@ aqo_ExecutorStart(QueryDesc *queryDesc, int eflags)
 
 	use_aqo = !IsQueryDisabled() && !IsParallelWorker() &&
 				(query_context.use_aqo || query_context.learn_aqo ||
-				force_collect_stat ||
+				query_context.shadow || force_collect_stat ||
 				(aqo_profile_classes > 0 && aqo_profile_enable));
 
 	if (use_aqo)
@@ -573,11 +1151,14 @@ aqo_ExecutorStart(QueryDesc *queryDesc, int eflags)
 			query_context.planning_time = INSTR_TIME_GET_DOUBLE(now);
 		}
 		else
+		{
 			/*
 			 * Should set anyway. It will be stored in a query env. The query
 			 * can be reused later by extracting from a plan cache.
 			 */
 			query_context.planning_time = -1;
+			query_context.overhead_time = 0.;
+		}
 
 		/*
 		 * To zero this timestamp preventing a false time calculation in the
@@ -590,9 +1171,10 @@ aqo_ExecutorStart(QueryDesc *queryDesc, int eflags)
 		query_context.start_execution_time = now;
 
 		query_context.explain_only = ((eflags & EXEC_FLAG_EXPLAIN_ONLY) != 0);
+		query_context.stopped_early = false;
 
-		if ((query_context.learn_aqo || force_collect_stat) &&
-			!query_context.explain_only)
+		if ((query_context.learn_aqo || query_context.shadow ||
+			 force_collect_stat) && !query_context.explain_only)
 			queryDesc->instrument_options |= INSTRUMENT_ROWS;
 
 		/* Save all query-related parameters into the query context. */
@@ -608,6 +1190,64 @@ aqo_ExecutorStart(QueryDesc *queryDesc, int eflags)
 		StorePlanInternals(queryDesc);
 }
 
+/*
+ * Runs the query. If the execution of a learned query is interrupted by an
+ * error (a cancel, statement_timeout and so on), ExecutorEnd isn't called.
+ * The rows, returned by the nodes before the error, are harvested to learn
+ * them as lower bounds of the cardinalities.
+ * After the run, it finds the nodes, which could be stopped before the end of
+ * data, to show them in EXPLAIN ANALYZE.
+ */
+void
+aqo_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction, uint64 count,
+				bool execute_once)
+{
+	uint64		processed = queryDesc->estate->es_processed;
+	EphemeralNamedRelation enr;
+	QueryContextData *context;
+
+	if (!aqo_learn_aborted ||
+		(queryDesc->instrument_options & INSTRUMENT_ROWS) == 0)
+	{
+		if (prev_ExecutorRun_hook)
+			prev_ExecutorRun_hook(queryDesc, direction, count, execute_once);
+		else
+			standard_ExecutorRun(queryDesc, direction, count, execute_once);
+	}
+	else
+	{
+		PG_TRY();
+		{
+			if (prev_ExecutorRun_hook)
+				prev_ExecutorRun_hook(queryDesc, direction, count,
+									  execute_once);
+			else
+				standard_ExecutorRun(queryDesc, direction, count,
+									 execute_once);
+		}
+		PG_CATCH();
+		{
+			harvest_aborted_query(queryDesc);
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+	}
+
+	if (aqo_incomplete_nodes == AQO_INCOMPLETE_LEARN ||
+		queryDesc->planstate->instrument == NULL)
+		return;
+
+	enr = get_ENR(queryDesc->queryEnv, AQOPrivateData);
+	if (enr == NULL)
+		return;
+
+	/* A cursor could fetch the requested number of rows only. */
+	context = (QueryContextData *) enr->reldata;
+	context->stopped_early = (count != 0 &&
+							  queryDesc->estate->es_processed - processed >= count);
+	mark_incomplete_nodes(queryDesc->planstate, context->stopped_early);
+}
+
 /*
  * General hook which runs before ExecutorEnd and collects query execution
  * cardinality statistics.
@@ -620,11 +1260,13 @@ aqo_ExecutorEnd(QueryDesc *queryDesc)
 	double cardinality_error;
 	QueryStat *stat = NULL;
 	instr_time endtime;
+	instr_time starttime;
 	EphemeralNamedRelation enr = get_ENR(queryDesc->queryEnv, PlanStateInfo);
 	LOCKTAG tag;
 
 	cardinality_sum_errors = 0.;
 	cardinality_num_objects = 0;
+	replan_forget();
 
 	if (!ExtractFromQueryEnv(queryDesc))
 		/* AQO keep all query-related preferences at the query context.
@@ -635,6 +1277,8 @@ aqo_ExecutorEnd(QueryDesc *queryDesc)
 		 */
 		goto end;
 
+	/* Time of the learning below is an overhead of AQO. */
+	INSTR_TIME_SET_CURRENT(starttime);
 	njoins = (enr != NULL) ? *(int *) enr->reldata : -1;
 
 	Assert(!IsQueryDisabled());
@@ -644,12 +1288,18 @@ aqo_ExecutorEnd(QueryDesc *queryDesc)
 	{
 		query_context.learn_aqo = false;
 		query_context.collect_stat = false;
+		query_context.shadow = false;
 	}
 
-	if (query_context.learn_aqo ||
+	if (query_context.learn_aqo || query_context.shadow ||
 		(!query_context.learn_aqo && query_context.collect_stat))
 	{
-		aqo_obj_stat ctx = {NIL, NIL, NIL, query_context.learn_aqo};
+		aqo_obj_stat ctx = {NIL, NIL, NIL, query_context.learn_aqo, false};
+
+		/* Another cursor could be executed after the last run of this one. */
+		if (aqo_incomplete_nodes != AQO_INCOMPLETE_LEARN)
+			mark_incomplete_nodes(queryDesc->planstate,
+								  query_context.stopped_early);
 
 		/*
 		 * Analyze plan if AQO need to learn or need to collect statistics only.
@@ -658,9 +1308,21 @@ aqo_ExecutorEnd(QueryDesc *queryDesc)
 		list_free(ctx.clauselist);
 		list_free(ctx.relidslist);
 		list_free(ctx.selectivities);
+		mark_incomplete_nodes(NULL, false);
 	}
 
-	if (query_context.collect_stat)
+	/* Replan cached plans, if the learning has found them obsolete. */
+	replan_invalidate(query_context.query_hash);
+
+	if (query_context.shadow)
+		shadow_store(query_context.query_hash);
+
+	/*
+	 * A shadow execution is planned neither with AQO nor as the class would be
+	 * planned without the shadow mode. Don't let it into the statistics, the
+	 * auto tuning and the plan baselines of the class.
+	 */
+	if (query_context.collect_stat && !query_context.shadow)
 		stat = get_aqo_stat(query_context.query_hash);
 
 	{
@@ -713,6 +1375,9 @@ aqo_ExecutorEnd(QueryDesc *queryDesc)
 
 			/* Write AQO statistics to the aqo_query_stat table */
 			update_aqo_stat(query_context.fspace_hash, stat);
+
+			/* Capture or re-validate the plan baseline of the class. */
+			baseline_capture(queryDesc->plannedstmt, stat);
 			pfree_query_stat(stat);
 		}
 
@@ -728,6 +1393,17 @@ aqo_ExecutorEnd(QueryDesc *queryDesc)
 		LockRelease(&tag, ExclusiveLock, false);
 	}
 
+	if (!query_context.explain_only)
+	{
+		INSTR_TIME_SET_CURRENT(endtime);
+		fast_path_account(query_context.query_id,
+						  query_context.overhead_time +
+						  INSTR_TIME_GET_DOUBLE(endtime) -
+						  INSTR_TIME_GET_DOUBLE(starttime),
+						  INSTR_TIME_GET_DOUBLE(starttime) -
+						  INSTR_TIME_GET_DOUBLE(query_context.start_execution_time));
+	}
+
 	selectivity_cache_clear();
 	cur_classes = list_delete_int(cur_classes, query_context.query_hash);
 
@@ -741,6 +1417,9 @@ end:
 	 * standard_ExecutorEnd clears the queryDesc->planstate. After this point no
 	 * one operation with the plan can be made.
 	 */
+
+	/* Learn on the queries, aborted since the previous statement. */
+	learn_aborted_samples();
 }
 
 /*
@@ -927,6 +1606,18 @@ explain_print:
 	else
 		appendStringInfo(es->str, "AQO not used");
 
+	if (aqo_node->shadow_prediction > 0.)
+		appendStringInfo(es->str, ", shadow=%.0lf",
+						 aqo_node->shadow_prediction);
+
+	/* Rows of the node could be a part of the real cardinality. */
+	if (ps->instrument && is_incomplete_node(ps))
+		appendStringInfo(es->str, ", incomplete");
+
+	/* A refused prediction has a confidence too. */
+	if (aqo_show_confidence && aqo_node->confidence >= 0.)
+		appendStringInfo(es->str, ", confidence=%.2lf", aqo_node->confidence);
+
 explain_end:
 	/* XXX: Do we really have situations than plan is NULL? */
 	if (plan && aqo_show_hash)
@@ -988,4 +1679,18 @@ print_into_explain(PlannedStmt *plannedstmt, IntoClause *into,
 									query_context.query_hash, es);
 		ExplainPropertyInteger("JOINS", NULL, njoins, es);
 	}
+
+	if (query_context.use_baseline)
+	{
+		char *signature = baseline_signature(plannedstmt);
+
+		if (signature != NULL)
+			ExplainPropertyText("AQO baseline", signature, es);
+	}
+
+	if (query_context.budget_exhausted)
+		ExplainPropertyText("AQO budget",
+							psprintf("exhausted after %d predictions",
+									 query_context.npredictions),
+							es);
 }
@@ -41,11 +41,13 @@
  *		Learn linking strategy is the same as intelligent one. The only
  *		difference is the default settings for the new query type:
  *		auto tuning is disabled.
+ *		In both intelligent and learn modes a new query type can be added
+ *		only after a few executions (see admission.c).
  *		Disabled strategy means that AQO is disabled for all queries.
  * 3. For given query type we determine its query_hash, use_aqo, learn_aqo,
  *		fspace_hash and auto_tuning parameters.
- * 4. For given fspace_hash we may use its machine learning settings, but now
- *		the machine learning setting are fixed for all feature spaces.
+ * 4. For given fspace_hash we use its model of feature subspaces, set in the
+ *		aqo_fspace_settings table (see model.c).
  *
  *******************************************************************************
  *
@@ -60,17 +62,32 @@
 
 #include "access/parallel.h"
 #include "access/table.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_inherits.h"
 #include "commands/extension.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/syscache.h"
 
 #include "aqo.h"
+#include "admission.h"
+#include "aqo_shared.h"
+#include "aqo_snapshot.h"
+#include "baseline.h"
+#include "fast_path.h"
 #include "hash.h"
 #include "preprocessing.h"
 #include "profile_mem.h"
+#include "shadow.h"
 
 
 /* List of feature spaces, that are processing in this backend. */
 List *cur_classes = NIL;
 
+int aqo_skip_trivial_queries = AQO_SKIP_TRIVIAL_OFF;
+
+static void register_query_class(const char *query_string);
+static bool skip_trivial_query(Query *parse);
 static bool isQueryUsingSystemRelation(Query *query);
 static bool isQueryUsingSystemRelation_walker(Node *node, void *context);
 
@@ -139,8 +156,10 @@ aqo_planner(Query *parse,
 	bool		query_is_stored = false;
 	Datum		query_params[5];
 	bool		query_nulls[5] = {false, false, false, false, false};
-	LOCKTAG		tag;
+	bool		admission_pending = false;
+	PlannedStmt *stmt;
 	MemoryContext oldCxt;
+	instr_time	start;
 
 	 /*
 	  * We do not work inside an parallel worker now by reason of insert into
@@ -156,8 +175,9 @@ aqo_planner(Query *parse,
 		aqo_profile_enable <= 0) ||
 		strstr(application_name, "postgres_fdw") != NULL || /* Prevent distributed deadlocks */
 		strstr(application_name, "pgfdw:") != NULL || /* caused by fdw */
+		RecoveryInProgress() ||
 		isQueryUsingSystemRelation(parse) ||
-		RecoveryInProgress())
+		skip_trivial_query(parse))
 	{
 		/*
 		 * We should disable AQO for this query to remember this decision along
@@ -171,7 +191,27 @@ aqo_planner(Query *parse,
 									boundParams);
 	}
 
+	if (fast_path_check(parse->queryId))
+	{
+		/* AQO is too expensive for this query class. */
+		disable_aqo_for_query();
+		return call_default_planner(parse,
+									query_string,
+									cursorOptions,
+									boundParams);
+	}
+
+	INSTR_TIME_SET_CURRENT(start);
+	query_context.query_id = parse->queryId;
+	query_context.overhead_time = 0.;
+	query_context.npredictions = 0;
+	query_context.budget_exhausted = false;
+	query_context.use_baseline = false;
+	query_context.check_baseline = false;
+	query_context.shadow = false;
+
 	selectivity_cache_clear();
+	prediction_info_clear();
 	query_context.query_hash = get_query_hash(parse, query_string);
 
 	if (query_is_deactivated(query_context.query_hash) ||
@@ -203,8 +243,14 @@ aqo_planner(Query *parse,
 		goto ignore_query_settings;
 	}
 
-	query_is_stored = find_query(query_context.query_hash, &query_params[0],
-															&query_nulls[0]);
+	if (aqo_mode == AQO_MODE_FROZEN && snapshot_is_active())
+		/* Use the published image of the knowledge base. */
+		query_is_stored = snapshot_find_query(query_context.query_hash,
+											  &query_params[0],
+											  &query_nulls[0]);
+	else
+		query_is_stored = find_query(query_context.query_hash,
+									 &query_params[0], &query_nulls[0]);
 
 	if (!query_is_stored)
 	{
@@ -306,36 +352,33 @@ aqo_planner(Query *parse,
 		default:
 			elog(ERROR, "Unrecognized aqo mode %d", aqo_mode);
 		}
+
+		/* The bandit decides on each execution (see auto_tuning.c). */
+		if (query_context.auto_tuning)
+			query_context.use_aqo = auto_tuning_choose(query_context.query_hash,
+													   query_context.use_aqo);
 	}
 
-ignore_query_settings:
-	if (!query_is_stored && (query_context.adding_query || force_collect_stat))
+	if (!query_is_stored && query_context.adding_query && !force_collect_stat &&
+		!query_class_admitted(query_context.query_hash))
 	{
 		/*
-		 * find-add query and query text must be atomic operation to prevent
-		 * concurrent insertions.
-		 */
-		init_lock_tag(&tag, (uint32) query_context.query_hash, (uint32) 0);
-		LockAcquire(&tag, ExclusiveLock, false, false);
-		/*
-		 * Add query into the AQO knowledge base. To process an error with
-		 * concurrent addition from another backend we will try to restart
-		 * preprocessing routine.
-		 */
-		update_query(query_context.query_hash, query_context.fspace_hash,
-					 query_context.learn_aqo, query_context.use_aqo,
-					 query_context.auto_tuning);
-
-		/*
-		 * Add query text into the ML-knowledge base. Just for further
-		 * analysis. In the case of cached plans we could have NULL query text.
+		 * The class has not been seen enough times. Don't touch the knowledge
+		 * base for it. If the plan is expensive enough, we will admit the
+		 * class after the planning, so it must be planned in the same way as
+		 * a new class. Otherwise, don't waste time on the AQO machinery.
 		 */
-		if (query_string != NULL)
-			add_query_text(query_context.query_hash, query_string);
-
-		LockRelease(&tag, ExclusiveLock, false);
+		query_context.adding_query = false;
+		if (aqo_admission_cost_threshold > 0.)
+			admission_pending = true;
+		else
+			disable_aqo_for_query();
 	}
 
+ignore_query_settings:
+	if (!query_is_stored && (query_context.adding_query || force_collect_stat))
+		register_query_class(query_string);
+
 	if (force_collect_stat)
 	{
 		/*
@@ -353,14 +396,80 @@ ignore_query_settings:
 		 */
 		query_context.planning_time = 0.;
 
+	if (aqo_shadow_mode && query_context.use_aqo)
+	{
+		/* Predict, but plan by the default estimations (see shadow.c). */
+		query_context.shadow = true;
+		query_context.use_aqo = false;
+	}
+
+	/* A converged class can be planned by its baseline. */
+	baseline_prepare(parse);
+
 	if (!IsQueryDisabled())
+	{
 		/* It's good place to set timestamp of start of a planning process. */
 		INSTR_TIME_SET_CURRENT(query_context.start_planning_time);
 
-	return call_default_planner(parse,
+		/* Account time of the preprocessing as an overhead of AQO. */
+		query_context.overhead_time =
+			INSTR_TIME_GET_DOUBLE(query_context.start_planning_time) -
+			INSTR_TIME_GET_DOUBLE(start);
+	}
+
+	stmt = call_default_planner(parse,
 								query_string,
 								cursorOptions,
 								boundParams);
+	baseline_finish();
+
+	if (admission_pending)
+	{
+		if (stmt->planTree->total_cost >= aqo_admission_cost_threshold)
+		{
+			/* An expensive query. Start to learn on it immediately. */
+			query_context.adding_query = true;
+			register_query_class(query_string);
+			admission_forget(query_context.query_hash);
+		}
+		else
+			disable_aqo_for_query();
+	}
+
+	return stmt;
+}
+
+/*
+ * Add the new query class into the AQO knowledge base.
+ */
+static void
+register_query_class(const char *query_string)
+{
+	LOCKTAG		tag;
+
+	/*
+	 * find-add query and query text must be atomic operation to prevent
+	 * concurrent insertions.
+	 */
+	init_lock_tag(&tag, (uint32) query_context.query_hash, (uint32) 0);
+	LockAcquire(&tag, ExclusiveLock, false, false);
+	/*
+	 * Add query into the AQO knowledge base. To process an error with
+	 * concurrent addition from another backend we will try to restart
+	 * preprocessing routine.
+	 */
+	update_query(query_context.query_hash, query_context.fspace_hash,
+				 query_context.learn_aqo, query_context.use_aqo,
+				 query_context.auto_tuning);
+
+	/*
+	 * Add query text into the ML-knowledge base. Just for further
+	 * analysis. In the case of cached plans we could have NULL query text.
+	 */
+	if (query_string != NULL)
+		add_query_text(query_context.query_hash, query_string);
+
+	LockRelease(&tag, ExclusiveLock, false);
 }
 
 /*
@@ -376,11 +485,166 @@ disable_aqo_for_query(void)
 	query_context.collect_stat = false;
 	query_context.adding_query = false;
 	query_context.explain_only = false;
+	query_context.use_baseline = false;
+	query_context.check_baseline = false;
+	query_context.shadow = false;
 
 	INSTR_TIME_SET_ZERO(query_context.start_planning_time);
 	query_context.planning_time = -1.;
 }
 
+/*
+ * Check, that the query fetches rows of the relation by a unique key: the
+ * quals contain equalities of all the key columns of a unique index to
+ * constants or parameters. Such a query returns one row at most.
+ */
+static bool
+is_unique_lookup(Oid relid, int rtindex, Node *quals)
+{
+	Bitmapset  *attnos = NULL;
+	Relation	rel;
+	List	   *indexes;
+	ListCell   *lc;
+	bool		result = false;
+
+	foreach(lc, make_ands_implicit((Expr *) quals))
+	{
+		OpExpr *clause = (OpExpr *) lfirst(lc);
+		Node   *left;
+		Node   *right;
+		Var	   *var;
+
+		if (!is_opclause(clause) || list_length(clause->args) != 2 ||
+			get_oprrest(clause->opno) != F_EQSEL)
+			continue;
+
+		left = strip_implicit_coercions(linitial(clause->args));
+		right = strip_implicit_coercions(lsecond(clause->args));
+		if (!IsA(left, Var))
+		{
+			Node *tmp = left;
+
+			left = right;
+			right = tmp;
+		}
+
+		var = (Var *) left;
+		if (!IsA(var, Var) || var->varno != rtindex ||
+			var->varlevelsup != 0 || var->varattno <= 0 ||
+			!(IsA(right, Const) || IsA(right, Param)))
+			continue;
+
+		attnos = bms_add_member(attnos, var->varattno);
+	}
+
+	if (attnos == NULL)
+		return false;
+
+	/* The relation is locked by the parser yet. */
+	rel = table_open(relid, NoLock);
+	indexes = RelationGetIndexList(rel);
+	table_close(rel, NoLock);
+
+	foreach(lc, indexes)
+	{
+		HeapTuple		tuple;
+		Form_pg_index	index;
+		int				i;
+
+		tuple = SearchSysCache1(INDEXRELID, ObjectIdGetDatum(lfirst_oid(lc)));
+		if (!HeapTupleIsValid(tuple))
+			continue;
+
+		index = (Form_pg_index) GETSTRUCT(tuple);
+		if (index->indisunique && index->indisvalid &&
+			heap_attisnull(tuple, Anum_pg_index_indexprs, NULL) &&
+			heap_attisnull(tuple, Anum_pg_index_indpred, NULL))
+		{
+			for (i = 0; i < index->indnkeyatts; i++)
+				if (!bms_is_member(index->indkey.values[i], attnos))
+					break;
+
+			result = (i == index->indnkeyatts);
+		}
+		ReleaseSysCache(tuple);
+
+		if (result)
+			break;
+	}
+
+	list_free(indexes);
+	bms_free(attnos);
+	return result;
+}
+
+/*
+ * Examine the structure of a query, whose cardinalities are obvious to the
+ * standard estimator. Looks into the parse tree only, so the check is cheaper
+ * than a hashing of the query.
+ */
+static bool
+is_trivial_query(Query *parse)
+{
+	Node		   *node;
+	RangeTblEntry  *rte;
+	int				rtindex;
+
+	if (parse->cteList != NIL || parse->setOperations != NULL ||
+		parse->hasAggs || parse->hasWindowFuncs || parse->hasTargetSRFs ||
+		parse->hasSubLinks || parse->groupClause != NIL ||
+		parse->groupingSets != NIL || parse->distinctClause != NIL)
+		return false;
+
+	if (parse->jointree == NULL || parse->jointree->fromlist == NIL)
+		/* Nothing to scan, like INSERT ... VALUES (...) */
+		return true;
+
+	if (list_length(parse->jointree->fromlist) > 1)
+		return false;
+
+	node = (Node *) linitial(parse->jointree->fromlist);
+	if (!IsA(node, RangeTblRef))
+		/* A join */
+		return false;
+
+	rtindex = ((RangeTblRef *) node)->rtindex;
+	rte = rt_fetch(rtindex, parse->rtable);
+	if (rte->rtekind != RTE_RELATION || rte->relkind != RELKIND_RELATION ||
+		(rte->inh && has_subclass(rte->relid)))
+		return false;
+
+	if (aqo_skip_trivial_queries == AQO_SKIP_TRIVIAL_SINGLE)
+		return true;
+
+	return is_unique_lookup(rte->relid, rtindex, parse->jointree->quals);
+}
+
+/*
+ * Pre-filter of trivial queries. Runs before any hashing and lookups in the
+ * knowledge base, so a skipped query costs nothing more.
+ */
+static bool
+skip_trivial_query(Query *parse)
+{
+	if (aqo_skip_trivial_queries == AQO_SKIP_TRIVIAL_OFF ||
+		!is_trivial_query(parse))
+		return false;
+
+	aqo_shared_count(AQO_TRIVIAL_COUNTER);
+	return true;
+}
+
+PG_FUNCTION_INFO_V1(aqo_skipped_trivial_queries);
+
+/*
+ * Number of trivial queries, planned without AQO since the server start.
+ */
+Datum
+aqo_skipped_trivial_queries(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64((int64) aqo_shared_counter(AQO_TRIVIAL_COUNTER));
+}
+
 /*
  * Examine a fully-parsed query, and return TRUE iff any relation underlying
  * the query is a system relation.
@@ -391,22 +655,173 @@ isQueryUsingSystemRelation(Query *query)
 	return isQueryUsingSystemRelation_walker((Node *) query, NULL);
 }
 
+/*
+ * Backend-local classification of relations by their Oids. An entry is
+ * removed on the relcache invalidation of the relation, so a rename or a drop
+ * can't leave a stale classification.
+ */
+typedef struct RelClassEntry
+{
+	Oid		relid;		/* hash key */
+	bool	is_system;	/* catalog or AQO relation */
+} RelClassEntry;
+
+static HTAB *relclass_cache = NULL;
+
+/*
+ * Tables of the extension. The install scripts create them in the public
+ * schema, but aqo_ignorance lives in the schema of the extension.
+ */
+static const char *aqo_relnames[] = {
+	"aqo_data",
+	"aqo_query_texts",
+	"aqo_query_stat",
+	"aqo_queries",
+	"aqo_ignorance",
+	"aqo_fss_usage",
+	"aqo_plan_baselines",
+	"aqo_fspace_settings"
+};
+
+#define AQO_NRELATIONS	lengthof(aqo_relnames)
+
+/* Oids of the AQO tables, resolved once and reset by the relcache callback */
+static Oid	aqo_relids[AQO_NRELATIONS];
+static bool	aqo_relids_valid = false;
+static bool	aqo_relids_missed = false;
+
+static void
+relclass_invalidate(Datum arg, Oid relid)
+{
+	int		i;
+
+	if (!OidIsValid(relid))
+		aqo_relids_valid = false;
+	else if (aqo_relids_valid)
+	{
+		/*
+		 * A missed table can be created later (see aqo_ignorance), so any
+		 * invalidation can reveal it.
+		 */
+		if (aqo_relids_missed)
+			aqo_relids_valid = false;
+
+		for (i = 0; i < AQO_NRELATIONS; i++)
+			if (aqo_relids[i] == relid)
+				aqo_relids_valid = false;
+	}
+
+	if (relclass_cache == NULL)
+		return;
+
+	if (!OidIsValid(relid))
+	{
+		/* Invalidation of the whole relcache */
+		hash_destroy(relclass_cache);
+		relclass_cache = NULL;
+	}
+	else
+		(void) hash_search(relclass_cache, &relid, HASH_REMOVE, NULL);
+}
+
+/*
+ * Resolve Oids of the AQO tables. A user table with the same name in another
+ * schema isn't an AQO one.
+ */
+static void
+resolve_aqo_relids(void)
+{
+	Oid		nspid = InvalidOid;
+	Oid		public_nspid = InvalidOid;
+	int		i;
+
+	/* The callback, called during the lookups, will reset the flag. */
+	aqo_relids_valid = true;
+	aqo_relids_missed = false;
+
+	if (OidIsValid(get_extension_oid("aqo", true)))
+	{
+		nspid = get_aqo_schema();
+		public_nspid = get_namespace_oid("public", true);
+	}
+
+	for (i = 0; i < AQO_NRELATIONS; i++)
+	{
+		Oid		relid = InvalidOid;
+
+		if (OidIsValid(public_nspid))
+			relid = get_relname_relid(aqo_relnames[i], public_nspid);
+		if (!OidIsValid(relid) && OidIsValid(nspid))
+			relid = get_relname_relid(aqo_relnames[i], nspid);
+
+		aqo_relids[i] = relid;
+		if (!OidIsValid(relid))
+			aqo_relids_missed = true;
+	}
+}
+
 static bool
-IsAQORelation(Relation rel)
+IsAQORelation(Oid relid)
 {
-	char *relname = NameStr(rel->rd_rel->relname);
+	int		i;
+
+	if (!aqo_relids_valid)
+		resolve_aqo_relids();
 
-	if (strcmp(relname, "aqo_data") == 0 ||
-		strcmp(relname, "aqo_query_texts") == 0 ||
-		strcmp(relname, "aqo_query_stat") == 0 ||
-		strcmp(relname, "aqo_queries") == 0 ||
-		strcmp(relname, "aqo_ignorance") == 0
-	   )
-	   return true;
+	for (i = 0; i < AQO_NRELATIONS; i++)
+		if (aqo_relids[i] == relid)
+			return true;
 
 	return false;
 }
 
+/*
+ * Check, whether the relation is a catalog or an AQO one. Only the first check
+ * of a relation looks into the syscache, and no one takes a lock.
+ */
+static bool
+is_system_relation(Oid relid)
+{
+	static bool		callback_registered = false;
+	RelClassEntry  *entry;
+	bool			is_system;
+
+	if (relclass_cache == NULL)
+	{
+		HASHCTL ctl;
+
+		if (!callback_registered)
+		{
+			CacheRegisterRelcacheCallback(relclass_invalidate, (Datum) 0);
+			callback_registered = true;
+		}
+
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(RelClassEntry);
+		relclass_cache = hash_create("AQO classification of relations", 256,
+									 &ctl, HASH_ELEM | HASH_BLOBS);
+	}
+
+	entry = (RelClassEntry *) hash_search(relclass_cache, &relid,
+										  HASH_FIND, NULL);
+	if (entry != NULL)
+		return entry->is_system;
+
+	/*
+	 * Syscache access can accept invalidation messages, so the entry is
+	 * created after it.
+	 */
+	is_system = IsCatalogRelationOid(relid) || IsAQORelation(relid);
+
+	if (relclass_cache != NULL)
+	{
+		entry = (RelClassEntry *) hash_search(relclass_cache, &relid,
+											  HASH_ENTER, NULL);
+		entry->is_system = is_system;
+	}
+	return is_system;
+}
+
 static bool
 isQueryUsingSystemRelation_walker(Node *node, void *context)
 {
@@ -424,12 +839,7 @@ isQueryUsingSystemRelation_walker(Node *node, void *context)
 
 			if (rte->rtekind == RTE_RELATION)
 			{
-				Relation	rel = table_open(rte->relid, AccessShareLock);
-				bool		is_catalog = IsCatalogRelation(rel);
-				bool		is_aqo_rel = IsAQORelation(rel);
-
-				table_close(rel, AccessShareLock);
-				if (is_catalog || is_aqo_rel)
+				if (is_system_relation(rte->relid))
 					return true;
 			}
 			else if (rte->rtekind == RTE_FUNCTION)
@@ -4,6 +4,19 @@
 #include "nodes/pathnodes.h"
 #include "nodes/plannodes.h"
 
+/* Structural pre-filter of trivial queries */
+typedef enum
+{
+	/* Don't skip anything */
+	AQO_SKIP_TRIVIAL_OFF = 0,
+	/* Lookups of one relation by a unique key */
+	AQO_SKIP_TRIVIAL_UNIQUE,
+	/* Any query over one relation without aggregates and subqueries */
+	AQO_SKIP_TRIVIAL_SINGLE
+} AQOSkipTrivialQueries;
+
+extern int aqo_skip_trivial_queries;
+
 extern PlannedStmt *aqo_planner(Query *parse,
 								const char *query_string,
 								int cursorOptions,
@@ -0,0 +1,320 @@
+/*
+ *******************************************************************************
+ *
+ *	PREWARM OF THE AQO KNOWLEDGE BASE
+ *
+ * After a restart the shared cache of feature subspaces is empty, and the
+ * first planning of each query class pays for cold reads of the aqo_data
+ * table. This module provides a background worker which scans the knowledge
+ * base and loads the most frequently used feature subspaces into the shared
+ * cache (see fss_cache.c).
+ *
+ * The worker can be started at a postmaster startup (aqo.prewarm) or on demand
+ * by the aqo_prewarm() SQL function. It loads data by small batches and sleeps
+ * for aqo.prewarm_delay milliseconds between them to not compete with the
+ * production workload. Progress of the work is reported in the
+ * pg_stat_activity view.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/prewarm.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "commands/dbcommands.h"
+#include "commands/extension.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/snapmgr.h"
+
+#include "aqo.h"
+#include "fss_cache.h"
+#include "prewarm.h"
+
+
+/* Number of feature subspaces loaded by one transaction of the worker. */
+#define PREWARM_BATCH_SIZE	(64)
+
+bool	aqo_prewarm_enable = false;
+char	*aqo_bgworker_database = NULL;
+int		aqo_prewarm_delay = 10;
+
+typedef struct PrewarmItem
+{
+	int		fhash;
+	int		fss_hash;
+	int		ncols;
+} PrewarmItem;
+
+PG_FUNCTION_INFO_V1(aqo_prewarm);
+
+
+static void
+fill_worker_struct(BackgroundWorker *worker, Oid dbid)
+{
+	memset(worker, 0, sizeof(BackgroundWorker));
+	worker->bgw_flags = BGWORKER_SHMEM_ACCESS |
+						BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker->bgw_start_time = BgWorkerStart_ConsistentState;
+	worker->bgw_restart_time = BGW_NEVER_RESTART;
+	strcpy(worker->bgw_library_name, "aqo");
+	strcpy(worker->bgw_function_name, "aqo_prewarm_main");
+	snprintf(worker->bgw_name, BGW_MAXLEN, "aqo prewarm");
+	snprintf(worker->bgw_type, BGW_MAXLEN, "aqo prewarm");
+	worker->bgw_main_arg = ObjectIdGetDatum(dbid);
+}
+
+/*
+ * Register the static prewarm worker, if needed. Must be called from the
+ * _PG_init() routine.
+ */
+void
+prewarm_init(void)
+{
+	BackgroundWorker worker;
+
+	if (!aqo_prewarm_enable)
+		return;
+
+	if (aqo_fss_cache_size <= 0)
+	{
+		elog(WARNING, "AQO prewarm is disabled because aqo.fss_cache_size is zero");
+		return;
+	}
+
+	/* Static worker uses the aqo.bgworker_database to connect. */
+	fill_worker_struct(&worker, InvalidOid);
+	RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * Get list of feature subspaces to load, ordered by usage frequency of their
+ * feature spaces. We don't need more subspaces than the cache can contain.
+ * Returns NULL if the AQO extension isn't created in this database.
+ */
+static PrewarmItem *
+collect_fss_list(int *nitems, char **dbname)
+{
+	PrewarmItem	   *items = NULL;
+	char		   *query;
+	int				ret;
+	uint64			i;
+
+	*nitems = 0;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	*dbname = MemoryContextStrdup(TopMemoryContext,
+								  get_database_name(MyDatabaseId));
+
+	if (!OidIsValid(get_extension_oid("aqo", true)))
+	{
+		CommitTransactionCommand();
+		return NULL;
+	}
+
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "collecting feature subspaces");
+
+	query = psprintf(
+		"SELECT d.fspace_hash, d.fsspace_hash, d.nfeatures "
+		"FROM public.aqo_data d LEFT JOIN "
+		"(SELECT q.fspace_hash, "
+		"sum(s.executions_with_aqo + s.executions_without_aqo) AS execs "
+		"FROM public.aqo_queries q, public.aqo_query_stat s "
+		"WHERE q.query_hash = s.query_hash GROUP BY q.fspace_hash) u "
+		"ON d.fspace_hash = u.fspace_hash "
+		"WHERE d.nfeatures <= %d "
+		"ORDER BY u.execs DESC NULLS LAST LIMIT %d",
+		AQO_FSS_CACHE_MAX_FEATURES, aqo_fss_cache_size);
+
+	ret = SPI_execute(query, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "AQO prewarm: SPI_execute failed: error code %d", ret);
+
+	if (SPI_processed > 0)
+		items = (PrewarmItem *) MemoryContextAlloc(TopMemoryContext,
+									sizeof(PrewarmItem) * SPI_processed);
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple	tuple = SPI_tuptable->vals[i];
+		TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+		bool		isnull;
+
+		items[i].fhash = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+		items[i].fss_hash = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+		items[i].ncols = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+	}
+	*nitems = (int) SPI_processed;
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+
+	return items;
+}
+
+/*
+ * Load the feature subspace. load_fss() puts it into the shared cache.
+ */
+static bool
+prewarm_fss(PrewarmItem *item)
+{
+	double	  **matrix;
+	double	   *targets;
+	int			rows;
+	int			i;
+
+	matrix = palloc(sizeof(*matrix) * aqo_K);
+	for (i = 0; i < aqo_K; ++i)
+		matrix[i] = palloc0(sizeof(**matrix) * Max(item->ncols, 1));
+	targets = palloc(sizeof(*targets) * aqo_K);
+
+	return load_fss(item->fhash, item->fss_hash, item->ncols,
+					matrix, targets, &rows, NULL);
+}
+
+/*
+ * Entry point of the prewarm worker.
+ * main_arg contains Oid of a database to prewarm. InvalidOid means a static
+ * worker which connects to the aqo.bgworker_database.
+ */
+void
+aqo_prewarm_main(Datum main_arg)
+{
+	Oid				dbid = DatumGetObjectId(main_arg);
+	PrewarmItem	   *items;
+	char		   *dbname;
+	int				nitems;
+	int				loaded = 0;
+	int				i = 0;
+	bool			full = false;
+
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	if (OidIsValid(dbid))
+		BackgroundWorkerInitializeConnectionByOid(dbid, InvalidOid, 0);
+	else
+		BackgroundWorkerInitializeConnection(aqo_bgworker_database, NULL, 0);
+
+	items = collect_fss_list(&nitems, &dbname);
+	if (items == NULL)
+	{
+		elog(LOG, "AQO prewarm: nothing to load in database \"%s\"", dbname);
+		proc_exit(0);
+	}
+
+	while (i < nitems && !full)
+	{
+		int		end = Min(i + PREWARM_BATCH_SIZE, nitems);
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (ConfigReloadPending)
+		{
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+		PushActiveSnapshot(GetTransactionSnapshot());
+
+		for (; i < end; i++)
+		{
+			if (fss_cache_is_full())
+			{
+				full = true;
+				break;
+			}
+
+			if (prewarm_fss(&items[i]))
+				loaded++;
+		}
+
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+
+		pgstat_report_activity(STATE_RUNNING,
+							   psprintf("loaded %d of %d feature subspaces",
+										loaded, nitems));
+
+		/* Throttling */
+		if (aqo_prewarm_delay > 0 && i < nitems && !full)
+		{
+			(void) WaitLatch(MyLatch,
+							 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+							 aqo_prewarm_delay,
+							 PG_WAIT_EXTENSION);
+			ResetLatch(MyLatch);
+		}
+	}
+
+	pgstat_report_activity(STATE_IDLE, NULL);
+	elog(LOG, "AQO prewarm: %d of %d feature subspaces loaded in database \"%s\"%s",
+		 loaded, nitems, dbname,
+		 full ? ", the cache is full" : "");
+
+	pfree(items);
+	proc_exit(0);
+}
+
+/*
+ * Launch a prewarm worker for the current database.
+ * Returns pid of the worker.
+ */
+Datum
+aqo_prewarm(PG_FUNCTION_ARGS)
+{
+	BackgroundWorker		worker;
+	BackgroundWorkerHandle *handle;
+	BgwHandleStatus			status;
+	pid_t					pid;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("only superuser can launch the AQO prewarm worker")));
+
+	if (aqo_fss_cache_size <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("AQO feature subspaces cache is disabled"),
+				 errhint("Set aqo.fss_cache_size to a positive value and restart the server.")));
+
+	fill_worker_struct(&worker, MyDatabaseId);
+	worker.bgw_notify_pid = MyProcPid;
+
+	if (!RegisterDynamicBackgroundWorker(&worker, &handle))
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+				 errmsg("could not register background process"),
+				 errhint("You may need to increase max_worker_processes.")));
+
+	status = WaitForBackgroundWorkerStartup(handle, &pid);
+	if (status != BGWH_STARTED)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+				 errmsg("could not start background process"),
+				 errhint("More details may be available in the server log.")));
+
+	PG_RETURN_INT32(pid);
+}
@@ -0,0 +1,13 @@
+#ifndef PREWARM_H
+#define PREWARM_H
+
+#include "postgres.h"
+
+extern PGDLLIMPORT bool aqo_prewarm_enable;
+extern PGDLLIMPORT char *aqo_bgworker_database;
+extern PGDLLIMPORT int aqo_prewarm_delay;
+
+extern void prewarm_init(void);
+extern PGDLLEXPORT void aqo_prewarm_main(Datum main_arg);
+
+#endif /* PREWARM_H */
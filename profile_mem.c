@@ -4,17 +4,17 @@
 #include "miscadmin.h"
 
 #include "aqo.h"
+#include "aqo_shared.h"
 #include "profile_mem.h"
 
 
 int 	aqo_profile_classes;
 bool	aqo_profile_enable;
-bool	out_of_memory = false;
-static HTAB   *profile_mem_queries = NULL;
 
 typedef struct ProfileMemEntry
 {
 	int key;
+	pg_atomic_uint64 lru;
 	double time;
 	unsigned int counter;
 } ProfileMemEntry;
@@ -22,11 +22,9 @@ typedef struct ProfileMemEntry
 PG_FUNCTION_INFO_V1(aqo_show_classes);
 PG_FUNCTION_INFO_V1(aqo_clear_classes);
 
-shmem_startup_hook_type prev_shmem_startup_hook = NULL;
-
 /*
- * Check a state of shared memory allcated for classes buffer.
- * Warn user, if he want to enable profiling without shared memory at all.
+ * Check a size of the classes buffer.
+ * Warn user, if he want to enable profiling without a buffer at all.
  */
 bool
 check_aqo_profile_enable(bool *newval, void **extra, GucSource source)
@@ -37,9 +35,6 @@ check_aqo_profile_enable(bool *newval, void **extra, GucSource source)
 		return false;
 	}
 
-	/* If it isn't startup process, we should check a shared memory existence. */
-	Assert(!IsUnderPostmaster || !(*newval == true && !profile_mem_queries));
-
 	return true;
 }
 
@@ -49,7 +44,8 @@ check_aqo_profile_enable(bool *newval, void **extra, GucSource source)
 Datum
 aqo_show_classes(PG_FUNCTION_ARGS)
 {
-	HASH_SEQ_STATUS hash_seq;
+	dshash_table *htab;
+	dshash_seq_status hash_seq;
 	ProfileMemEntry *entry;
     TupleDesc tupdesc;
     AttInMetadata *attinmeta;
@@ -89,17 +85,22 @@ aqo_show_classes(PG_FUNCTION_ARGS)
 		PG_RETURN_VOID();
 	}
 
-	hash_seq_init(&hash_seq, profile_mem_queries);
-	while (((entry = (ProfileMemEntry *) hash_seq_search(&hash_seq)) != NULL))
+	htab = aqo_shared_table(AQO_PROFILE_TABLE, false);
+	if (htab != NULL)
 	{
-		Datum values[3];
-		bool  nulls[3] = {0, 0, 0};
-
-		values[0] = Int32GetDatum(entry->key);
-		values[1] = Float8GetDatum(entry->time);
-		values[2] = UInt32GetDatum(entry->counter);
-
-		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		dshash_seq_init(&hash_seq, htab, false);
+		while (((entry = (ProfileMemEntry *) dshash_seq_next(&hash_seq)) != NULL))
+		{
+			Datum values[3];
+			bool  nulls[3] = {0, 0, 0};
+
+			values[0] = Int32GetDatum(entry->key);
+			values[1] = Float8GetDatum(entry->time);
+			values[2] = UInt32GetDatum(entry->counter);
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+		dshash_seq_term(&hash_seq);
 	}
 
 	ReleaseTupleDesc(tupdesc);
@@ -114,32 +115,7 @@ aqo_show_classes(PG_FUNCTION_ARGS)
 long
 profile_clear_hash_table(void)
 {
-	HASH_SEQ_STATUS status;
-	ProfileMemEntry *entry;
-	long deleted;
-
-	Assert(aqo_profile_classes > 0);
-
-	/* callback only gets registered after creating the hash */
-	Assert(profile_mem_queries != NULL);
-	deleted = hash_get_num_entries(profile_mem_queries);
-
-	if (deleted == 0)
-		/* Fast path. Table is empty yet. */
-		return 0;
-
-	hash_seq_init(&status, profile_mem_queries);
-	while ((entry = (ProfileMemEntry *) hash_seq_search(&status)) != NULL)
-	{
-		if (hash_search(profile_mem_queries,
-						(void *) &entry->key,
-						HASH_REMOVE,
-						NULL) == NULL)
-			elog(ERROR, "AQO: hash table corrupted");
-	}
-
-	Assert(hash_get_num_entries(profile_mem_queries) == 0);
-	return deleted;
+	return aqo_shared_remove(AQO_PROFILE_TABLE, NULL, NULL);
 }
 
 Datum
@@ -167,18 +143,14 @@ update_profile_mem_table(double total_time)
 	if (aqo_profile_classes <= 0 || !aqo_profile_enable)
 		return;
 
-	Assert(profile_mem_queries);
-
-	pentry = (ProfileMemEntry *) hash_search(profile_mem_queries,
-											 &query_context.query_hash,
-											 HASH_ENTER_NULL, &found);
-
+	/*
+	 * If the buffer is full, the least recently used classes will be evicted.
+	 */
+	pentry = (ProfileMemEntry *) aqo_shared_insert(AQO_PROFILE_TABLE,
+												   &query_context.query_hash,
+												   &found);
 	if (pentry == NULL)
-	{
-		/* Out of memory. */
-		elog(LOG, "AQO: profiling buffer is full.");
 		return;
-	}
 
 	if (!found)
 	{
@@ -188,55 +160,14 @@ update_profile_mem_table(double total_time)
 
 	pentry->time += total_time;
 	pentry->counter++;
-}
-
-/*
- * Estimate shared memory space needed.
- */
-static Size
-profile_memsize(void)
-{
-	Size		size = 0;
-
-	Assert(aqo_profile_classes > 0);
-
-	size = add_size(size,
-					hash_estimate_size(aqo_profile_classes,
-					sizeof(ProfileMemEntry)));
-	return size;
+	aqo_shared_release(AQO_PROFILE_TABLE, pentry);
 }
 
 void
 profile_init(void)
 {
-	if (aqo_profile_classes <= 0)
-		return;
-
-	RequestAddinShmemSpace(profile_memsize());
+	aqo_shared_register_table(AQO_PROFILE_TABLE, "aqo_profile_mem_queries",
+							  sizeof(int), sizeof(ProfileMemEntry),
+							  offsetof(ProfileMemEntry, lru),
+							  &aqo_profile_classes);
 }
-
-/*
- * shmem_startup hook: allocate or attach to shared memory.
- * Allocate and initialize profiling-related shared memory, if not already
- * done, and set up backend-local pointer to that state.  Returns false if this
- * operation was failed.
- */
-void
-profile_shmem_startup(void)
-{
-	HASHCTL ctl;
-
-	if (prev_shmem_startup_hook)
-		prev_shmem_startup_hook();
-
-	if (aqo_profile_classes <= 0)
-		return;
-
-	ctl.keysize = sizeof(int);
-	ctl.entrysize = sizeof(ProfileMemEntry);
-	profile_mem_queries = ShmemInitHash("aqo_profile_mem_queries",
-										aqo_profile_classes,
-										aqo_profile_classes,
-										&ctl,
-										HASH_ELEM | HASH_BLOBS);
-}
\ No newline at end of file
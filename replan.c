@@ -0,0 +1,215 @@
+/*
+ *******************************************************************************
+ *
+ *	REPLANNING OF CACHED PLANS
+ *
+ * A prepared statement, which has settled on a generic plan, uses it until
+ * something invalidates the plan. The learning of AQO changes the knowledge
+ * base only, so the plan doesn't benefit from the learned cardinalities, even
+ * if they differ a lot from the estimations of the plan.
+ *
+ * Each plan node keeps the cardinality, predicted at planning time (see
+ * AQOPlanNode). When AQO learns on a plan, reused from a plan cache, it
+ * compares these predictions with the real cardinalities. If any of them
+ * differ more than aqo.replan_threshold times, AQO invalidates the relcache
+ * entries of the relations of the node. The plan cache drops all the plans,
+ * which depend on these relations, in all backends, and the next execution
+ * is planned with the learned cardinalities.
+ *
+ * It can invalidate other plans over the same relations, so the invalidation
+ * of each query class is done not more often than once per
+ * aqo.replan_interval seconds. Times of the last invalidations are stored in
+ * a shared table (see aqo_shared.c).
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/replan.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "optimizer/optimizer.h"
+#include "utils/inval.h"
+#include "utils/syscache.h"
+#include "utils/timestamp.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "replan.h"
+
+
+double	aqo_replan_threshold = 0.;
+int		aqo_replan_interval = 60;
+int		aqo_replan_size = 10000;
+
+typedef struct ReplanKey
+{
+	Oid		dbid;
+	int		qhash;
+} ReplanKey;
+
+typedef struct ReplanEntry
+{
+	ReplanKey			key;
+
+	pg_atomic_uint64	lru;
+	TimestampTz			last;	/* time of the last invalidation */
+} ReplanEntry;
+
+/* Relations of nodes with diverged cardinalities in the current plan */
+static List *replan_relids = NIL;
+static bool replan_callback = false;
+
+
+static inline void
+init_replan_key(ReplanKey *key, int qhash)
+{
+	memset(key, 0, sizeof(ReplanKey));
+	key->dbid = MyDatabaseId;
+	key->qhash = qhash;
+}
+
+/*
+ * Forget relations of the previous query. It could be aborted before
+ * replan_invalidate() was called.
+ */
+void
+replan_forget(void)
+{
+	list_free(replan_relids);
+	replan_relids = NIL;
+}
+
+static void
+replan_xact_callback(XactEvent event, void *arg)
+{
+	if (event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+		replan_forget();
+}
+
+/*
+ * Compare the cardinality of a node of the cached plan with the learned one.
+ */
+void
+replan_account(List *relids, double predicted, double learned)
+{
+	MemoryContext	oldCxt;
+	ListCell	   *lc;
+
+	/* Only a plan, reused from a plan cache, has no planning time. */
+	if (aqo_replan_threshold <= 0. || query_context.planning_time >= 0.)
+		return;
+
+	predicted = clamp_row_est(predicted);
+	learned = clamp_row_est(learned);
+	if (Max(predicted, learned) < aqo_replan_threshold * Min(predicted, learned))
+		return;
+
+	if (!replan_callback)
+	{
+		RegisterXactCallback(replan_xact_callback, NULL);
+		replan_callback = true;
+	}
+
+	oldCxt = MemoryContextSwitchTo(AQOMemoryContext);
+	foreach(lc, relids)
+		replan_relids = list_append_unique_oid(replan_relids,
+											   (Oid) lfirst_int(lc));
+	MemoryContextSwitchTo(oldCxt);
+}
+
+/*
+ * Check the limit of invalidations of the query class.
+ */
+static bool
+replan_allowed(int qhash)
+{
+	ReplanKey		key;
+	ReplanEntry	   *entry;
+	TimestampTz		now;
+	bool			found;
+	bool			allowed;
+
+	init_replan_key(&key, qhash);
+	entry = (ReplanEntry *) aqo_shared_insert(AQO_REPLAN_TABLE, &key, &found);
+	if (entry == NULL)
+		/* The shared table is disabled. */
+		return false;
+
+	now = GetCurrentStatementStartTimestamp();
+	allowed = (!found || aqo_replan_interval == 0 ||
+			   TimestampDifferenceExceeds(entry->last, now,
+										  aqo_replan_interval * 1000));
+	if (allowed)
+		entry->last = now;
+
+	aqo_shared_release(AQO_REPLAN_TABLE, entry);
+	return allowed;
+}
+
+/*
+ * Invalidate cached plans over the relations with diverged cardinalities.
+ * The invalidation is sent at commit of the transaction.
+ */
+void
+replan_invalidate(int qhash)
+{
+	ListCell *lc;
+
+	if (replan_relids == NIL)
+		return;
+
+	if (replan_allowed(qhash))
+	{
+		foreach(lc, replan_relids)
+		{
+			Oid		relid = lfirst_oid(lc);
+
+			/* Skip a relation, dropped since the planning. */
+			if (SearchSysCacheExists1(RELOID, ObjectIdGetDatum(relid)))
+				CacheInvalidateRelcacheByRelid(relid);
+		}
+
+		aqo_shared_count(AQO_REPLAN_COUNTER);
+		elog(DEBUG1, "AQO: cached plans of the query class %d are invalidated",
+			 qhash);
+	}
+
+	replan_forget();
+}
+
+PG_FUNCTION_INFO_V1(aqo_plan_invalidations);
+
+/*
+ * Number of invalidations of cached plans since the server start.
+ */
+Datum
+aqo_plan_invalidations(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64((int64) aqo_shared_counter(AQO_REPLAN_COUNTER));
+}
+
+/*
+ * Remove times of invalidations of the database. InvalidOid means all
+ * databases. Returns number of removed entries.
+ */
+long
+replan_reset(Oid dbid)
+{
+	return aqo_shared_remove_database(AQO_REPLAN_TABLE, dbid);
+}
+
+void
+replan_init(void)
+{
+	aqo_shared_register_table(AQO_REPLAN_TABLE, "aqo_replan",
+							  sizeof(ReplanKey), sizeof(ReplanEntry),
+							  offsetof(ReplanEntry, lru),
+							  &aqo_replan_size);
+}
@@ -0,0 +1,19 @@
+#ifndef REPLAN_H
+#define REPLAN_H
+
+#include "postgres.h"
+
+#include "nodes/pg_list.h"
+
+extern PGDLLIMPORT double aqo_replan_threshold;
+extern PGDLLIMPORT int aqo_replan_interval;
+extern PGDLLIMPORT int aqo_replan_size;
+
+extern void replan_account(List *relids, double predicted, double learned);
+extern void replan_invalidate(int qhash);
+extern void replan_forget(void);
+extern long replan_reset(Oid dbid);
+
+extern void replan_init(void);
+
+#endif /* REPLAN_H */
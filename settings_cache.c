@@ -0,0 +1,151 @@
+/*
+ *******************************************************************************
+ *
+ *	SHARED CACHE OF QUERY SETTINGS
+ *
+ * The planner hook looks up settings of each query class in the aqo_queries
+ * table. This module keeps recently used records of this table in a shared
+ * table (see aqo_shared.c).
+ *
+ * Only records inserted by committed transactions are cached, and any change
+ * of the record made by AQO removes it from the cache. Manual changes of the
+ * aqo_queries table are tracked by a trigger, which resets all cached records
+ * of the database.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/settings_cache.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "settings_cache.h"
+
+
+int		aqo_settings_cache_size = 1000;
+
+typedef struct SettingsCacheKey
+{
+	Oid		dbid;
+	int		qhash;
+} SettingsCacheKey;
+
+typedef struct SettingsCacheEntry
+{
+	SettingsCacheKey key;
+
+	pg_atomic_uint64 lru;
+	int			fspace_hash;
+	bool		learn_aqo;
+	bool		use_aqo;
+	bool		auto_tuning;
+} SettingsCacheEntry;
+
+
+static inline void
+init_cache_key(SettingsCacheKey *key, int qhash)
+{
+	memset(key, 0, sizeof(SettingsCacheKey));
+	key->dbid = MyDatabaseId;
+	key->qhash = qhash;
+}
+
+/*
+ * Search settings of the query class in the cache.
+ * Interface is the same as in the find_query() routine: values are returned in
+ * order of the aqo_queries columns. If values is NULL, just check an existence
+ * of the record.
+ */
+bool
+settings_cache_find(int qhash, Datum *values, bool *nulls)
+{
+	SettingsCacheKey	key;
+	SettingsCacheEntry *entry;
+
+	if (aqo_settings_cache_size <= 0)
+		return false;
+
+	init_cache_key(&key, qhash);
+	entry = (SettingsCacheEntry *) aqo_shared_find(AQO_SETTINGS_TABLE,
+												   &key, false);
+	if (entry == NULL)
+		return false;
+
+	if (values != NULL)
+	{
+		values[0] = Int32GetDatum(qhash);
+		values[1] = BoolGetDatum(entry->learn_aqo);
+		values[2] = BoolGetDatum(entry->use_aqo);
+		values[3] = Int32GetDatum(entry->fspace_hash);
+		values[4] = BoolGetDatum(entry->auto_tuning);
+		memset(nulls, 0, sizeof(bool) * 5);
+	}
+
+	aqo_shared_release(AQO_SETTINGS_TABLE, entry);
+	return true;
+}
+
+void
+settings_cache_store(int qhash, int fhash, bool learn_aqo, bool use_aqo,
+					 bool auto_tuning)
+{
+	SettingsCacheKey	key;
+	SettingsCacheEntry *entry;
+	bool				found;
+
+	if (aqo_settings_cache_size <= 0)
+		return;
+
+	init_cache_key(&key, qhash);
+	entry = (SettingsCacheEntry *) aqo_shared_insert(AQO_SETTINGS_TABLE,
+													 &key, &found);
+	if (entry == NULL)
+		return;
+
+	entry->fspace_hash = fhash;
+	entry->learn_aqo = learn_aqo;
+	entry->use_aqo = use_aqo;
+	entry->auto_tuning = auto_tuning;
+	aqo_shared_release(AQO_SETTINGS_TABLE, entry);
+}
+
+/*
+ * Remove the record from the cache. Called on any update of the record.
+ */
+void
+settings_cache_forget(int qhash)
+{
+	SettingsCacheKey key;
+
+	init_cache_key(&key, qhash);
+	(void) aqo_shared_delete(AQO_SETTINGS_TABLE, &key);
+}
+
+/*
+ * Remove all cached records, related to the database. InvalidOid means all
+ * databases.
+ * Return a number of removed entries. Just for info.
+ */
+long
+settings_cache_reset(Oid dbid)
+{
+	return aqo_shared_remove_database(AQO_SETTINGS_TABLE, dbid);
+}
+
+void
+settings_cache_init(void)
+{
+	aqo_shared_register_table(AQO_SETTINGS_TABLE, "aqo_settings_cache",
+							  sizeof(SettingsCacheKey),
+							  sizeof(SettingsCacheEntry),
+							  offsetof(SettingsCacheEntry, lru),
+							  &aqo_settings_cache_size);
+}
@@ -0,0 +1,16 @@
+#ifndef SETTINGS_CACHE_H
+#define SETTINGS_CACHE_H
+
+#include "postgres.h"
+
+extern PGDLLIMPORT int aqo_settings_cache_size;
+
+extern bool settings_cache_find(int qhash, Datum *values, bool *nulls);
+extern void settings_cache_store(int qhash, int fhash, bool learn_aqo,
+								 bool use_aqo, bool auto_tuning);
+extern void settings_cache_forget(int qhash);
+extern long settings_cache_reset(Oid dbid);
+
+extern void settings_cache_init(void);
+
+#endif /* SETTINGS_CACHE_H */
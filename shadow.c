@@ -0,0 +1,212 @@
+/*
+ *******************************************************************************
+ *
+ *	SHADOW MODE
+ *
+ * Before AQO is allowed to change plans of a query class, it is useful to know
+ * how good its predictions would be. In the shadow mode (see aqo.shadow_mode)
+ * the cardinality hooks make predictions as usual, but don't use them: the
+ * query is planned by the default estimations. Each plan node keeps both
+ * values (see AQOPlanNode).
+ *
+ * At the end of the execution AQO compares both values with the real
+ * cardinalities of the nodes. An error of a node is the absolute difference of
+ * logarithms, as in aqo_query_stat. Sums of the errors are accumulated per
+ * query class in a shared table, and aqo_shadow_report() shows the mean errors
+ * of the default estimator and of AQO.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/shadow.c
+ *
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "optimizer/optimizer.h"
+
+#include "aqo.h"
+#include "aqo_shared.h"
+#include "shadow.h"
+
+
+bool	aqo_shadow_mode = false;
+int		aqo_shadow_size = 10000;
+
+typedef struct ShadowKey
+{
+	Oid		dbid;
+	int		qhash;
+} ShadowKey;
+
+typedef struct ShadowEntry
+{
+	ShadowKey			key;
+
+	pg_atomic_uint64	lru;
+	int64				executions;
+	int64				nodes;
+	double				default_error;	/* sum of errors of the default estimator */
+	double				aqo_error;		/* sum of errors of the predictions */
+} ShadowEntry;
+
+/* Errors of the nodes of the current query */
+static double	shadow_default_error = 0.;
+static double	shadow_aqo_error = 0.;
+static int64	shadow_nodes = 0;
+
+
+static inline void
+init_shadow_key(ShadowKey *key, int qhash)
+{
+	memset(key, 0, sizeof(ShadowKey));
+	key->dbid = MyDatabaseId;
+	key->qhash = qhash;
+}
+
+/*
+ * Compare the default estimation and the unused prediction of a node with the
+ * real cardinality.
+ */
+void
+shadow_account(double predicted, double shadow, double learned)
+{
+	double	l = log(clamp_row_est(learned));
+
+	/* Without a prediction AQO uses the default estimation too. */
+	if (shadow <= 0.)
+		shadow = predicted;
+
+	shadow_default_error += fabs(log(clamp_row_est(predicted)) - l);
+	shadow_aqo_error += fabs(log(clamp_row_est(shadow)) - l);
+	shadow_nodes++;
+}
+
+/*
+ * Add errors of the executed query to the errors of its class.
+ */
+void
+shadow_store(int qhash)
+{
+	ShadowKey		key;
+	ShadowEntry	   *entry;
+	bool			found;
+
+	if (shadow_nodes == 0)
+		return;
+
+	init_shadow_key(&key, qhash);
+	entry = (ShadowEntry *) aqo_shared_insert(AQO_SHADOW_TABLE, &key, &found);
+	if (entry != NULL)
+	{
+		entry->executions++;
+		entry->nodes += shadow_nodes;
+		entry->default_error += shadow_default_error;
+		entry->aqo_error += shadow_aqo_error;
+		aqo_shared_release(AQO_SHADOW_TABLE, entry);
+	}
+
+	shadow_default_error = 0.;
+	shadow_aqo_error = 0.;
+	shadow_nodes = 0;
+}
+
+PG_FUNCTION_INFO_V1(aqo_shadow_report);
+
+/*
+ * Mean errors of the query classes of the current database, executed in the
+ * shadow mode. The improvement is a percentage of the error of the default
+ * estimator, which AQO would remove.
+ */
+Datum
+aqo_shadow_report(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupdesc;
+	Tuplestorestate	   *tupstore;
+	MemoryContext		oldcontext;
+	dshash_table	   *htab;
+	dshash_seq_status	hash_seq;
+	ShadowEntry		   *entry;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+	MemoryContextSwitchTo(oldcontext);
+
+	htab = aqo_shared_table(AQO_SHADOW_TABLE, false);
+	if (htab != NULL)
+	{
+		dshash_seq_init(&hash_seq, htab, false);
+		while ((entry = (ShadowEntry *) dshash_seq_next(&hash_seq)) != NULL)
+		{
+			Datum	values[6];
+			bool	nulls[6] = {0, 0, 0, 0, 0, 0};
+			double	default_error;
+			double	aqo_error;
+
+			if (entry->key.dbid != MyDatabaseId || entry->nodes <= 0)
+				continue;
+
+			default_error = entry->default_error / entry->nodes;
+			aqo_error = entry->aqo_error / entry->nodes;
+
+			values[0] = Int32GetDatum(entry->key.qhash);
+			values[1] = Int64GetDatum(entry->executions);
+			values[2] = Int64GetDatum(entry->nodes);
+			values[3] = Float8GetDatum(default_error);
+			values[4] = Float8GetDatum(aqo_error);
+			if (default_error > 0.)
+				values[5] = Float8GetDatum(100. * (default_error - aqo_error) /
+										   default_error);
+			else
+				nulls[5] = true;
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+		dshash_seq_term(&hash_seq);
+	}
+
+	tuplestore_donestoring(tupstore);
+	PG_RETURN_VOID();
+}
+
+/*
+ * Remove errors of the database. InvalidOid means all databases. Returns
+ * number of removed entries.
+ */
+long
+shadow_reset(Oid dbid)
+{
+	return aqo_shared_remove_database(AQO_SHADOW_TABLE, dbid);
+}
+
+void
+shadow_init(void)
+{
+	aqo_shared_register_table(AQO_SHADOW_TABLE, "aqo_shadow",
+							  sizeof(ShadowKey), sizeof(ShadowEntry),
+							  offsetof(ShadowEntry, lru),
+							  &aqo_shadow_size);
+}
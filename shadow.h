@@ -0,0 +1,15 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include "postgres.h"
+
+extern PGDLLIMPORT bool aqo_shadow_mode;
+extern PGDLLIMPORT int aqo_shadow_size;
+
+extern void shadow_account(double predicted, double shadow, double learned);
+extern void shadow_store(int qhash);
+extern long shadow_reset(Oid dbid);
+
+extern void shadow_init(void);
+
+#endif /* SHADOW_H */
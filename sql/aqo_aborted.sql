@@ -0,0 +1,29 @@
+CREATE EXTENSION aqo;
+CREATE TABLE abrt(x int);
+INSERT INTO abrt (x) (SELECT gs FROM generate_series(1, 1000) AS gs);
+ANALYZE abrt;
+
+SET aqo.mode = 'learn';
+SET aqo.show_details = true;
+SET max_parallel_workers_per_gather = 0;
+
+-- The query fails in the middle of the scan and isn't learned
+SELECT count(*) FROM abrt WHERE 1 / (x - 500) <= 0;
+EXPLAIN (COSTS OFF) SELECT count(*) FROM abrt WHERE 1 / (x - 500) <= 0;
+
+-- Rows, returned by the scan before the error, are learned as a lower bound
+-- at the end of the next statement
+SET aqo.learn_aborted = true;
+SELECT count(*) FROM abrt WHERE 1 / (x - 500) <= 0;
+SELECT 1;
+EXPLAIN (COSTS OFF) SELECT count(*) FROM abrt WHERE 1 / (x - 500) <= 0;
+
+-- The lower bound below the prediction doesn't change the knowledge
+SELECT count(*) FROM abrt WHERE 1 / (x - 200) <= 0;
+SELECT 1;
+EXPLAIN (COSTS OFF) SELECT count(*) FROM abrt WHERE 1 / (x - 200) <= 0;
+
+RESET aqo.learn_aborted;
+RESET max_parallel_workers_per_gather;
+DROP TABLE abrt;
+DROP EXTENSION aqo;
@@ -0,0 +1,33 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'intelligent';
+SET aqo.admission_threshold = 3;
+
+CREATE TABLE adm(x int);
+INSERT INTO adm (x) (SELECT * FROM generate_series(1, 1000) AS gs);
+ANALYZE adm;
+
+-- The query class is added only on its third execution
+SELECT count(*) FROM adm WHERE x < 10;
+SELECT count(*) FROM aqo_query_texts WHERE query_text LIKE '%FROM adm%';
+SELECT count(*) FROM adm WHERE x < 20;
+SELECT count(*) FROM aqo_query_texts WHERE query_text LIKE '%FROM adm%';
+SELECT count(*) FROM adm WHERE x < 30;
+SELECT count(*) FROM aqo_query_texts WHERE query_text LIKE '%FROM adm%';
+
+-- An expensive query is added immediately and learned on its first execution
+SET aqo.admission_threshold = 100;
+SET aqo.admission_cost_threshold = 1;
+SELECT count(*) FROM adm a1, adm a2 WHERE a1.x = a2.x;
+SELECT count(*) FROM aqo_query_texts WHERE query_text LIKE '%FROM adm%';
+SELECT count(*) > 0 AS learned FROM aqo_data d, aqo_query_texts t
+WHERE d.fspace_hash = t.query_hash AND t.query_text LIKE '%FROM adm a1%';
+
+-- A cheap one waits
+SET aqo.admission_cost_threshold = 1000000;
+SELECT count(*) FROM adm WHERE x > 10;
+SELECT count(*) FROM aqo_query_texts WHERE query_text LIKE '%FROM adm%';
+
+RESET aqo.admission_cost_threshold;
+RESET aqo.admission_threshold;
+DROP TABLE adm;
+DROP EXTENSION aqo;
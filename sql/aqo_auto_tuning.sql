@@ -0,0 +1,25 @@
+CREATE TABLE tun(x int);
+INSERT INTO tun (x) (SELECT gs FROM generate_series(1, 100) AS gs);
+ANALYZE tun;
+
+CREATE EXTENSION aqo;
+SET aqo.mode = 'intelligent';
+SET aqo.auto_tuning_method = 'thompson';
+
+-- Register the query class
+SELECT count(*) FROM tun WHERE x < 10;
+SELECT q.query_hash AS qhash, q.xmin::text AS x0
+FROM aqo_queries q JOIN aqo_query_texts t USING (query_hash)
+WHERE t.query_text LIKE 'SELECT count(*) FROM tun%' \gset
+
+-- Both choices are explored without writes to aqo_queries
+SELECT count(*) FROM tun WHERE x < 10;
+SELECT count(*) FROM tun WHERE x < 10;
+SELECT count(*) FROM tun WHERE x < 10;
+SELECT xmin::text = :'x0' AS unchanged, auto_tuning
+FROM aqo_queries WHERE query_hash = :qhash;
+SELECT executions_with_aqo, executions_without_aqo
+FROM aqo_query_stat WHERE query_hash = :qhash;
+
+DROP EXTENSION aqo;
+DROP TABLE tun;
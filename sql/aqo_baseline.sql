@@ -0,0 +1,38 @@
+CREATE EXTENSION aqo;
+CREATE TABLE blt(x int);
+INSERT INTO blt (x) (SELECT gs FROM generate_series(1, 100) AS gs);
+ANALYZE blt;
+
+SET aqo.mode = 'learn';
+SET aqo.show_details = true;
+SET aqo.plan_baselines = true;
+
+-- Learn the query class until convergence
+SELECT count(*) FROM blt WHERE x < 10;
+SELECT count(*) FROM blt WHERE x < 10;
+SELECT count(*) FROM blt WHERE x < 10;
+SELECT count(*) FROM blt WHERE x < 10;
+SELECT count(*) FROM blt WHERE x < 10;
+SELECT count(*) FROM blt WHERE x < 10;
+SELECT count(*) FROM blt WHERE x < 10;
+SELECT count(*) FROM blt WHERE x < 10;
+SELECT count(*) FROM blt WHERE x < 10;
+SELECT count(*) FROM blt WHERE x < 10;
+
+-- The converged plan is captured
+SELECT signature, pinned FROM aqo_plan_baselines;
+
+-- The planning is steered by the baseline without predictions
+EXPLAIN (COSTS OFF) SELECT count(*) FROM blt WHERE x < 10;
+
+SELECT aqo_pin_baseline(query_hash) FROM aqo_plan_baselines;
+SELECT signature, pinned FROM aqo_plan_baselines;
+SELECT aqo_drop_baseline(query_hash) FROM aqo_plan_baselines;
+SELECT aqo_drop_baseline(0);
+
+-- Without the baseline the query is planned by predictions
+EXPLAIN (COSTS OFF) SELECT count(*) FROM blt WHERE x < 10;
+
+RESET aqo.plan_baselines;
+DROP TABLE blt;
+DROP EXTENSION aqo;
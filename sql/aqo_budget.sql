@@ -0,0 +1,43 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'forced';
+SET aqo.show_details = true;
+SET enable_hashjoin = off;
+SET enable_mergejoin = off;
+SET enable_material = off;
+
+CREATE TABLE bgt(x int);
+CREATE TABLE bgd(x int);
+INSERT INTO bgt (x) (SELECT gs FROM generate_series(1, 1000) AS gs);
+INSERT INTO bgd (x) (SELECT gs FROM generate_series(1, 100) AS gs);
+ANALYZE bgt, bgd;
+
+SELECT count(*) FROM bgt, bgd WHERE bgt.x = bgd.x AND bgt.x < 10;
+EXPLAIN (COSTS OFF)
+	SELECT * FROM bgt, bgd WHERE bgt.x = bgd.x AND bgt.x < 10;
+
+SELECT aqo_exhausted_budgets() AS exhausted \gset
+
+-- All the predictions fit the budget
+SET aqo.prediction_budget = 3;
+EXPLAIN (COSTS OFF)
+	SELECT * FROM bgt, bgd WHERE bgt.x = bgd.x AND bgt.x < 10;
+
+-- The budget is exhausted in the middle of the join: the scans are predicted
+SET aqo.prediction_budget = 2;
+EXPLAIN (COSTS OFF)
+	SELECT * FROM bgt, bgd WHERE bgt.x = bgd.x AND bgt.x < 10;
+
+-- Preprocessing of any query takes more than a microsecond
+SET aqo.planning_budget = 1;
+EXPLAIN (COSTS OFF)
+	SELECT * FROM bgt, bgd WHERE bgt.x = bgd.x AND bgt.x < 10;
+
+RESET aqo.planning_budget;
+RESET aqo.prediction_budget;
+SELECT aqo_exhausted_budgets() - :exhausted AS exhausted;
+
+RESET enable_material;
+RESET enable_mergejoin;
+RESET enable_hashjoin;
+DROP TABLE bgt, bgd;
+DROP EXTENSION aqo;
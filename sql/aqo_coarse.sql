@@ -0,0 +1,35 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'forced';
+SET aqo.show_details = true;
+SET aqo.coarse_fallback = on;
+-- Use the coarser model as is
+SET aqo.coarse_confidence = 1;
+
+CREATE TABLE crs(x int, y int, z int);
+INSERT INTO crs (x, y, z)
+	(SELECT gs, gs, gs FROM generate_series(1, 100) AS gs);
+ANALYZE crs;
+
+SELECT count(*) FROM crs WHERE x < 10;
+
+-- The model of the clause on x is used with the selectivity of the new clause
+EXPLAIN (ANALYZE, VERBOSE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT * FROM crs WHERE x < 10 AND y < 50;
+
+-- A candidate with two missed clauses is rejected
+EXPLAIN (ANALYZE, VERBOSE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT * FROM crs WHERE x < 10 AND y > 50 AND z > 50;
+
+-- unless the limit allows it
+SET aqo.coarse_max_missing = 2;
+EXPLAIN (ANALYZE, VERBOSE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT * FROM crs WHERE x < 10 AND y > 50 AND z < 50;
+RESET aqo.coarse_max_missing;
+
+SET aqo.coarse_fallback = off;
+EXPLAIN (ANALYZE, VERBOSE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT * FROM crs WHERE x < 10 AND y > 50;
+
+RESET aqo.coarse_confidence;
+DROP TABLE crs;
+DROP EXTENSION aqo;
@@ -0,0 +1,44 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'forced';
+SET aqo.show_details = true;
+SET aqo.show_confidence = true;
+
+CREATE TABLE cnf(x int);
+INSERT INTO cnf (x) (SELECT gs FROM generate_series(1, 100) AS gs);
+ANALYZE cnf;
+
+SELECT count(*) FROM cnf WHERE x < 10;
+
+-- The learned point is predicted with full confidence
+EXPLAIN (COSTS OFF) SELECT * FROM cnf WHERE x < 10;
+
+-- Extrapolation far from the learned point
+EXPLAIN (COSTS OFF) SELECT * FROM cnf WHERE x < 90;
+
+SET aqo.confidence_blend_threshold = 0.5;
+EXPLAIN (COSTS OFF) SELECT * FROM cnf WHERE x < 90;
+
+SET aqo.confidence_refuse_threshold = 0.5;
+EXPLAIN (COSTS OFF) SELECT * FROM cnf WHERE x < 90;
+EXPLAIN (COSTS OFF) SELECT * FROM cnf WHERE x < 10;
+
+-- A refused prediction leaves the standard estimation
+CREATE FUNCTION plan_rows(query text) RETURNS int AS $$
+DECLARE
+	plan json;
+BEGIN
+	EXECUTE 'EXPLAIN (FORMAT JSON) ' || query INTO plan;
+	RETURN (plan->0->'Plan'->>'Plan Rows')::int;
+END;
+$$ LANGUAGE plpgsql;
+SELECT plan_rows('SELECT * FROM cnf WHERE x < 90') AS refused \gset
+SET aqo.mode = 'disabled';
+SELECT plan_rows('SELECT * FROM cnf WHERE x < 90') = :refused AS default_rows;
+SET aqo.mode = 'forced';
+
+RESET aqo.confidence_refuse_threshold;
+RESET aqo.confidence_blend_threshold;
+RESET aqo.show_confidence;
+DROP FUNCTION plan_rows;
+DROP TABLE cnf;
+DROP EXTENSION aqo;
@@ -0,0 +1,39 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'forced';
+SET aqo.show_details = true;
+SET aqo.drift_threshold = 0.5;
+
+CREATE TABLE drf(x int) WITH (autovacuum_enabled = off);
+INSERT INTO drf (x) (SELECT gs FROM generate_series(1, 100) AS gs);
+ANALYZE drf;
+SELECT pg_stat_force_next_flush();
+
+SELECT count(*) FROM drf WHERE x < 10;
+EXPLAIN (COSTS OFF) SELECT * FROM drf WHERE x < 10;
+
+-- Modifications below the threshold don't affect the model
+INSERT INTO drf (x) (SELECT 1000 + gs FROM generate_series(1, 30) AS gs);
+SELECT pg_stat_force_next_flush();
+EXPLAIN (COSTS OFF) SELECT * FROM drf WHERE x < 10;
+
+-- but they are accumulated up to the drift
+INSERT INTO drf (x) (SELECT 1000 + gs FROM generate_series(1, 30) AS gs);
+SELECT pg_stat_force_next_flush();
+EXPLAIN (COSTS OFF) SELECT * FROM drf WHERE x < 10;
+
+-- The model is learned from scratch
+SELECT count(*) FROM drf WHERE x < 10;
+EXPLAIN (COSTS OFF) SELECT * FROM drf WHERE x < 10;
+
+-- A massive delete is a drift too
+DELETE FROM drf WHERE x > 20;
+SELECT pg_stat_force_next_flush();
+EXPLAIN (COSTS OFF) SELECT * FROM drf WHERE x < 10;
+
+INSERT INTO drf (x) (SELECT gs FROM generate_series(1, 100) AS gs);
+SELECT pg_stat_force_next_flush();
+SELECT count(*) FROM drf WHERE x < 10;
+EXPLAIN (COSTS OFF) SELECT * FROM drf WHERE x < 10;
+
+DROP TABLE drf;
+DROP EXTENSION aqo;
@@ -0,0 +1,33 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'learn';
+
+CREATE TABLE ev(x int, y int);
+INSERT INTO ev (x, y) (SELECT gs, gs FROM generate_series(1, 100) AS gs);
+ANALYZE ev;
+
+SELECT count(*) FROM ev WHERE x < 10;
+SELECT count(*) FROM ev WHERE y < 10;
+SELECT count(*) FROM ev WHERE x < 10 AND y < 10;
+
+-- Don't learn on the service queries below
+SET aqo.mode = 'disabled';
+SELECT count(*) AS nfss FROM aqo_data \gset
+
+-- Nothing is evicted without limits, but usage is flushed
+SELECT aqo_evict();
+SELECT count(*) = :nfss AS same FROM aqo_data;
+SELECT count(*) = :nfss AS flushed FROM aqo_fss_usage;
+
+SET aqo.max_fss_per_fspace = 1;
+SELECT aqo_evict() = :nfss - 3 AS evicted;
+SELECT max(n) FROM (SELECT count(*) AS n FROM aqo_data GROUP BY fspace_hash) AS s;
+
+SET aqo.max_fss = 2;
+SELECT aqo_evict();
+SELECT count(*) FROM aqo_data;
+SELECT count(*) FROM aqo_fss_usage;
+
+RESET aqo.max_fss;
+RESET aqo.max_fss_per_fspace;
+DROP TABLE ev;
+DROP EXTENSION aqo;
@@ -0,0 +1,34 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'learn';
+
+CREATE TABLE exp(x int);
+INSERT INTO exp (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE exp;
+
+SELECT count(*) FROM exp WHERE x < 10;
+SELECT count(*) FROM exp WHERE x < 10;
+
+-- Don't learn on the service queries below
+SET aqo.mode = 'disabled';
+SELECT count(*) AS nqueries FROM aqo_queries \gset
+SELECT count(*) AS nfss FROM aqo_data \gset
+SELECT aqo_export('aqo_export.bin', true) AS nrecords \gset
+
+DELETE FROM aqo_queries WHERE query_hash <> 0;
+SELECT count(*) FROM aqo_data;
+
+SELECT aqo_import('aqo_export.bin', 'skip') = :nrecords AS imported;
+SELECT count(*) = :nqueries AS queries FROM aqo_queries;
+SELECT count(*) = :nfss AS fss FROM aqo_data;
+
+-- Merge of the same objects doesn't add new ones
+SELECT aqo_import('aqo_export.bin') = :nrecords AS imported;
+SELECT count(*) = :nfss AS fss FROM aqo_data;
+SELECT aqo_import('aqo_export.bin', 'replace') = :nrecords AS imported;
+SELECT count(*) = :nfss AS fss FROM aqo_data;
+
+SELECT aqo_import('aqo_export.bin', 'update');
+SELECT aqo_import('nonexistent.bin');
+
+DROP TABLE exp;
+DROP EXTENSION aqo;
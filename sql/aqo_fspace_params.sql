@@ -0,0 +1,35 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'forced';
+SET aqo.show_details = true;
+
+CREATE TABLE prm(x int) WITH (autovacuum_enabled = off);
+INSERT INTO prm (x) (SELECT gs FROM generate_series(1, 100) AS gs);
+ANALYZE prm;
+
+SELECT count(*) FROM prm WHERE x < 10;
+
+-- Change of the parameters keeps the learned data
+SELECT aqo_set_fspace_params(0, learning_rate => 1);
+SELECT k, learning_rate FROM aqo_fspace_settings WHERE fspace_hash = 0;
+EXPLAIN (COSTS OFF) SELECT * FROM prm WHERE x < 10;
+
+-- With the learning rate of 1 the nearest object is just replaced
+INSERT INTO prm (x) (SELECT gs FROM generate_series(1, 100) AS gs);
+SELECT count(*) FROM prm WHERE x < 10;
+EXPLAIN (COSTS OFF) SELECT * FROM prm WHERE x < 10;
+
+-- Reset to the defaults
+SELECT aqo_set_fspace_params(0);
+SELECT k IS NULL AND learning_rate IS NULL AS defaults
+FROM aqo_fspace_settings WHERE fspace_hash = 0;
+
+-- With k of 1 only the nearest object is used
+SELECT count(*) FROM prm WHERE x < 50;
+SELECT aqo_set_fspace_params(0, k => 1);
+EXPLAIN (COSTS OFF) SELECT * FROM prm WHERE x < 40;
+SELECT aqo_set_fspace_params(0);
+
+SELECT aqo_set_fspace_params(1, k => 100);
+
+DROP TABLE prm;
+DROP EXTENSION aqo;
@@ -0,0 +1,28 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'forced';
+SET aqo.show_details = true;
+SET aqo.show_confidence = true;
+SET aqo.hybrid_model = on;
+
+CREATE TABLE hyb(x int) WITH (autovacuum_enabled = off);
+INSERT INTO hyb (x) (SELECT gs FROM generate_series(1, 100) AS gs);
+ANALYZE hyb;
+
+SELECT count(*) FROM hyb WHERE x < 10;
+
+-- The standard estimation is a feature of the scan
+SELECT max(nfeatures) AS nfeatures FROM aqo_data WHERE fspace_hash = 0;
+EXPLAIN (COSTS OFF) SELECT * FROM hyb WHERE x < 10;
+
+-- The standard estimation grows with the table, and the learned object is
+-- farther from the new one than the selectivities tell
+INSERT INTO hyb (x) (SELECT gs FROM generate_series(101, 1000) AS gs);
+EXPLAIN (COSTS OFF) SELECT * FROM hyb WHERE x < 10;
+
+-- Hybrid models aren't used by the basic ones
+SET aqo.hybrid_model = off;
+EXPLAIN (COSTS OFF) SELECT * FROM hyb WHERE x < 10;
+
+RESET aqo.show_confidence;
+DROP TABLE hyb;
+DROP EXTENSION aqo;
@@ -0,0 +1,27 @@
+CREATE EXTENSION aqo;
+CREATE TABLE inc(x int);
+INSERT INTO inc (x) (SELECT gs FROM generate_series(1, 1000) AS gs);
+ANALYZE inc;
+
+SET aqo.mode = 'learn';
+SET aqo.show_details = true;
+SET max_parallel_workers_per_gather = 0;
+
+-- The scan is stopped by the LIMIT and isn't learned
+SET aqo.incomplete_nodes = 'skip';
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x FROM inc WHERE x % 2 = 0 LIMIT 100;
+EXPLAIN (COSTS OFF) SELECT x FROM inc WHERE x % 2 = 0 LIMIT 100;
+
+-- Rows of the scan are learned as a lower bound of its cardinality
+SET aqo.incomplete_nodes = 'lower_bound';
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x FROM inc WHERE x % 2 = 0 LIMIT 100;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x FROM inc WHERE x % 2 = 0 LIMIT 50;
+EXPLAIN (COSTS OFF) SELECT x FROM inc WHERE x % 2 = 0 LIMIT 50;
+
+RESET aqo.incomplete_nodes;
+RESET max_parallel_workers_per_gather;
+DROP TABLE inc;
+DROP EXTENSION aqo;
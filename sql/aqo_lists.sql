@@ -0,0 +1,58 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'learn';
+SET aqo.normalize_lists = on;
+
+CREATE TABLE lst(x int, y text);
+INSERT INTO lst (x, y) (SELECT gs, 'v' || gs FROM generate_series(1, 100) AS gs);
+ANALYZE lst;
+
+-- IN-lists of any length belong to the same query class
+SELECT count(*) FROM lst WHERE x IN (1, 2);
+SELECT count(*) FROM lst WHERE x IN (1, 2, 3, 4, 5);
+SELECT count(*) FROM lst WHERE x IN (10, 20, 30, 40, 50, 60, 70);
+
+-- The same for VALUES lists
+SELECT count(*) FROM (VALUES (1, 'a'), (2, 'b')) AS v(a, b);
+SELECT count(*) FROM (VALUES (1, 'a'), (2, 'b'), (3, 'c')) AS v(a, b);
+
+SELECT count(*) FROM aqo_query_texts WHERE query_text LIKE '%lst WHERE x IN%';
+SELECT count(*) FROM aqo_query_texts WHERE query_text LIKE '%FROM (VALUES%';
+
+-- But lists of expressions are distinguished
+SELECT count(*) FROM lst WHERE x IN (1, 2 + x);
+SELECT count(*) FROM aqo_query_texts WHERE query_text LIKE '%lst WHERE x IN%';
+
+-- Length of the list as a feature
+SET aqo.list_length_feature = on;
+SELECT count(*) FROM lst WHERE y IN ('v1', 'v2');
+SELECT count(*) FROM lst WHERE y IN ('v1', 'v2', 'v3');
+SELECT max(d.nfeatures) AS nfeatures FROM aqo_data d, aqo_query_texts t
+WHERE d.fspace_hash = t.query_hash AND t.query_text LIKE '%lst WHERE y IN%';
+
+RESET aqo.list_length_feature;
+
+-- Lists of parameters of prepared statements too
+PREPARE lst2(int, int) AS SELECT count(*) FROM lst WHERE x IN ($1, $2);
+PREPARE lst4(int, int, int, int) AS
+	SELECT count(*) FROM lst WHERE x IN ($1, $2, $3, $4);
+EXECUTE lst2(1, 2);
+EXECUTE lst4(1, 2, 3, 4);
+PREPARE lsv2(varchar, varchar) AS SELECT count(*) FROM lst WHERE y IN ($1, $2);
+PREPARE lsv3(varchar, varchar, varchar) AS
+	SELECT count(*) FROM lst WHERE y IN ($1, $2, $3);
+EXECUTE lsv2('v1', 'v2');
+EXECUTE lsv3('v1', 'v2', 'v3');
+SELECT count(*) FROM aqo_query_texts WHERE query_text LIKE 'PREPARE%';
+
+-- Feature subspaces of generic plans don't depend on the list length either
+SET plan_cache_mode = force_generic_plan;
+EXECUTE lst2(1, 2);
+SELECT count(*) AS nfss FROM aqo_data \gset
+EXECUTE lst4(1, 2, 3, 4);
+SELECT count(*) - :nfss AS new_subspaces FROM aqo_data;
+RESET plan_cache_mode;
+DEALLOCATE ALL;
+RESET aqo.normalize_lists;
+
+DROP TABLE lst;
+DROP EXTENSION aqo;
@@ -0,0 +1,34 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'forced';
+SET aqo.show_details = true;
+
+CREATE TABLE mdl(x int);
+INSERT INTO mdl (x) (SELECT gs FROM generate_series(1, 1000) AS gs);
+ANALYZE mdl;
+
+INSERT INTO aqo_fspace_settings (fspace_hash, model) VALUES (0, 'linear');
+SELECT count(*) FROM mdl WHERE x < 10;
+EXPLAIN (COSTS OFF) SELECT * FROM mdl WHERE x < 10;
+
+-- Subspaces of the linear model aren't used by the OkNNr one
+DELETE FROM aqo_fspace_settings;
+EXPLAIN (COSTS OFF) SELECT * FROM mdl WHERE x < 10;
+
+-- Feature spaces without settings use the default model
+SET aqo.model = 'linear';
+EXPLAIN (COSTS OFF) SELECT * FROM mdl WHERE x < 10;
+
+-- Each learning step halves the error of the linear model
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT * FROM mdl WHERE x < 500;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT * FROM mdl WHERE x < 500;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT * FROM mdl WHERE x < 500;
+EXPLAIN (COSTS OFF) SELECT * FROM mdl WHERE x < 500;
+RESET aqo.model;
+
+INSERT INTO aqo_fspace_settings (fspace_hash, model) VALUES (0, 'svm');
+
+DROP TABLE mdl;
+DROP EXTENSION aqo;
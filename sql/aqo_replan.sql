@@ -0,0 +1,29 @@
+CREATE EXTENSION aqo;
+CREATE TABLE rpl(x int);
+INSERT INTO rpl (x) (SELECT gs FROM generate_series(1, 100) AS gs);
+ANALYZE rpl;
+
+SET aqo.mode = 'learn';
+SET aqo.show_details = true;
+SET aqo.replan_threshold = 2;
+SET plan_cache_mode = 'force_generic_plan';
+SELECT aqo_plan_invalidations() AS invalidations \gset
+
+-- The generic plan estimates a third of the table
+PREPARE q(int) AS SELECT count(*) FROM rpl WHERE x < $1;
+EXECUTE q(10);
+EXPLAIN (COSTS OFF) EXECUTE q(10);
+
+-- The cached plan diverges from the learned cardinality and is replanned
+EXECUTE q(10);
+EXECUTE q(10);
+EXPLAIN (COSTS OFF) EXECUTE q(10);
+EXECUTE q(10);
+
+SELECT aqo_plan_invalidations() - :invalidations AS invalidations;
+
+DEALLOCATE q;
+RESET plan_cache_mode;
+RESET aqo.replan_threshold;
+DROP TABLE rpl;
+DROP EXTENSION aqo;
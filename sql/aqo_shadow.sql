@@ -0,0 +1,29 @@
+CREATE EXTENSION aqo;
+CREATE TABLE shd(x int);
+INSERT INTO shd (x) (SELECT gs FROM generate_series(1, 1000) AS gs);
+ANALYZE shd;
+
+SET aqo.mode = 'learn';
+SET aqo.show_details = true;
+SET max_parallel_workers_per_gather = 0;
+
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x FROM shd WHERE x % 3 = 0;
+
+-- The prediction is made, but the query is planned by the default estimation
+SET aqo.shadow_mode = on;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x FROM shd WHERE x % 3 = 0;
+RESET aqo.shadow_mode;
+
+SELECT executions, nodes, round(error_default::numeric, 2) AS error_default,
+	   round(error_aqo::numeric, 2) AS error_aqo,
+	   round(improvement::numeric) AS improvement
+FROM aqo_shadow_report();
+
+SELECT aqo_cache_reset() > 0;
+SELECT count(*) FROM aqo_shadow_report();
+
+RESET max_parallel_workers_per_gather;
+DROP TABLE shd;
+DROP EXTENSION aqo;
@@ -0,0 +1,30 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'learn';
+SET aqo.show_details = true;
+SET aqo.shared_fss = on;
+SET aqo.shared_fss_sample_rate = 1;
+
+CREATE TABLE shr(x int);
+INSERT INTO shr (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE shr;
+
+EXPLAIN (ANALYZE, VERBOSE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x FROM shr WHERE x < 10;
+SELECT count(*) > 0 AS shared FROM aqo_data WHERE fspace_hash = -1;
+SELECT query_text FROM aqo_query_texts WHERE query_hash = -1;
+
+-- The pool is separate from the COMMON feature space
+SELECT count(*) AS common FROM aqo_data WHERE fspace_hash = 0;
+
+-- A new query class uses the shared subspace on its first execution
+EXPLAIN (ANALYZE, VERBOSE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x, x FROM shr WHERE x < 10;
+
+-- Without the pool it doesn't
+SET aqo.shared_fss = off;
+EXPLAIN (ANALYZE, VERBOSE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x, x, x FROM shr WHERE x < 10;
+
+RESET aqo.shared_fss_sample_rate;
+DROP TABLE shr;
+DROP EXTENSION aqo;
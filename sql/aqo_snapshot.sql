@@ -0,0 +1,29 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'learn';
+SET aqo.show_details = true;
+
+CREATE TABLE snap(x int);
+INSERT INTO snap (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE snap;
+
+EXPLAIN (ANALYZE, VERBOSE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x FROM snap;
+EXPLAIN (ANALYZE, VERBOSE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x FROM snap;
+
+SELECT aqo_publish_snapshot() > 0 AS published;
+
+-- The image doesn't depend on the knowledge base tables
+DELETE FROM aqo_data;
+SET aqo.mode = 'frozen';
+EXPLAIN (ANALYZE, VERBOSE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x FROM snap;
+
+-- Without the image AQO uses the tables again
+SELECT aqo_drop_snapshot();
+SELECT aqo_drop_snapshot();
+EXPLAIN (ANALYZE, VERBOSE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+	SELECT x FROM snap;
+
+DROP TABLE snap;
+DROP EXTENSION aqo;
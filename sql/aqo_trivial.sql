@@ -0,0 +1,40 @@
+CREATE EXTENSION aqo;
+SET aqo.mode = 'forced';
+SET aqo.skip_trivial_queries = 'unique';
+
+CREATE TABLE trv(id int PRIMARY KEY, x int);
+CREATE TABLE trv2(a int, b int, UNIQUE (a, b));
+INSERT INTO trv (id, x) (SELECT gs, gs FROM generate_series(1, 100) AS gs);
+
+-- A query without relations is trivial, so reading of the counter is counted.
+SELECT aqo_skipped_trivial_queries() AS skipped \gset
+
+-- Lookups by a unique key are skipped
+SELECT x FROM trv WHERE id = 1;
+UPDATE trv SET x = x + 1 WHERE id = 2;
+DELETE FROM trv WHERE 3 = id;
+INSERT INTO trv (id, x) VALUES (101, 101);
+SELECT * FROM trv2 WHERE a = 1 AND b = 1;
+
+-- Other queries aren't skipped
+SELECT * FROM trv2 WHERE a = 1;
+SELECT count(*) FROM trv WHERE id = 1;
+SELECT t1.x FROM trv t1, trv t2 WHERE t1.id = 1 AND t2.id = 1;
+SELECT x FROM trv WHERE id = (SELECT 1);
+SELECT count(*) FROM trv WHERE x < 10;
+
+SELECT aqo_skipped_trivial_queries() - :skipped AS skipped;
+
+-- Any query over one relation is skipped in the 'single' mode
+SET aqo.skip_trivial_queries = 'single';
+SELECT aqo_skipped_trivial_queries() AS skipped \gset
+SELECT * FROM trv2 WHERE a = 1;
+SELECT x FROM trv WHERE x < 3;
+SELECT count(*) FROM trv WHERE x < 10;
+SELECT t1.x FROM trv t1, trv t2 WHERE t1.id = t2.x AND t1.id = 1;
+-- Queries over AQO tables aren't planned by AQO at all, so aren't counted
+SELECT fspace_hash FROM aqo_queries WHERE query_hash = 0;
+SELECT aqo_skipped_trivial_queries() - :skipped AS skipped;
+
+DROP TABLE trv, trv2;
+DROP EXTENSION aqo;
@@ -140,4 +140,39 @@ SELECT count(*) FROM aqo_query_stat WHERE
         aqo_queries.fspace_hash = ANY(SELECT aqo_data.fspace_hash FROM aqo_data WHERE :b_oid=ANY(oids)) AND
             aqo_queries.fspace_hash = aqo_queries.query_hash);
 
+-- Data of a dropped table is removed without a manual cleanup
+CREATE TABLE c(x int);
+SELECT count(*) FROM c;
+SELECT 'c'::regclass::oid AS c_oid \gset
+SELECT count(*) > 0 AS learned FROM aqo_data WHERE :c_oid=ANY(oids);
+DROP TABLE c;
+SELECT count(*) FROM aqo_data WHERE :c_oid=ANY(oids);
+
+-- The same, if the automatic cleanup is disabled
+SET aqo.cleanup_dropped = 'off';
+CREATE TABLE c(x int);
+SELECT count(*) FROM c;
+SELECT 'c'::regclass::oid AS c_oid \gset
+DROP TABLE c;
+SELECT count(*) > 0 AS remain FROM aqo_data WHERE :c_oid=ANY(oids);
+SELECT clean_aqo_data();
+SELECT count(*) FROM aqo_data WHERE :c_oid=ANY(oids);
+RESET aqo.cleanup_dropped;
+
+-- A user without rights on the AQO tables drops a table
+CREATE ROLE regress_aqo_cleanup;
+CREATE SCHEMA regress_aqo_cleanup AUTHORIZATION regress_aqo_cleanup;
+SET ROLE regress_aqo_cleanup;
+CREATE TABLE regress_aqo_cleanup.c(x int);
+SELECT count(*) FROM regress_aqo_cleanup.c;
+SELECT 'regress_aqo_cleanup.c'::regclass::oid AS c_oid \gset
+RESET ROLE;
+SELECT count(*) > 0 AS learned FROM aqo_data WHERE :c_oid=ANY(oids);
+SET ROLE regress_aqo_cleanup;
+DROP TABLE regress_aqo_cleanup.c;
+RESET ROLE;
+SELECT count(*) FROM aqo_data WHERE :c_oid=ANY(oids);
+DROP SCHEMA regress_aqo_cleanup;
+DROP ROLE regress_aqo_cleanup;
+
 DROP EXTENSION aqo;
\ No newline at end of file
@@ -17,6 +17,10 @@ CREATE TABLE test (id SERIAL, data TEXT);
 INSERT INTO test (data) VALUES ('string');
 SELECT * FROM test;
 
+-- A user table with the name of an AQO table isn't a service relation
+CREATE TABLE aqo_data (id int);
+SELECT count(*) FROM aqo_data;
+
 -- Check AQO service relations state after some manipulations
 -- Exclude fields with hash values from the queries. Hash is depend on
 -- nodefuncs code which is highly PostgreSQL version specific.
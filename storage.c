@@ -20,10 +20,18 @@
 #include "access/heapam.h"
 #include "access/table.h"
 #include "access/tableam.h"
+#include "catalog/index.h"
+#include "executor/executor.h"
+#include "utils/timestamp.h"
 
 #include "aqo.h"
+#include "aqo_snapshot.h"
+#include "baseline.h"
+#include "eviction.h"
+#include "fss_cache.h"
 #include "preprocessing.h"
 #include "profile_mem.h"
+#include "settings_cache.h"
 
 
 HTAB *deactivated_queries = NULL;
@@ -38,6 +46,8 @@ static void deform_vector(Datum datum, double *vector, int *nelems);
 #define DeformVectorSz(datum, v_name)	(deform_vector((datum), (v_name), &(v_name ## _size)))
 
 
+static void insert_other_indexes(Relation hrel, Relation irel,
+								 HeapTuple tuple);
 static bool my_simple_heap_update(Relation relation,
 								  ItemPointer otid,
 								  HeapTuple tup,
@@ -65,12 +75,16 @@ open_aqo_relation(char *heaprelnspname, char *heaprelname,
 		 * Absence of any AQO-related table tell us that someone executed
 		 * a 'DROP EXTENSION aqo' command. We disable AQO for all future queries
 		 * in this backend. For performance reasons we do it locally.
-		 * Clear profiling hash table.
+		 * Clear profiling hash table and shared caches of the database.
 		 * Also, we gently disable AQO for the rest of the current query
 		 * execution process.
 		 */
 		aqo_enabled = false;
 		(void) profile_clear_hash_table();
+		(void) fss_cache_reset(MyDatabaseId);
+		(void) settings_cache_reset(MyDatabaseId);
+		(void) snapshot_drop(MyDatabaseId);
+		(void) fss_usage_reset(MyDatabaseId);
 		disable_aqo_for_query();
 
 		return false;
@@ -86,6 +100,9 @@ open_aqo_relation(char *heaprelnspname, char *heaprelname,
  *
  * Use dirty snapshot to see all (include in-progess) data. We want to prevent
  * wait in the XactLockTableWait routine.
+ *
+ * Records of committed transactions are stored into the shared settings cache
+ * and the next search of the query doesn't need an access to the table.
  */
 bool
 find_query(int qhash, Datum *search_values, bool *search_nulls)
@@ -100,6 +117,9 @@ find_query(int qhash, Datum *search_values, bool *search_nulls)
 	SnapshotData snap;
 	bool		find_ok = false;
 
+	if (settings_cache_find(qhash, search_values, search_nulls))
+		return true;
+
 	if (!open_aqo_relation("public", "aqo_queries", "aqo_queries_query_hash_idx",
 		AccessShareLock, &hrel, &irel))
 		return false;
@@ -117,6 +137,20 @@ find_query(int qhash, Datum *search_values, bool *search_nulls)
 		tuple = ExecFetchSlotHeapTuple(slot, true, &shouldFree);
 		Assert(shouldFree != true);
 		heap_deform_tuple(tuple, hrel->rd_att, search_values, search_nulls);
+
+		/*
+		 * Cache the record only if no one in-progress transaction (include
+		 * our own) inserted or deleted it.
+		 */
+		if (!TransactionIdIsValid(snap.xmin) &&
+			!TransactionIdIsValid(snap.xmax) &&
+			!TransactionIdIsCurrentTransactionId(
+									HeapTupleHeaderGetXmin(tuple->t_data)))
+			settings_cache_store(qhash,
+								 DatumGetInt32(search_values[3]),
+								 DatumGetBool(search_values[1]),
+								 DatumGetBool(search_values[2]),
+								 DatumGetBool(search_values[4]));
 	}
 
 	ExecDropSingleTupleTableSlot(slot);
@@ -127,6 +161,226 @@ find_query(int qhash, Datum *search_values, bool *search_nulls)
 	return find_ok;
 }
 
+/*
+ * Search settings of the feature space in the aqo_fspace_settings table.
+ * Values are returned in order of the table columns. They refer to a copy of
+ * the tuple, allocated in the current memory context.
+ */
+bool
+find_fspace_settings(int fhash, Datum *values, bool *nulls)
+{
+	Relation	hrel;
+	Relation	irel;
+	HeapTuple	tuple;
+	TupleTableSlot *slot;
+	bool		shouldFree;
+	IndexScanDesc scan;
+	ScanKeyData key;
+	bool		find_ok = false;
+
+	if (!open_aqo_relation("public", "aqo_fspace_settings",
+						   "aqo_fspace_settings_pkey",
+						   AccessShareLock, &hrel, &irel))
+		return false;
+
+	scan = index_beginscan(hrel, irel, SnapshotSelf, 1, 0);
+	ScanKeyInit(&key, 1, BTEqualStrategyNumber, F_INT4EQ, Int32GetDatum(fhash));
+	index_rescan(scan, &key, 1, NULL, 0);
+
+	slot = MakeSingleTupleTableSlot(hrel->rd_att, &TTSOpsBufferHeapTuple);
+	find_ok = index_getnext_slot(scan, ForwardScanDirection, slot);
+
+	if (find_ok)
+	{
+		tuple = ExecFetchSlotHeapTuple(slot, true, &shouldFree);
+		Assert(shouldFree != true);
+		heap_deform_tuple(heap_copytuple(tuple), hrel->rd_att, values, nulls);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	index_endscan(scan);
+	index_close(irel, AccessShareLock);
+	table_close(hrel, AccessShareLock);
+
+	return find_ok;
+}
+
+/*
+ * Returns the record of the aqo_plan_baselines table for the query class.
+ */
+bool
+find_baseline(int qhash, Datum *values, bool *nulls)
+{
+	Relation	hrel;
+	Relation	irel;
+	HeapTuple	tuple;
+	TupleTableSlot *slot;
+	bool		shouldFree;
+	IndexScanDesc scan;
+	ScanKeyData key;
+	bool		find_ok = false;
+
+	if (!open_aqo_relation("public", "aqo_plan_baselines",
+						   "aqo_plan_baselines_pkey",
+						   AccessShareLock, &hrel, &irel))
+		return false;
+
+	scan = index_beginscan(hrel, irel, SnapshotSelf, 1, 0);
+	ScanKeyInit(&key, 1, BTEqualStrategyNumber, F_INT4EQ, Int32GetDatum(qhash));
+	index_rescan(scan, &key, 1, NULL, 0);
+
+	slot = MakeSingleTupleTableSlot(hrel->rd_att, &TTSOpsBufferHeapTuple);
+	find_ok = index_getnext_slot(scan, ForwardScanDirection, slot);
+
+	if (find_ok)
+	{
+		tuple = ExecFetchSlotHeapTuple(slot, true, &shouldFree);
+		Assert(shouldFree != true);
+		heap_deform_tuple(heap_copytuple(tuple), hrel->rd_att, values, nulls);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	index_endscan(scan);
+	index_close(irel, AccessShareLock);
+	table_close(hrel, AccessShareLock);
+
+	return find_ok;
+}
+
+/*
+ * Store the plan baseline of the query class. The pinned flag of an existing
+ * record is kept.
+ * Refuse to update, if any concurrent transaction is changing the record.
+ */
+bool
+update_baseline(int qhash, const char *signature)
+{
+	Relation	hrel;
+	Relation	irel;
+	TupleTableSlot *slot;
+	HeapTuple	tuple,
+				nw_tuple;
+	Datum		values[Natts_baselines];
+	bool		isnull[Natts_baselines] = { false, false, false, false };
+	bool		replace[Natts_baselines] = { false, true, false, true };
+	bool		shouldFree;
+	bool		result = true;
+	bool		update_indexes;
+	IndexScanDesc scan;
+	ScanKeyData key;
+	SnapshotData snap;
+
+	/* Couldn't allow to write if xact must be read-only. */
+	if (XactReadOnly)
+		return false;
+
+	if (!open_aqo_relation("public", "aqo_plan_baselines",
+						   "aqo_plan_baselines_pkey",
+						   RowExclusiveLock, &hrel, &irel))
+		return false;
+
+	InitDirtySnapshot(snap);
+	scan = index_beginscan(hrel, irel, &snap, 1, 0);
+	ScanKeyInit(&key, 1, BTEqualStrategyNumber, F_INT4EQ, Int32GetDatum(qhash));
+
+	index_rescan(scan, &key, 1, NULL, 0);
+	slot = MakeSingleTupleTableSlot(hrel->rd_att, &TTSOpsBufferHeapTuple);
+
+	values[Anum_baseline_query_hash - 1] = Int32GetDatum(qhash);
+	values[Anum_baseline_signature - 1] = CStringGetTextDatum(signature);
+	values[Anum_baseline_pinned - 1] = BoolGetDatum(false);
+	values[Anum_baseline_captured - 1] =
+								TimestampTzGetDatum(GetCurrentTimestamp());
+
+	if (!index_getnext_slot(scan, ForwardScanDirection, slot))
+	{
+		tuple = heap_form_tuple(RelationGetDescr(hrel), values, isnull);
+		simple_heap_insert(hrel, tuple);
+		my_index_insert(irel, values, isnull, &(tuple->t_self),
+						hrel, UNIQUE_CHECK_YES);
+	}
+	else if (!TransactionIdIsValid(snap.xmin) &&
+			 !TransactionIdIsValid(snap.xmax))
+	{
+		tuple = ExecFetchSlotHeapTuple(slot, true, &shouldFree);
+		Assert(shouldFree != true);
+		nw_tuple = heap_modify_tuple(tuple, hrel->rd_att, values, isnull, replace);
+
+		if (my_simple_heap_update(hrel, &(nw_tuple->t_self), nw_tuple,
+								  &update_indexes))
+		{
+			if (update_indexes)
+				my_index_insert(irel, values, isnull,
+								&(nw_tuple->t_self),
+								hrel, UNIQUE_CHECK_YES);
+		}
+		else
+			/* The user has changed the record concurrently. */
+			result = false;
+	}
+	else
+		result = false;
+
+	ExecDropSingleTupleTableSlot(slot);
+	index_endscan(scan);
+	index_close(irel, RowExclusiveLock);
+	table_close(hrel, RowExclusiveLock);
+
+	CommandCounterIncrement();
+	return result;
+}
+
+/*
+ * Remove the plan baseline of the query class.
+ * Refuse to remove, if any concurrent transaction is changing the record.
+ */
+bool
+delete_baseline(int qhash)
+{
+	Relation	hrel;
+	Relation	irel;
+	TupleTableSlot *slot;
+	HeapTuple	tuple;
+	bool		shouldFree;
+	bool		result = false;
+	IndexScanDesc scan;
+	ScanKeyData key;
+	SnapshotData snap;
+
+	/* Couldn't allow to write if xact must be read-only. */
+	if (XactReadOnly)
+		return false;
+
+	if (!open_aqo_relation("public", "aqo_plan_baselines",
+						   "aqo_plan_baselines_pkey",
+						   RowExclusiveLock, &hrel, &irel))
+		return false;
+
+	InitDirtySnapshot(snap);
+	scan = index_beginscan(hrel, irel, &snap, 1, 0);
+	ScanKeyInit(&key, 1, BTEqualStrategyNumber, F_INT4EQ, Int32GetDatum(qhash));
+
+	index_rescan(scan, &key, 1, NULL, 0);
+	slot = MakeSingleTupleTableSlot(hrel->rd_att, &TTSOpsBufferHeapTuple);
+
+	if (index_getnext_slot(scan, ForwardScanDirection, slot) &&
+		!TransactionIdIsValid(snap.xmin) && !TransactionIdIsValid(snap.xmax))
+	{
+		tuple = ExecFetchSlotHeapTuple(slot, true, &shouldFree);
+		Assert(shouldFree != true);
+		simple_heap_delete(hrel, &(tuple->t_self));
+		result = true;
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	index_endscan(scan);
+	index_close(irel, RowExclusiveLock);
+	table_close(hrel, RowExclusiveLock);
+
+	CommandCounterIncrement();
+	return result;
+}
+
 /*
  * Update query status in intelligent mode.
  *
@@ -233,6 +487,9 @@ update_query(int qhash, int fhash,
 	index_close(irel, RowExclusiveLock);
 	table_close(hrel, RowExclusiveLock);
 
+	/* The record will be cached again after commit of the transaction. */
+	settings_cache_forget(qhash);
+
 	CommandCounterIncrement();
 	return result;
 }
@@ -359,6 +616,11 @@ deform_oids_vector(Datum datum)
  *			of the objects
  * 'rows' is the pointer in which the function stores actual number of
  *			objects in the given feature space
+ *
+ * In the frozen mode the published image of the knowledge base is used
+ * exclusively, if it exists.
+ * Otherwise, search the shared cache of feature subspaces at first. It doesn't
+ * store relids, so the cache can't be used if the caller requests them.
  */
 bool
 load_fss(int fhash, int fss_hash,
@@ -377,6 +639,13 @@ load_fss(int fhash, int fss_hash,
 	bool		isnull[6];
 	bool		success = true;
 
+	if (aqo_mode == AQO_MODE_FROZEN && relids == NULL && snapshot_is_active())
+		return snapshot_load_fss(fhash, fss_hash, ncols, matrix, targets, rows);
+
+	if (relids == NULL &&
+		fss_cache_lookup(fhash, fss_hash, ncols, matrix, targets, rows))
+		return true;
+
 	if (!open_aqo_relation("public", "aqo_data",
 						   "aqo_fss_access_idx",
 						   AccessShareLock, &hrel, &irel))
@@ -413,6 +682,9 @@ load_fss(int fhash, int fss_hash,
 
 			if (relids != NULL)
 				*relids = deform_oids_vector(values[5]);
+
+			(void) fss_cache_store(fhash, fss_hash, *rows, ncols,
+								   matrix, targets);
 		}
 		else
 			elog(ERROR, "unexpected number of features for hash (%d, %d):\
@@ -511,6 +783,7 @@ update_fss(int fhash, int fsshash, int nrows, int ncols,
 		simple_heap_insert(hrel, tuple);
 		my_index_insert(irel, values, isnull, &(tuple->t_self),
 														hrel, UNIQUE_CHECK_YES);
+		insert_other_indexes(hrel, irel, tuple);
 	}
 	else if (!TransactionIdIsValid(snap.xmin) && !TransactionIdIsValid(snap.xmax))
 	{
@@ -530,9 +803,12 @@ update_fss(int fhash, int fsshash, int nrows, int ncols,
 															&update_indexes))
 		{
 			if (update_indexes)
+			{
 				my_index_insert(irel, values, isnull,
 								&(nw_tuple->t_self),
 								hrel, UNIQUE_CHECK_YES);
+				insert_other_indexes(hrel, irel, nw_tuple);
+			}
 			result = true;
 		}
 		else
@@ -560,6 +836,13 @@ update_fss(int fhash, int fsshash, int nrows, int ncols,
 	index_close(irel, RowExclusiveLock);
 	table_close(hrel, RowExclusiveLock);
 
+	/* Keep the shared cache consistent with the knowledge base. */
+	if (result)
+	{
+		(void) fss_cache_store(fhash, fsshash, nrows, ncols, matrix, targets);
+		fss_usage_touch(fhash, fsshash, false);
+	}
+
 	CommandCounterIncrement();
 	return result;
 }
@@ -898,6 +1181,74 @@ my_index_insert(Relation indexRelation,
 #endif
 }
 
+/*
+ * AQO maintains the access index of its table by itself. Insert the tuple into
+ * all other indexes of the table, like the index on relation OIDs of the
+ * aqo_data table. Expressions and predicates of the indexes are evaluated in
+ * a private executor state.
+ */
+static void
+insert_other_indexes(Relation hrel, Relation irel, HeapTuple tuple)
+{
+	List		   *indexes = RelationGetIndexList(hrel);
+	ListCell	   *lc;
+	EState		   *estate = NULL;
+	ExprContext	   *econtext = NULL;
+	TupleTableSlot *slot = NULL;
+
+	foreach(lc, indexes)
+	{
+		Oid			indexoid = lfirst_oid(lc);
+		Relation	index;
+		IndexInfo  *indexInfo;
+		Datum		values[INDEX_MAX_KEYS];
+		bool		isnull[INDEX_MAX_KEYS];
+
+		if (indexoid == RelationGetRelid(irel))
+			continue;
+
+		index = index_open(indexoid, RowExclusiveLock);
+		indexInfo = BuildIndexInfo(index);
+
+		if (!indexInfo->ii_ReadyForInserts)
+		{
+			index_close(index, RowExclusiveLock);
+			continue;
+		}
+
+		if (estate == NULL)
+		{
+			estate = CreateExecutorState();
+			econtext = GetPerTupleExprContext(estate);
+			slot = MakeSingleTupleTableSlot(RelationGetDescr(hrel),
+											&TTSOpsHeapTuple);
+			ExecStoreHeapTuple(tuple, slot, false);
+			econtext->ecxt_scantuple = slot;
+		}
+
+		/* Skip a partial index, which doesn't cover the tuple. */
+		if (indexInfo->ii_Predicate != NIL &&
+			!ExecQual(ExecPrepareQual(indexInfo->ii_Predicate, estate),
+					  econtext))
+		{
+			index_close(index, RowExclusiveLock);
+			continue;
+		}
+
+		FormIndexDatum(indexInfo, slot, estate, values, isnull);
+		my_index_insert(index, values, isnull, &(tuple->t_self), hrel,
+						UNIQUE_CHECK_NO);
+		index_close(index, RowExclusiveLock);
+	}
+
+	if (estate != NULL)
+	{
+		ExecDropSingleTupleTableSlot(slot);
+		FreeExecutorState(estate);
+	}
+	list_free(indexes);
+}
+
 /* Creates a storage for hashes of deactivated queries */
 void
 init_deactivated_queries_storage(void)
@@ -1,10 +1,10 @@
 use strict;
 use warnings;
-use TestLib;
-use Test::More tests => 21;
-use PostgresNode;
+use PostgreSQL::Test::Utils;
+use Test::More tests => 23;
+use PostgreSQL::Test::Cluster;
 
-my $node = PostgresNode->new('aqotest');
+my $node = PostgreSQL::Test::Cluster->new('aqotest');
 $node->init;
 $node->append_conf('postgresql.conf', qq{
 						shared_preload_libraries = 'aqo'
@@ -17,6 +17,7 @@ $node->append_conf('postgresql.conf', qq{
 my $TRANSACTIONS = 1000;
 my $CLIENTS = 10;
 my $THREADS = 10;
+my $FAST_PATH_MIN_SAMPLES = 3; # See fast_path.c
 
 # General purpose variables.
 my $res;
@@ -297,4 +298,30 @@ $node->command_ok([ 'pgbench', '-T',
 					"5", '-c', "$CLIENTS", '-j', "$THREADS" , '-f', "$bank"],
 					'Conflicts with an AQO dropping command.');
 
+# ##############################################################################
+#
+# Check the fast path: AQO is switched off for the cheap query classes.
+#
+# ##############################################################################
+
+$node->safe_psql('postgres', "
+	DROP EXTENSION IF EXISTS aqo;
+	CREATE EXTENSION aqo;
+	ALTER SYSTEM SET aqo.mode = 'learn';
+	ALTER SYSTEM SET compute_query_id = 'on';
+	ALTER SYSTEM SET aqo.fast_path_overhead = 1.0E-6;
+	SELECT pg_reload_conf();
+");
+$node->command_ok([ 'pgbench', '-t',
+					"$TRANSACTIONS", '-c', "$CLIENTS", '-j', "$THREADS" ],
+					'pgbench with the fast path');
+
+# Each class is measured FAST_PATH_MIN_SAMPLES times before it goes to the fast
+# path. Concurrent clients may still plan it with AQO at that moment, but no
+# class may be seen by AQO more times.
+$res = $node->safe_psql('postgres', "
+	SELECT count(*) FROM aqo_query_stat
+	WHERE executions_with_aqo > $FAST_PATH_MIN_SAMPLES + $CLIENTS");
+is($res, 0, 'Cheap query classes go to the fast path');
+
 $node->stop();
@@ -4,11 +4,11 @@
 
 use strict;
 use warnings;
-use TestLib;
-use Test::More tests => 20;
-use PostgresNode;
+use PostgreSQL::Test::Utils;
+use Test::More tests => 22;
+use PostgreSQL::Test::Cluster;
 
-my $node = PostgresNode->new('profiling');
+my $node = PostgreSQL::Test::Cluster->new('profiling');
 $node->init;
 $node->append_conf('postgresql.conf', qq{
 						aqo.mode = 'disabled'
@@ -127,4 +127,19 @@ is($res, 5002);
 $res = $node->safe_psql('postgres', "SELECT * FROM aqo_clear_classes()");
 is($res, 8); # Should get the same number of classes as in single-threaded test.
 
+# ##############################################################################
+#
+# Check the change of the buffer size without a restart.
+#
+# ##############################################################################
+
+$node->safe_psql('postgres', "
+	ALTER SYSTEM SET aqo.profile_classes = 4;
+	SELECT pg_reload_conf();
+");
+$node->command_ok([ 'pgbench', '-t', "$TRANSACTIONS" ],
+'check eviction of classes from the profiling buffer');
+$res = $node->safe_psql('postgres', "SELECT count(*) <= 4 FROM aqo_show_classes()");
+is($res, 't'); # Least recently used classes were evicted.
+
 $node->stop();
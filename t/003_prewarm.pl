@@ -0,0 +1,93 @@
+#
+# Tests for the shared cache of feature subspaces and the prewarm worker
+#
+
+use strict;
+use warnings;
+use PostgreSQL::Test::Utils;
+use Test::More tests => 6;
+use Time::HiRes qw(usleep);
+use PostgreSQL::Test::Cluster;
+
+my $node = PostgreSQL::Test::Cluster->new('prewarm');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+						shared_preload_libraries = 'aqo'
+						aqo.mode = 'learn'
+						aqo.fss_cache_size = 100
+						aqo.prewarm = 'off'
+						log_statement = 'ddl' # reduce size of logs.
+					});
+
+# General purpose variables.
+my $res;
+my $plan;
+
+$node->start();
+$node->safe_psql('postgres', "
+	CREATE EXTENSION aqo;
+	CREATE TABLE t AS SELECT x FROM generate_series(1, 1000) AS x;
+	ANALYZE t;
+");
+
+# Learn the query.
+for (my $i = 0; $i < 3; $i++)
+{
+	$node->safe_psql('postgres', "SELECT count(*) FROM t WHERE x < 300");
+}
+$plan = $node->safe_psql('postgres', "
+	EXPLAIN (COSTS OFF, SUMMARY OFF)
+	SELECT count(*) FROM t WHERE x < 300");
+
+# ##############################################################################
+#
+# Check the prewarm worker, launched on startup.
+#
+# ##############################################################################
+
+$node->append_conf('postgresql.conf', qq{aqo.prewarm = 'on'});
+$node->restart();
+
+# Wait for the end of the worker.
+my $log = '';
+for (my $i = 0; $i < 1800; $i++)
+{
+	$log = PostgreSQL::Test::Utils::slurp_file($node->logfile);
+	last if ($log =~ /AQO prewarm: /);
+	usleep(100_000);
+}
+unlike($log, qr/nothing to load/, 'static prewarm worker found the knowledge base');
+like($log, qr/AQO prewarm: [1-9][0-9]* of [0-9]+ feature subspaces loaded/,
+	 'feature subspaces were loaded on startup');
+
+# Prediction made on the cached data must be the same.
+$res = $node->safe_psql('postgres', "
+	EXPLAIN (COSTS OFF, SUMMARY OFF)
+	SELECT count(*) FROM t WHERE x < 300");
+is($res, $plan, 'plan is the same after prewarm');
+
+# ##############################################################################
+#
+# Check the manual launch and invalidation of the cache.
+#
+# ##############################################################################
+
+$res = $node->safe_psql('postgres', "SELECT aqo_prewarm() > 0");
+is($res, 't', 'prewarm worker was launched by a user');
+
+# Manual change of the knowledge base resets the cache without errors.
+$node->safe_psql('postgres', "DELETE FROM aqo_data");
+$res = $node->safe_psql('postgres', "SELECT count(*) FROM t WHERE x < 300");
+is($res, 299, 'query works after the cache invalidation');
+
+# Without the cache the worker can't be launched.
+$node->append_conf('postgresql.conf', qq{
+						aqo.fss_cache_size = 0
+						aqo.prewarm = 'off'
+					});
+$node->restart();
+my ($ret, $stdout, $stderr) = $node->psql('postgres', "SELECT aqo_prewarm()");
+like($stderr, qr/feature subspaces cache is disabled/,
+	 'prewarm requires the cache');
+
+$node->stop();
@@ -0,0 +1,677 @@
+/*
+ *******************************************************************************
+ *
+ *	EXPORT AND IMPORT OF THE KNOWLEDGE BASE
+ *
+ * A trained knowledge base can be moved between installations by the
+ * aqo_export() and aqo_import() calls. The data is streamed into a file in a
+ * compact binary format instead of a text representation of the arrays.
+ *
+ * The file starts with a header and contains a sequence of tagged records:
+ * settings of query classes, query texts, feature subspaces and, optionally,
+ * execution statistics. Settings are written before all other records, so
+ * foreign keys of the AQO tables are satisfied during the import.
+ *
+ * The knowledge base refers to relations by their OIDs (query and feature
+ * space hashes depend on them too). So, an import makes sense only into a
+ * database with the same OIDs of relations, for example into a physical copy
+ * of the source database.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2021, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/transfer.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "storage/lmgr.h"
+#include "tcop/utility.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+
+#include "aqo.h"
+#include "model.h"
+
+
+#define AQO_EXPORT_MAGIC	(0xA0E0B001)
+#define AQO_EXPORT_VERSION	(1)
+
+/* Flags of the file header */
+#define AQO_EXPORT_WITH_STATS	(0x01)
+
+/* Record tags */
+#define AQO_RECORD_QUERY	'Q'
+#define AQO_RECORD_TEXT		'T'
+#define AQO_RECORD_DATA		'D'
+#define AQO_RECORD_STAT		'S'
+#define AQO_RECORD_END		'E'
+
+/* Number of tuples fetched from a cursor at once */
+#define AQO_EXPORT_BATCH	(1000)
+
+typedef struct ExportHeader
+{
+	uint32	magic;
+	uint32	version;
+	uint32	flags;
+	uint32	double_size;	/* protects from an incompatible platform */
+} ExportHeader;
+
+/*
+ * What to do with an object which already exists in the knowledge base.
+ */
+typedef enum
+{
+	AQO_IMPORT_REPLACE,		/* Overwrite by the imported one */
+	AQO_IMPORT_MERGE,		/* Learn feature subspaces on imported objects */
+	AQO_IMPORT_SKIP			/* Keep the existed one */
+} AQOImportMode;
+
+typedef struct TransferFile
+{
+	FILE	   *file;
+	const char *path;
+} TransferFile;
+
+typedef void (*export_record_fn) (TransferFile *tf, HeapTuple tuple,
+								  TupleDesc tupdesc);
+
+PG_FUNCTION_INFO_V1(aqo_export);
+PG_FUNCTION_INFO_V1(aqo_import);
+
+
+static void
+write_bytes(TransferFile *tf, const void *data, Size len)
+{
+	if (len > 0 && fwrite(data, 1, len, tf->file) != len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", tf->path)));
+}
+
+static void
+read_bytes(TransferFile *tf, void *data, Size len)
+{
+	if (len > 0 && fread(data, 1, len, tf->file) != len)
+	{
+		if (ferror(tf->file))
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read file \"%s\": %m", tf->path)));
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("unexpected end of AQO export file \"%s\"",
+							tf->path)));
+	}
+}
+
+static void
+write_int(TransferFile *tf, int32 value)
+{
+	write_bytes(tf, &value, sizeof(value));
+}
+
+static int32
+read_int(TransferFile *tf)
+{
+	int32	value;
+
+	read_bytes(tf, &value, sizeof(value));
+	return value;
+}
+
+/*
+ * Check a length read from the file to not allocate a garbage amount of memory.
+ */
+static int32
+read_length(TransferFile *tf, int32 max)
+{
+	int32	len = read_int(tf);
+
+	if (len < 0 || len > max)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid length %d in AQO export file \"%s\"",
+						len, tf->path)));
+	return len;
+}
+
+/*
+ * Write a float8 array as a number of elements and the elements. NULL array is
+ * written as an empty one.
+ */
+static void
+write_array(TransferFile *tf, HeapTuple tuple, TupleDesc tupdesc, int attnum)
+{
+	Datum		datum;
+	bool		isnull;
+	ArrayType  *array;
+	Datum	   *elems;
+	int			nelems;
+	int			i;
+
+	datum = SPI_getbinval(tuple, tupdesc, attnum, &isnull);
+	if (isnull)
+	{
+		write_int(tf, 0);
+		return;
+	}
+
+	array = DatumGetArrayTypeP(datum);
+	deconstruct_array(array, FLOAT8OID, 8, FLOAT8PASSBYVAL, 'd',
+					  &elems, NULL, &nelems);
+	write_int(tf, nelems);
+	for (i = 0; i < nelems; i++)
+	{
+		double	value = DatumGetFloat8(elems[i]);
+
+		write_bytes(tf, &value, sizeof(value));
+	}
+	pfree(elems);
+}
+
+/*
+ * Read an array, written by the write_array(). Only last 'max' elements are
+ * kept. Returns number of stored elements.
+ */
+static int
+read_array(TransferFile *tf, double *dest, int max)
+{
+	int		nelems = read_length(tf, MaxAllocSize / sizeof(double));
+	int		skip = Max(nelems - max, 0);
+	int		i;
+
+	for (i = 0; i < nelems; i++)
+	{
+		double	value;
+
+		read_bytes(tf, &value, sizeof(value));
+		if (i >= skip)
+			dest[i - skip] = value;
+	}
+	return nelems - skip;
+}
+
+static void
+export_query(TransferFile *tf, HeapTuple tuple, TupleDesc tupdesc)
+{
+	bool	isnull;
+	char	flags[3];
+
+	write_int(tf, DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull)));
+	write_int(tf, DatumGetInt32(SPI_getbinval(tuple, tupdesc, 2, &isnull)));
+	flags[0] = DatumGetBool(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+	flags[1] = DatumGetBool(SPI_getbinval(tuple, tupdesc, 4, &isnull));
+	flags[2] = DatumGetBool(SPI_getbinval(tuple, tupdesc, 5, &isnull));
+	write_bytes(tf, flags, sizeof(flags));
+}
+
+static void
+export_text(TransferFile *tf, HeapTuple tuple, TupleDesc tupdesc)
+{
+	bool	isnull;
+	text   *txt;
+
+	write_int(tf, DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull)));
+	txt = DatumGetTextPP(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+	write_int(tf, VARSIZE_ANY_EXHDR(txt));
+	write_bytes(tf, VARDATA_ANY(txt), VARSIZE_ANY_EXHDR(txt));
+}
+
+/*
+ * The matrix of features is written as a flat array, its shape is defined by
+ * the number of features and the number of targets.
+ */
+static void
+export_data(TransferFile *tf, HeapTuple tuple, TupleDesc tupdesc)
+{
+	bool		isnull;
+	Datum		datum;
+
+	write_int(tf, DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull)));
+	write_int(tf, DatumGetInt32(SPI_getbinval(tuple, tupdesc, 2, &isnull)));
+	write_int(tf, DatumGetInt32(SPI_getbinval(tuple, tupdesc, 3, &isnull)));
+	write_array(tf, tuple, tupdesc, 4);
+	write_array(tf, tuple, tupdesc, 5);
+
+	datum = SPI_getbinval(tuple, tupdesc, 6, &isnull);
+	if (isnull)
+		write_int(tf, 0);
+	else
+	{
+		Datum  *elems;
+		int		nelems;
+		int		i;
+
+		deconstruct_array(DatumGetArrayTypeP(datum),
+						  OIDOID, sizeof(Oid), true, TYPALIGN_INT,
+						  &elems, NULL, &nelems);
+		write_int(tf, nelems);
+		for (i = 0; i < nelems; i++)
+		{
+			Oid		relid = DatumGetObjectId(elems[i]);
+
+			write_bytes(tf, &relid, sizeof(relid));
+		}
+		pfree(elems);
+	}
+}
+
+static void
+export_stat(TransferFile *tf, HeapTuple tuple, TupleDesc tupdesc)
+{
+	bool	isnull;
+	int64	value;
+	int		i;
+
+	write_int(tf, DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull)));
+	for (i = 2; i <= 7; i++)
+		write_array(tf, tuple, tupdesc, i);
+
+	for (i = 8; i <= 9; i++)
+	{
+		value = DatumGetInt64(SPI_getbinval(tuple, tupdesc, i, &isnull));
+		if (isnull)
+			value = 0;
+		write_bytes(tf, &value, sizeof(value));
+	}
+}
+
+/*
+ * Stream results of the query into the file through a cursor to not
+ * materialize the whole table in memory.
+ */
+static int64
+export_table(TransferFile *tf, const char *query, char tag,
+			 export_record_fn export_record)
+{
+	SPIPlanPtr	plan;
+	Portal		portal;
+	int64		nrecords = 0;
+
+	plan = SPI_prepare(query, 0, NULL);
+	if (plan == NULL)
+		elog(ERROR, "AQO export: SPI_prepare failed: error code %d",
+			 SPI_result);
+	portal = SPI_cursor_open(NULL, plan, NULL, NULL, true);
+
+	for (;;)
+	{
+		uint64	i;
+
+		SPI_cursor_fetch(portal, true, AQO_EXPORT_BATCH);
+		if (SPI_processed == 0)
+			break;
+
+		for (i = 0; i < SPI_processed; i++)
+		{
+			write_bytes(tf, &tag, 1);
+			export_record(tf, SPI_tuptable->vals[i], SPI_tuptable->tupdesc);
+			nrecords++;
+		}
+		SPI_freetuptable(SPI_tuptable);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	SPI_cursor_close(portal);
+	SPI_freeplan(plan);
+	return nrecords;
+}
+
+/*
+ * Write the knowledge base of the current database into the file.
+ * Returns number of written records.
+ */
+Datum
+aqo_export(PG_FUNCTION_ARGS)
+{
+	char		   *path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	bool			with_stats = PG_GETARG_BOOL(1);
+	TransferFile	tf;
+	ExportHeader	header;
+	int64			nrecords = 0;
+	char			tag = AQO_RECORD_END;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("only superuser can export the AQO knowledge base")));
+
+	tf.path = path;
+	tf.file = AllocateFile(path, PG_BINARY_W);
+	if (tf.file == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for writing: %m", path)));
+
+	header.magic = AQO_EXPORT_MAGIC;
+	header.version = AQO_EXPORT_VERSION;
+	header.flags = with_stats ? AQO_EXPORT_WITH_STATS : 0;
+	header.double_size = sizeof(double);
+	write_bytes(&tf, &header, sizeof(header));
+
+	SPI_connect();
+	nrecords += export_table(&tf,
+		"SELECT query_hash, fspace_hash, learn_aqo, use_aqo, auto_tuning "
+		"FROM public.aqo_queries ORDER BY query_hash",
+		AQO_RECORD_QUERY, export_query);
+	nrecords += export_table(&tf,
+		"SELECT query_hash, query_text FROM public.aqo_query_texts "
+		"ORDER BY query_hash",
+		AQO_RECORD_TEXT, export_text);
+	nrecords += export_table(&tf,
+		"SELECT fspace_hash, fsspace_hash, nfeatures, features, targets, oids "
+		"FROM public.aqo_data ORDER BY fspace_hash, fsspace_hash",
+		AQO_RECORD_DATA, export_data);
+	if (with_stats)
+		nrecords += export_table(&tf,
+			"SELECT query_hash, "
+			"execution_time_with_aqo, execution_time_without_aqo, "
+			"planning_time_with_aqo, planning_time_without_aqo, "
+			"cardinality_error_with_aqo, cardinality_error_without_aqo, "
+			"executions_with_aqo, executions_without_aqo "
+			"FROM public.aqo_query_stat ORDER BY query_hash",
+			AQO_RECORD_STAT, export_stat);
+	SPI_finish();
+
+	/* The end marker contains number of records to check integrity. */
+	write_bytes(&tf, &tag, 1);
+	write_bytes(&tf, &nrecords, sizeof(nrecords));
+
+	if (FreeFile(tf.file))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not close file \"%s\": %m", path)));
+
+	PG_RETURN_INT64(nrecords);
+}
+
+static void
+import_query(TransferFile *tf, AQOImportMode mode)
+{
+	int		qhash = read_int(tf);
+	int		fhash = read_int(tf);
+	char	flags[3];
+
+	read_bytes(tf, flags, sizeof(flags));
+
+	/* Settings of an existed query class are replaced only by request. */
+	if (mode != AQO_IMPORT_REPLACE)
+	{
+		Datum	values[5];
+		bool	nulls[5];
+
+		if (find_query(qhash, values, nulls))
+			return;
+	}
+
+	if (!update_query(qhash, fhash, flags[0], flags[1], flags[2]))
+		elog(ERROR, "AQO import: can't store settings of the query %d", qhash);
+}
+
+static void
+import_text(TransferFile *tf)
+{
+	int		qhash = read_int(tf);
+	int		len = read_length(tf, MaxAllocSize - 1);
+	char   *str = palloc(len + 1);
+
+	read_bytes(tf, str, len);
+	str[len] = '\0';
+
+	/* A text is defined by the query hash, so it isn't replaced. */
+	(void) add_query_text(qhash, str);
+	pfree(str);
+}
+
+/*
+ * Import a feature subspace. In the merge mode each imported object is learned
+ * into the existed subspace, as if it was obtained from an execution.
+ */
+static void
+import_data(TransferFile *tf, AQOImportMode mode)
+{
+	int			fhash = read_int(tf);
+	int			fss_hash = read_int(tf);
+	int			ncols = read_length(tf, INT_MAX / aqo_K);
+	int			nfeatures;
+	int			nrows;
+	int			nrelids;
+	double	   *features;
+	double	  **matrix;
+	double		targets[aqo_K];
+	List	   *relids = NIL;
+	LOCKTAG		tag;
+	int			i;
+
+	features = palloc0(sizeof(double) * Max(ncols, 1) * aqo_K);
+	nfeatures = read_array(tf, features, ncols * aqo_K);
+	nrows = read_array(tf, targets, aqo_K);
+
+	if (ncols > 0 && nfeatures != nrows * ncols)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("AQO import: inconsistent shape of the feature subspace (%d, %d)",
+						fhash, fss_hash)));
+
+	nrelids = read_length(tf, MaxAllocSize / sizeof(Oid));
+	for (i = 0; i < nrelids; i++)
+	{
+		Oid		relid;
+
+		read_bytes(tf, &relid, sizeof(relid));
+		relids = lappend_oid(relids, relid);
+	}
+
+	init_lock_tag(&tag, (uint32) fhash, (uint32) fss_hash);
+	LockAcquire(&tag, ExclusiveLock, false, false);
+
+	if (mode == AQO_IMPORT_REPLACE ||
+		!load_fss(fhash, fss_hash, 0, NULL, NULL, NULL, NULL))
+	{
+		matrix = palloc(sizeof(double *) * aqo_K);
+		for (i = 0; i < nrows; i++)
+			matrix[i] = features + i * ncols;
+
+		if (!update_fss(fhash, fss_hash, nrows, ncols, matrix, targets, relids))
+			elog(ERROR, "AQO import: can't store the feature subspace (%d, %d)",
+				 fhash, fss_hash);
+	}
+	else if (mode == AQO_IMPORT_MERGE)
+	{
+		double	local_targets[aqo_K];
+		double *rows[aqo_K];
+		int		local_nrows;
+		AQOModelParams params;
+
+		matrix = palloc(sizeof(double *) * aqo_K);
+		for (i = 0; i < aqo_K; i++)
+			matrix[i] = palloc0(sizeof(double) * Max(ncols, 1));
+
+		if (!load_fss(fhash, fss_hash, ncols, matrix, local_targets,
+					  &local_nrows, NULL))
+			elog(ERROR, "AQO import: can't load the feature subspace (%d, %d)",
+				 fhash, fss_hash);
+
+		for (i = 0; i < nrows; i++)
+			rows[i] = features + i * ncols;
+		aqo_fspace_params(fhash, &params);
+		local_nrows = aqo_fspace_model(fhash)->merge(local_nrows, ncols, matrix,
+													 local_targets, nrows, rows,
+													 targets, &params);
+
+		if (!update_fss(fhash, fss_hash, local_nrows, ncols, matrix,
+						local_targets, relids))
+			elog(ERROR, "AQO import: can't store the feature subspace (%d, %d)",
+				 fhash, fss_hash);
+	}
+
+	LockRelease(&tag, ExclusiveLock, false);
+	pfree(features);
+	list_free(relids);
+}
+
+/*
+ * Execution statistics can't be merged reasonably. They are stored only if the
+ * query class hasn't any local statistics or by request.
+ */
+static void
+import_stat(TransferFile *tf, AQOImportMode mode)
+{
+	int			qhash = read_int(tf);
+	QueryStat  *stat = palloc_query_stat();
+	QueryStat  *local;
+
+	stat->execution_time_with_aqo_size =
+		read_array(tf, stat->execution_time_with_aqo, aqo_stat_size);
+	stat->execution_time_without_aqo_size =
+		read_array(tf, stat->execution_time_without_aqo, aqo_stat_size);
+	stat->planning_time_with_aqo_size =
+		read_array(tf, stat->planning_time_with_aqo, aqo_stat_size);
+	stat->planning_time_without_aqo_size =
+		read_array(tf, stat->planning_time_without_aqo, aqo_stat_size);
+	stat->cardinality_error_with_aqo_size =
+		read_array(tf, stat->cardinality_error_with_aqo, aqo_stat_size);
+	stat->cardinality_error_without_aqo_size =
+		read_array(tf, stat->cardinality_error_without_aqo, aqo_stat_size);
+	read_bytes(tf, &stat->executions_with_aqo, sizeof(int64));
+	read_bytes(tf, &stat->executions_without_aqo, sizeof(int64));
+
+	local = get_aqo_stat(qhash);
+	if (mode == AQO_IMPORT_REPLACE || local == NULL ||
+		local->executions_with_aqo + local->executions_without_aqo == 0)
+		update_aqo_stat(qhash, stat);
+
+	if (local != NULL)
+		pfree_query_stat(local);
+	pfree_query_stat(stat);
+}
+
+/*
+ * Load the knowledge base from the file, written by the aqo_export().
+ * Returns number of imported records.
+ */
+Datum
+aqo_import(PG_FUNCTION_ARGS)
+{
+	char		   *path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	char		   *modestr = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	AQOImportMode	mode;
+	TransferFile	tf;
+	ExportHeader	header;
+	int64			nrecords = 0;
+	int64			expected;
+	MemoryContext	tmpCxt;
+	MemoryContext	oldCxt;
+	int				save_nestlevel;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("only superuser can import the AQO knowledge base")));
+
+	if (pg_strcasecmp(modestr, "replace") == 0)
+		mode = AQO_IMPORT_REPLACE;
+	else if (pg_strcasecmp(modestr, "merge") == 0)
+		mode = AQO_IMPORT_MERGE;
+	else if (pg_strcasecmp(modestr, "skip") == 0)
+		mode = AQO_IMPORT_SKIP;
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid AQO import mode \"%s\"", modestr),
+				 errhint("Valid modes are \"replace\", \"merge\" and \"skip\".")));
+
+	PreventCommandIfReadOnly("aqo_import()");
+
+	tf.path = path;
+	tf.file = AllocateFile(path, PG_BINARY_R);
+	if (tf.file == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for reading: %m", path)));
+
+	read_bytes(&tf, &header, sizeof(header));
+	if (header.magic != AQO_EXPORT_MAGIC ||
+		header.double_size != sizeof(double))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("file \"%s\" isn't an AQO export file", path)));
+	if (header.version != AQO_EXPORT_VERSION)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("unsupported version %u of AQO export file \"%s\"",
+						header.version, path)));
+
+	/*
+	 * The frozen mode could read feature subspaces from the published
+	 * snapshot. Merge must see the actual content of the tables.
+	 */
+	save_nestlevel = NewGUCNestLevel();
+	(void) set_config_option("aqo.mode", "controlled",
+							 PGC_USERSET, PGC_S_SESSION,
+							 GUC_ACTION_SAVE, true, 0, false);
+
+	tmpCxt = AllocSetContextCreate(CurrentMemoryContext,
+								   "AQO import",
+								   ALLOCSET_DEFAULT_SIZES);
+	oldCxt = MemoryContextSwitchTo(tmpCxt);
+
+	for (;;)
+	{
+		char	tag;
+
+		read_bytes(&tf, &tag, 1);
+		if (tag == AQO_RECORD_END)
+			break;
+
+		switch (tag)
+		{
+			case AQO_RECORD_QUERY:
+				import_query(&tf, mode);
+				break;
+			case AQO_RECORD_TEXT:
+				import_text(&tf);
+				break;
+			case AQO_RECORD_DATA:
+				import_data(&tf, mode);
+				break;
+			case AQO_RECORD_STAT:
+				import_stat(&tf, mode);
+				break;
+			default:
+				ereport(ERROR,
+						(errcode(ERRCODE_DATA_CORRUPTED),
+						 errmsg("unknown record type %d in AQO export file \"%s\"",
+								tag, path)));
+		}
+
+		nrecords++;
+		MemoryContextReset(tmpCxt);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	MemoryContextSwitchTo(oldCxt);
+	MemoryContextDelete(tmpCxt);
+	AtEOXact_GUC(true, save_nestlevel);
+
+	read_bytes(&tf, &expected, sizeof(expected));
+	if (expected != nrecords)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("AQO export file \"%s\" contains %lld records instead of %lld",
+						path, (long long) nrecords, (long long) expected)));
+
+	FreeFile(tf.file);
+	PG_RETURN_INT64(nrecords);
+}